@@ -0,0 +1,321 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for the adaptive (FGK) huffman code, where
+ * the encoder and decoder both start from an empty tree and update it
+ * after every symbol. No frequencies have to be counted up front and no
+ * code has to be stored, so a stream is encoded in a single pass and
+ * every symbol can be sent as soon as it is read.
+ * Symbols not seen yet are sent as the code of the "not yet transmitted"
+ * (NYT) leaf followed by the symbol in ADAPTIVE_LITERAL_BITS bits, and
+ * the stream ends with the ADAPTIVE_END symbol.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "huffman.h"
+
+/* Function Declarations */
+void writeAdaptiveCode(struct AdaptiveTree* tree, int node, struct BitWriter* writer);
+void swapAdaptiveNodes(struct AdaptiveTree* tree, int first, int second);
+int spawnAdaptiveLeaf(struct AdaptiveTree* tree, int symbol);
+
+/*
+ * Sets up a tree holding only the NYT leaf, which starts out as the root
+
+ * struct AdaptiveTree* tree - tree to set up
+*/
+void initAdaptiveTree(struct AdaptiveTree* tree)
+{
+  int i;
+  for(i = 0; i < ADAPTIVE_SYMBOLS; i++) tree->leaf[i] = -1;
+
+  tree->nyt = ADAPTIVE_ROOT;
+  tree->nodes[ADAPTIVE_ROOT].weight = 0;
+  tree->nodes[ADAPTIVE_ROOT].parent = -1;
+  tree->nodes[ADAPTIVE_ROOT].left = -1;
+  tree->nodes[ADAPTIVE_ROOT].right = -1;
+  tree->nodes[ADAPTIVE_ROOT].symbol = -1;
+}
+
+/*
+ * Splits the NYT leaf in two, the left child becoming the new NYT leaf
+ * and the right child a leaf for a symbol seen for the first time.
+
+ * struct AdaptiveTree* tree - tree to add to
+ * int symbol - symbol of the new leaf
+
+ * returns int - node number of the new leaf
+*/
+int spawnAdaptiveLeaf(struct AdaptiveTree* tree, int symbol)
+{
+  int parent = tree->nyt;
+  int nyt = parent - 2;
+  int leaf = parent - 1;
+
+  tree->nodes[parent].left = nyt;
+  tree->nodes[parent].right = leaf;
+
+  tree->nodes[nyt].weight = 0;
+  tree->nodes[nyt].parent = parent;
+  tree->nodes[nyt].left = -1;
+  tree->nodes[nyt].right = -1;
+  tree->nodes[nyt].symbol = -1;
+
+  tree->nodes[leaf].weight = 0;
+  tree->nodes[leaf].parent = parent;
+  tree->nodes[leaf].left = -1;
+  tree->nodes[leaf].right = -1;
+  tree->nodes[leaf].symbol = symbol;
+
+  tree->nyt = nyt;
+  tree->leaf[symbol] = leaf;
+  return leaf;
+}
+
+/*
+ * Swaps the subtrees at two node numbers. Each number keeps its place
+ * under its parent, only what hangs there is exchanged, so the links
+ * from the children and the symbols back up to them are fixed up.
+
+ * struct AdaptiveTree* tree - tree to change
+ * int first - node number of one subtree
+ * int second - node number of the other subtree
+*/
+void swapAdaptiveNodes(struct AdaptiveTree* tree, int first, int second)
+{
+  struct AdaptiveNode* a = &tree->nodes[first];
+  struct AdaptiveNode* b = &tree->nodes[second];
+  struct AdaptiveNode temp = *a;
+
+  a->weight = b->weight;
+  a->left = b->left;
+  a->right = b->right;
+  a->symbol = b->symbol;
+  b->weight = temp.weight;
+  b->left = temp.left;
+  b->right = temp.right;
+  b->symbol = temp.symbol;
+
+  if(a->left != -1)
+  {
+    tree->nodes[a->left].parent = first;
+    tree->nodes[a->right].parent = first;
+  }
+  else if(a->symbol >= 0) tree->leaf[a->symbol] = first;
+  else tree->nyt = first;
+
+  if(b->left != -1)
+  {
+    tree->nodes[b->left].parent = second;
+    tree->nodes[b->right].parent = second;
+  }
+  else if(b->symbol >= 0) tree->leaf[b->symbol] = second;
+  else tree->nyt = second;
+}
+
+/*
+ * Counts one more of a symbol, adding a leaf for it if it is new. Going
+ * from the symbol's leaf up to the root, each node first trades places
+ * with the highest numbered node of the same weight, so that weights
+ * still never decrease as node numbers go up once it is incremented.
+
+ * struct AdaptiveTree* tree - tree to update
+ * int symbol - symbol that was just sent
+*/
+void updateAdaptiveTree(struct AdaptiveTree* tree, int symbol)
+{
+  int node = tree->leaf[symbol];
+  if(node == -1) node = spawnAdaptiveLeaf(tree, symbol);
+
+  while(node != -1)
+  {
+    unsigned long weight = tree->nodes[node].weight;
+    int leader = node;
+
+    while(leader < ADAPTIVE_ROOT && tree->nodes[leader+1].weight == weight) leader++;
+    if(leader != node && leader != tree->nodes[node].parent)
+    {
+      swapAdaptiveNodes(tree, node, leader);
+      node = leader;
+    }
+
+    tree->nodes[node].weight++;
+    node = tree->nodes[node].parent;
+  }
+}
+
+/*
+ * Writes the current code of a node, found by following the parents
+ * up to the root. Codes may be longer than 64 bits, so the bits are
+ * collected 64 at a time and written out starting with the first.
+
+ * struct AdaptiveTree* tree - tree holding the node
+ * int node - node to write the code of
+ * struct BitWriter* writer - where the code goes
+*/
+void writeAdaptiveCode(struct AdaptiveTree* tree, int node, struct BitWriter* writer)
+{
+  uint64_t chunks[(ADAPTIVE_SYMBOLS + 63) / 64]; /* last bits of the code first */
+  unsigned int length = 0;
+  int i;
+
+  chunks[0] = 0;
+  while(tree->nodes[node].parent != -1)
+  {
+    int parent = tree->nodes[node].parent;
+    if(length % 64 == 0 && length > 0) chunks[length / 64] = 0;
+    if(tree->nodes[parent].right == node) chunks[length / 64] |= (uint64_t)1 << (length % 64);
+    length++;
+    node = parent;
+  }
+
+  if(length == 0) return;
+  i = (length - 1) / 64;
+  writeBits(writer, chunks[i], length - 64 * i);
+  for(i--; i >= 0; i--) writeBits(writer, chunks[i], 64);
+}
+
+/*
+ * Encodes a file with the adaptive code, reading it once from start
+ * to end, and ends the bits with ADAPTIVE_END.
+
+ * FILE* in - file to encode, may be a pipe
+ * FILE* out - file to write the encoded bits to
+ * unsigned long* freq - array of 256 filled with how often each symbol is seen
+
+ * returns unsigned long - how many symbols were encoded
+*/
+unsigned long encodeAdaptive(FILE* in, FILE* out, unsigned long* freq)
+{
+  struct AdaptiveTree* tree = (struct AdaptiveTree*)malloc(sizeof(struct AdaptiveTree));
+  struct BitWriter* writer = (struct BitWriter*)malloc(sizeof(struct BitWriter));
+  struct InputFile input;
+  const unsigned char* span = NULL;
+  unsigned long length = 0, pos = 0; /* span being encoded */
+  unsigned long total = 0;
+  int symbol, i;
+
+  for(i = 0; i < 256; i++) freq[i] = 0;
+  initAdaptiveTree(tree);
+  initBitWriter(writer, out);
+  openInput(&input, in);
+
+  while(1)
+  {
+    if(pos == length)
+    {
+      length = nextSpan(&input, &span);
+      pos = 0;
+    }
+    symbol = (pos < length) ? span[pos++] : ADAPTIVE_END;
+
+    if(tree->leaf[symbol] != -1) writeAdaptiveCode(tree, tree->leaf[symbol], writer);
+    else
+    {
+      writeAdaptiveCode(tree, tree->nyt, writer);
+      writeBits(writer, (uint64_t)symbol, ADAPTIVE_LITERAL_BITS);
+    }
+    if(symbol == ADAPTIVE_END) break;
+
+    updateAdaptiveTree(tree, symbol);
+    freq[symbol]++;
+    total++;
+  }
+
+  flushBits(writer);
+  closeInput(&input);
+  free(writer);
+  free(tree);
+  return total;
+}
+
+/*
+ * Decodes bits written by encodeAdaptive, following the tree a bit at a
+ * time since the codes change after every symbol.
+
+ * FILE* in - file to decode, positioned at the first encoded bit
+ * FILE* out - file to write decoded characters to
+
+ * returns int - 1 if everything up to ADAPTIVE_END was decoded
+ *               0 if the bits are corrupt or run out first
+*/
+int decodeAdaptive(FILE* in, FILE* out)
+{
+  struct AdaptiveTree* tree = (struct AdaptiveTree*)malloc(sizeof(struct AdaptiveTree));
+  struct InputFile input;
+  struct OutputFile output;
+  const unsigned char* span = NULL;
+  unsigned long length = 0, pos = 0; /* span being decoded */
+  unsigned int bitBuf = 0; /* current byte of input */
+  int bitCount = 0; /* unread bits left in bitBuf */
+  int decoded = 0;
+
+  initAdaptiveTree(tree);
+  openInput(&input, in);
+  openOutput(&output, out, 0); /* the length isn't known until the end */
+
+  while(1)
+  {
+    int node = ADAPTIVE_ROOT;
+    int symbol;
+
+    /* walking down to a leaf, 0 bits go left and 1 bits go right */
+    while(tree->nodes[node].left != -1)
+    {
+      if(bitCount == 0)
+      {
+        if(pos == length)
+        {
+          length = nextSpan(&input, &span);
+          pos = 0;
+          if(length == 0) break;
+        }
+        bitBuf = span[pos++];
+        bitCount = 8;
+      }
+      bitCount--;
+      node = ((bitBuf >> bitCount) & 1) ? tree->nodes[node].right : tree->nodes[node].left;
+    }
+    if(tree->nodes[node].left != -1) break;
+
+    symbol = tree->nodes[node].symbol;
+    if(node == tree->nyt)
+    {
+      int i;
+      symbol = 0;
+      for(i = 0; i < ADAPTIVE_LITERAL_BITS; i++)
+      {
+        if(bitCount == 0)
+        {
+          if(pos == length)
+          {
+            length = nextSpan(&input, &span);
+            pos = 0;
+            if(length == 0) break;
+          }
+          bitBuf = span[pos++];
+          bitCount = 8;
+        }
+        bitCount--;
+        symbol = (symbol << 1) | (int)((bitBuf >> bitCount) & 1);
+      }
+      /* a symbol only gets sent in full the first time */
+      if(i < ADAPTIVE_LITERAL_BITS || symbol >= ADAPTIVE_SYMBOLS || tree->leaf[symbol] != -1) break;
+    }
+
+    if(symbol == ADAPTIVE_END)
+    {
+      decoded = 1;
+      break;
+    }
+
+    if(output.used == output.capacity) flushOutput(&output);
+    output.data[output.used++] = (unsigned char)symbol;
+    updateAdaptiveTree(tree, symbol);
+  }
+
+  closeOutput(&output);
+  closeInput(&input);
+  free(tree);
+  return decoded;
+}
@@ -0,0 +1,509 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for encoding or decoding many files in one
+ * run, for when there are lots of small files and starting a process
+ * for each would take longer than the files themselves. Each thread
+ * works through the files one at a time in memory with a context and
+ * buffers of its own, kept from file to file, so once they have grown
+ * to the largest file nothing more is allocated. Batches are written in
+ * the canonical format, which has the smallest header for small files.
+*/
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "huffman.h"
+
+/* Scratch memory of one thread, kept from file to file */
+struct Lane
+{
+  struct HuffContext* context;
+  unsigned char* in; /* whole input file */
+  unsigned long inCapacity;
+  unsigned char* out; /* whole output file */
+  unsigned long outCapacity;
+  char* path; /* name of the output file */
+  unsigned long pathCapacity;
+  unsigned long files; /* files done */
+  unsigned long failed; /* files that couldn't be done */
+  uint64_t rawBytes; /* bytes before encoding or after decoding */
+  uint64_t encodedBytes; /* bytes after encoding or before decoding */
+};
+
+/* Everything the threads share */
+struct Batch
+{
+  int encoding; /* 1 to encode, 0 to decode */
+  const char* outDir; /* where the output files go */
+  char** names; /* every input file */
+  unsigned long numFiles;
+  unsigned long capacity;
+  unsigned long next; /* next file to hand out */
+  pthread_mutex_t lock; /* guards next */
+  struct Lane* lanes;
+};
+
+/* The output name of a file, for finding files that would share one */
+struct OutputEntry
+{
+  char* name;
+  unsigned long file; /* index of the input in the batch's names */
+};
+
+/* Function Declarations */
+int addInput(struct Batch* batch, const char* name);
+int addDirectory(struct Batch* batch, const char* dir);
+void addName(struct Batch* batch, const char* name, const char* dir);
+void batchTask(void* context, unsigned long index);
+int batchFile(struct Batch* batch, struct Lane* lane, const char* name);
+unsigned long readWhole(FILE* in, struct Lane* lane);
+void* growBuffer(void* buffer, unsigned long* capacity, unsigned long needed);
+const char* outputName(struct Batch* batch, struct Lane* lane, const char* name);
+unsigned long dropSharedOutputs(struct Batch* batch);
+int compareOutputs(const void* first, const void* second);
+
+/*
+ * Encodes or decodes every file named, on several threads. Each input
+ * may be a file, a directory, whose regular files are all taken, or "-"
+ * for a list of names on standard input, one per line. Outputs are named
+ * after their inputs: encoding adds ".huff" and decoding takes it off
+ * again, or adds ".dec" if it isn't there. A file whose output would
+ * have the same name as an earlier file's is left out as failed. When
+ * done, how many files and bytes went through and how fast is written
+ * to standard error.
+
+ * int encoding - 1 to encode, 0 to decode
+ * const char* outDir - directory the output files go in
+ * char** inputs - files, directories or "-"
+ * int numInputs - how many inputs there are
+ * int numThreads - threads to work on files at the same time
+ * int maxLength - longest code allowed when encoding, 0 for no limit
+
+ * returns int - 1 if every file was done
+ *               0 if any couldn't be read, written or decoded
+*/
+int runBatch(int encoding, const char* outDir, char** inputs, int numInputs,
+             int numThreads, int maxLength)
+{
+  struct Batch batch;
+  struct ThreadPool* pool;
+  unsigned long numLanes, files = 0, failed = 0, i;
+  uint64_t rawBytes = 0, encodedBytes = 0;
+  double start = wallClock();
+  double seconds;
+  int listed = 1;
+
+  batch.encoding = encoding;
+  batch.outDir = outDir;
+  batch.numFiles = 0;
+  batch.capacity = 64;
+  batch.names = (char**)malloc(sizeof(char*) * batch.capacity);
+  batch.next = 0;
+  for(i = 0; i < (unsigned long)numInputs; i++) listed &= addInput(&batch, inputs[i]);
+  failed = dropSharedOutputs(&batch);
+
+  numLanes = (batch.numFiles < (unsigned long)numThreads) ? batch.numFiles : (unsigned long)numThreads;
+  if(numLanes < 1) numLanes = 1;
+  batch.lanes = (struct Lane*)calloc(numLanes, sizeof(struct Lane));
+  for(i = 0; i < numLanes; i++) batch.lanes[i].context = createHuffContext(maxLength, 1);
+
+  pthread_mutex_init(&batch.lock, NULL);
+  pool = createThreadPool((int)numLanes);
+  runTasks(pool, batchTask, &batch, numLanes);
+  freeThreadPool(pool);
+  pthread_mutex_destroy(&batch.lock);
+  seconds = wallClock() - start;
+
+  for(i = 0; i < numLanes; i++)
+  {
+    struct Lane* lane = &batch.lanes[i];
+    files += lane->files;
+    failed += lane->failed;
+    rawBytes += lane->rawBytes;
+    encodedBytes += lane->encodedBytes;
+    freeHuffContext(lane->context);
+    free(lane->in);
+    free(lane->out);
+    free(lane->path);
+  }
+  for(i = 0; i < batch.numFiles; i++) free(batch.names[i]);
+  free(batch.names);
+  free(batch.lanes);
+
+  fprintf(stderr, "%s %lu files, %lu bytes %s %lu bytes in %.3f seconds, %.1f MB/s\n",
+          encoding ? "Encoded" : "Decoded", files,
+          (unsigned long)(encoding ? rawBytes : encodedBytes), encoding ? "to" : "into",
+          (unsigned long)(encoding ? encodedBytes : rawBytes), seconds,
+          (seconds > 0) ? (double)rawBytes / seconds / (1024.0 * 1024.0) : 0.0);
+  if(failed > 0) fprintf(stderr, "%lu files failed!\n", failed);
+  return listed && failed == 0;
+}
+
+/*
+ * Adds the files of one command line input to the batch
+
+ * struct Batch* batch - batch to add to
+ * const char* name - a file, a directory or "-" for a list on standard input
+
+ * returns int - 1 if the input was found
+ *               0 if it doesn't exist or can't be read
+*/
+int addInput(struct Batch* batch, const char* name)
+{
+  struct stat info;
+
+  if(strcmp(name, "-") == 0)
+  {
+    char* line = (char*)malloc(256);
+    unsigned long capacity = 256, length = 0;
+    int currChar;
+
+    /* one name per line, blank lines and carriage returns left out */
+    do
+    {
+      currChar = getchar();
+      if(currChar != EOF && currChar != '\n')
+      {
+        if(currChar == '\r') continue;
+        if(length + 1 >= capacity) line = (char*)growBuffer(line, &capacity, length + 2);
+        line[length++] = (char)currChar;
+        continue;
+      }
+      line[length] = '\0';
+      if(length > 0) addName(batch, line, NULL);
+      length = 0;
+    } while(currChar != EOF);
+
+    free(line);
+    return 1;
+  }
+
+  if(stat(name, &info) != 0)
+  {
+    fprintf(stderr, "Error Opening Input File %s!\n", name);
+    return 0;
+  }
+  if(S_ISDIR(info.st_mode)) return addDirectory(batch, name);
+  addName(batch, name, NULL);
+  return 1;
+}
+
+/*
+ * Adds every regular file of a directory to the batch, without going
+ * into the directories it holds
+
+ * struct Batch* batch - batch to add to
+ * const char* dir - directory to look through
+
+ * returns int - 1 if the directory was read
+ *               0 if it couldn't be opened
+*/
+int addDirectory(struct Batch* batch, const char* dir)
+{
+  DIR* handle = opendir(dir);
+  struct dirent* entry;
+  unsigned long first = batch->numFiles;
+
+  if(handle == NULL)
+  {
+    fprintf(stderr, "Error Opening Input Directory %s!\n", dir);
+    return 0;
+  }
+
+  while((entry = readdir(handle)) != NULL)
+  {
+    struct stat info;
+    addName(batch, entry->d_name, dir);
+
+    /* the name has to be joined to the directory before it can be checked */
+    if(stat(batch->names[batch->numFiles-1], &info) != 0 || !S_ISREG(info.st_mode))
+    {
+      free(batch->names[--batch->numFiles]);
+    }
+  }
+  closedir(handle);
+
+  if(batch->numFiles == first) fprintf(stderr, "No Files In Directory %s!\n", dir);
+  return 1;
+}
+
+/*
+ * Adds a copy of a file name to the batch
+
+ * struct Batch* batch - batch to add to
+ * const char* name - name of the file
+ * const char* dir - directory the name is in, NULL if it is a full name
+*/
+void addName(struct Batch* batch, const char* name, const char* dir)
+{
+  unsigned long dirLength = (dir == NULL) ? 0 : strlen(dir) + 1;
+  char* copy = (char*)malloc(dirLength + strlen(name) + 1);
+
+  if(dir != NULL)
+  {
+    strcpy(copy, dir);
+    copy[dirLength-1] = '/';
+  }
+  strcpy(copy + dirLength, name);
+
+  if(batch->numFiles == batch->capacity)
+  {
+    batch->capacity *= 2;
+    batch->names = (char**)realloc(batch->names, sizeof(char*) * batch->capacity);
+  }
+  batch->names[batch->numFiles++] = copy;
+}
+
+/*
+ * Works through files one after the other until none are left. There is
+ * a task for every thread, and index picks the thread's own scratch memory.
+
+ * void* context - the batch
+ * unsigned long index - which lane to work in
+*/
+void batchTask(void* context, unsigned long index)
+{
+  struct Batch* batch = (struct Batch*)context;
+  struct Lane* lane = &batch->lanes[index];
+
+  while(1)
+  {
+    unsigned long file;
+
+    pthread_mutex_lock(&batch->lock);
+    file = batch->next;
+    if(file < batch->numFiles) batch->next++;
+    pthread_mutex_unlock(&batch->lock);
+    if(file >= batch->numFiles) return;
+
+    if(batchFile(batch, lane, batch->names[file])) lane->files++;
+    else lane->failed++;
+  }
+}
+
+/*
+ * Encodes or decodes one file of the batch in memory. Decoding takes the
+ * canonical and block formats, whatever decodeBuffer does.
+
+ * struct Batch* batch - the batch
+ * struct Lane* lane - scratch memory of the thread
+ * const char* name - file to encode or decode
+
+ * returns int - 1 if the output was written
+ *               0 if something went wrong, which is reported
+*/
+int batchFile(struct Batch* batch, struct Lane* lane, const char* name)
+{
+  unsigned long inLength, outLength = 0;
+  uint64_t rawLength;
+  const char* outName;
+  FILE* file;
+  int done;
+
+  file = fopen(name, "rb");
+  if(file == NULL)
+  {
+    fprintf(stderr, "Error Opening Input File %s!\n", name);
+    return 0;
+  }
+  inLength = readWhole(file, lane);
+  fclose(file);
+
+  if(batch->encoding)
+  {
+    lane->out = (unsigned char*)growBuffer(lane->out, &lane->outCapacity, encodeBound(inLength));
+    done = encodeBuffer(lane->context, lane->in, inLength, lane->out, lane->outCapacity, &outLength);
+  }
+  else
+  {
+    /* no code is shorter than a bit, so nothing decodes to more than
+     * 8 bytes a byte, which keeps a corrupt length from asking for a lot */
+    done = decodedLength(lane->in, inLength, &rawLength) && rawLength / 8 <= inLength;
+    if(done)
+    {
+      lane->out = (unsigned char*)growBuffer(lane->out, &lane->outCapacity,
+                                             (unsigned long)rawLength);
+      done = decodeBuffer(lane->context, lane->in, inLength, lane->out, lane->outCapacity,
+                          &outLength);
+    }
+  }
+  if(!done)
+  {
+    fprintf(stderr, "Error %s File %s!\n", batch->encoding ? "Encoding" : "Decoding", name);
+    return 0;
+  }
+
+  outName = outputName(batch, lane, name);
+  file = fopen(outName, "wb");
+  if(file == NULL)
+  {
+    fprintf(stderr, "Error Opening Output File %s!\n", outName);
+    return 0;
+  }
+  done = fwrite(lane->out, 1, outLength, file) == outLength;
+  done &= fclose(file) == 0;
+  if(!done)
+  {
+    fprintf(stderr, "Error Writing Output File %s!\n", outName);
+    return 0;
+  }
+
+  lane->rawBytes += batch->encoding ? inLength : outLength;
+  lane->encodedBytes += batch->encoding ? outLength : inLength;
+  return 1;
+}
+
+/*
+ * Reads all of a file into the lane's input buffer
+
+ * FILE* in - file to read
+ * struct Lane* lane - gets the bytes in its input buffer
+
+ * returns unsigned long - how many bytes were read
+*/
+unsigned long readWhole(FILE* in, struct Lane* lane)
+{
+  unsigned long length = 0;
+
+  while(1)
+  {
+    unsigned long numBytes;
+    if(length == lane->inCapacity)
+    {
+      lane->in = (unsigned char*)growBuffer(lane->in, &lane->inCapacity, length + INPUT_CHUNK_BYTES);
+    }
+    numBytes = (unsigned long)fread(lane->in + length, 1, lane->inCapacity - length, in);
+    length += numBytes;
+    if(numBytes == 0) return length;
+  }
+}
+
+/*
+ * Makes sure a buffer holds at least the given number of bytes, at least
+ * doubling it when it has to grow so growing is rare
+
+ * void* buffer - buffer to grow, may be NULL
+ * unsigned long* capacity - bytes buffer holds, updated if it grows
+ * unsigned long needed - bytes it must hold
+
+ * returns void* - the buffer, moved if it grew
+*/
+void* growBuffer(void* buffer, unsigned long* capacity, unsigned long needed)
+{
+  if(needed <= *capacity && buffer != NULL) return buffer;
+  if(needed < 2 * *capacity) needed = 2 * *capacity;
+  if(needed == 0) needed = 1;
+  *capacity = needed;
+  return realloc(buffer, needed);
+}
+
+/*
+ * Names the output of a file, in the output directory: encoding adds
+ * ".huff", decoding takes it off or adds ".dec" if it isn't there
+
+ * struct Batch* batch - the batch
+ * struct Lane* lane - keeps the name in its path buffer
+ * const char* name - input file
+
+ * returns const char* - output file name, good until the lane's next file
+*/
+const char* outputName(struct Batch* batch, struct Lane* lane, const char* name)
+{
+  const char* base = strrchr(name, '/');
+  unsigned long dirLength = strlen(batch->outDir);
+  unsigned long baseLength;
+
+  base = (base == NULL) ? name : base + 1;
+  baseLength = strlen(base);
+  lane->path = (char*)growBuffer(lane->path, &lane->pathCapacity, dirLength + baseLength + 7);
+
+  strcpy(lane->path, batch->outDir);
+  lane->path[dirLength] = '/';
+  strcpy(lane->path + dirLength + 1, base);
+  if(batch->encoding) strcat(lane->path, ".huff");
+  else if(baseLength > 5 && strcmp(base + baseLength - 5, ".huff") == 0)
+  {
+    lane->path[dirLength + 1 + baseLength - 5] = '\0';
+  }
+  else strcat(lane->path, ".dec");
+  return lane->path;
+}
+
+/*
+ * Takes files out of the batch whose output would have the same name as
+ * an earlier file's, like a/x and b/x, so no output is written twice or
+ * by two threads at once. Each one is reported and counted as failed.
+
+ * struct Batch* batch - batch to check, before any file is started
+
+ * returns unsigned long - how many files were taken out
+*/
+unsigned long dropSharedOutputs(struct Batch* batch)
+{
+  struct OutputEntry* entries;
+  struct Lane lane;
+  unsigned char* dropped;
+  unsigned long i, kept = 0, numDropped = 0;
+
+  if(batch->numFiles < 2) return 0;
+  entries = (struct OutputEntry*)malloc(sizeof(struct OutputEntry) * batch->numFiles);
+  dropped = (unsigned char*)calloc(batch->numFiles, 1);
+  memset(&lane, 0, sizeof(lane));
+  for(i = 0; i < batch->numFiles; i++)
+  {
+    const char* name = outputName(batch, &lane, batch->names[i]);
+    entries[i].name = (char*)malloc(strlen(name) + 1);
+    strcpy(entries[i].name, name);
+    entries[i].file = i;
+  }
+  free(lane.path);
+
+  /* equal names end up next to each other, the earliest file first */
+  qsort(entries, batch->numFiles, sizeof(struct OutputEntry), compareOutputs);
+  for(i = 1; i < batch->numFiles; i++)
+  {
+    unsigned long first = i - 1;
+    while(i < batch->numFiles && strcmp(entries[i].name, entries[first].name) == 0)
+    {
+      fprintf(stderr, "Output File %s Of %s Is Already The Output Of %s!\n", entries[i].name,
+              batch->names[entries[i].file], batch->names[entries[first].file]);
+      dropped[entries[i].file] = 1;
+      numDropped++;
+      i++;
+    }
+  }
+  for(i = 0; i < batch->numFiles; i++) free(entries[i].name);
+  free(entries);
+
+  for(i = 0; i < batch->numFiles; i++)
+  {
+    if(dropped[i]) free(batch->names[i]);
+    else batch->names[kept++] = batch->names[i];
+  }
+  batch->numFiles = kept;
+  free(dropped);
+  return numDropped;
+}
+
+/*
+ * Orders output entries by name, and entries of the same name by the
+ * order their files were given in, for qsort
+
+ * const void* first - an OutputEntry
+ * const void* second - another OutputEntry
+
+ * returns int - below 0 if first goes first, above 0 if second does
+*/
+int compareOutputs(const void* first, const void* second)
+{
+  const struct OutputEntry* a = (const struct OutputEntry*)first;
+  const struct OutputEntry* b = (const struct OutputEntry*)second;
+  int order = strcmp(a->name, b->name);
+
+  if(order != 0) return order;
+  return (a->file < b->file) ? -1 : (a->file > b->file);
+}
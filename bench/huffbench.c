@@ -0,0 +1,574 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for measuring how fast and how well the
+ * programs compress. Every file in inputs/decoded plus generated files
+ * of random, skewed, repeating and text-like bytes is encoded and decoded
+ * by running huffencode and huffdecode, the decoded file is checked
+ * against the original, and the speed, ratio and peak memory of each run
+ * is written out one line per file and mode, separated by tabs.
+ * The results are compared against a stored baseline of the same lines,
+ * and anything that got noticeably slower, bigger or hungrier is reported
+ * as a regression. Speeds only mean something on the machine they were
+ * measured on, so the baseline isn't kept with the sources: the first run
+ * without one stores its results as the baseline. Only works on systems
+ * with fork and wait4.
+ * To use it, run from the top of the repository:
+ * ./bench/huffbench [-u] [-r repeats] [-T tolerance] [-e flags]... baselineFile [size]...
+ * Where sizes (default 1m and 16m) may end in k, m or g, -e gives the
+ * flags of a mode to run (default blocks and -c), -u writes the results
+ * as the new baseline instead of comparing, and -T is the percent lost
+ * speed counted as a regression (default 10).
+*/
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define ENCODER "bench/huffencode"
+#define DECODER "bench/huffdecode"
+#define INPUTS "inputs/decoded"
+#define CORPUS "bench/corpus"
+#define ENCODED "bench/corpus/out.huff"
+#define DECODED "bench/corpus/out.dec"
+#define MAX_MODES 16 /* most -e flags */
+#define MAX_MODE_ARGS 16 /* most flags in one mode */
+#define MAX_SIZES 16 /* most generated sizes */
+#define MAX_RESULTS 1024 /* most lines in a baseline */
+#define RATIO_SLACK 1.001 /* ratio may grow this much before it counts */
+#define MEMORY_SLACK 1.25 /* peak memory may grow this much before it counts */
+#define MEMORY_FLOOR 1024 /* KB of memory growth always allowed */
+
+/* Measurements of one file encoded and decoded in one mode */
+struct BenchResult
+{
+  char name[64]; /* file name */
+  char mode[64]; /* flags passed to huffencode, "-" for none */
+  unsigned long bytes; /* size of the file */
+  unsigned long encoded; /* size once encoded */
+  double ratio; /* encoded size over the original size */
+  double encodeSpeed; /* MB/s of original bytes while encoding */
+  double decodeSpeed; /* MB/s of original bytes while decoding */
+  long encodeMemory; /* peak KB used by huffencode */
+  long decodeMemory; /* peak KB used by huffdecode */
+};
+
+/* Function Declarations */
+int runProgram(char** args, double* seconds, long* memory);
+int benchFile(const char* path, const char* name, char* mode, int repeats,
+              struct BenchResult* result);
+int sameFiles(const char* first, const char* second);
+int makeCorpus(const char* kind, unsigned long size, char* path);
+unsigned long parseBenchSize(const char* text);
+uint64_t nextRandom(uint64_t* state);
+void printResult(FILE* out, struct BenchResult* result);
+int readBaseline(const char* path, struct BenchResult* baseline);
+int compareResult(struct BenchResult* result, struct BenchResult* baseline, int numBaseline,
+                  double tolerance);
+
+int main(int argc, char** argv)
+{
+  static struct BenchResult results[MAX_RESULTS];
+  static struct BenchResult baseline[MAX_RESULTS];
+  static const char* kinds[] = {"random", "skewed", "runs", "text"};
+  char* modes[MAX_MODES];
+  unsigned long sizes[MAX_SIZES];
+  char path[256], name[64];
+  int numModes = 0, numSizes = 0, numResults = 0, numBaseline = 0;
+  int update = 0, repeats = 3, regressions = 0, failures = 0;
+  double tolerance = 10;
+  const char* baselinePath;
+  DIR* inputs;
+  struct dirent* entry;
+  FILE* out;
+  int argi = 1, i, m, k;
+
+  while(argi < argc && argv[argi][0] == '-')
+  {
+    if(strcmp(argv[argi], "-u") == 0) update = 1;
+    else if(strcmp(argv[argi], "-r") == 0 && argi + 1 < argc) repeats = atoi(argv[++argi]);
+    else if(strcmp(argv[argi], "-T") == 0 && argi + 1 < argc) tolerance = atof(argv[++argi]);
+    else if(strcmp(argv[argi], "-e") == 0 && argi + 1 < argc && numModes < MAX_MODES)
+    {
+      modes[numModes++] = argv[++argi];
+    }
+    else
+    {
+      fprintf(stderr, "Unknown Option %s!\n", argv[argi]);
+      return 1;
+    }
+    argi++;
+  }
+  if(argi >= argc || repeats < 1)
+  {
+    fprintf(stderr, "usage: huffbench [-u] [-r repeats] [-T tolerance] [-e flags]... "
+                    "baselineFile [size]...\n");
+    return 1;
+  }
+  baselinePath = argv[argi++];
+  for(; argi < argc && numSizes < MAX_SIZES; argi++)
+  {
+    sizes[numSizes] = parseBenchSize(argv[argi]);
+    if(sizes[numSizes] == 0)
+    {
+      fprintf(stderr, "Invalid Size %s!\n", argv[argi]);
+      return 1;
+    }
+    numSizes++;
+  }
+  if(numSizes == 0)
+  {
+    sizes[numSizes++] = 1 << 20;
+    sizes[numSizes++] = 16 << 20;
+  }
+  if(numModes == 0)
+  {
+    modes[numModes++] = "";
+    modes[numModes++] = "-c";
+  }
+  if(!update) numBaseline = readBaseline(baselinePath, baseline);
+  if(numBaseline == 0) update = 1;
+  mkdir(CORPUS, 0777);
+
+  printResult(stdout, NULL);
+  inputs = opendir(INPUTS);
+  while(inputs != NULL && (entry = readdir(inputs)) != NULL)
+  {
+    if(entry->d_name[0] == '.') continue;
+    sprintf(path, "%s/%.200s", INPUTS, entry->d_name);
+    sprintf(name, "%.63s", entry->d_name);
+    for(m = 0; m < numModes && numResults < MAX_RESULTS; m++)
+    {
+      if(!benchFile(path, name, modes[m], repeats, &results[numResults])) failures++;
+      else printResult(stdout, &results[numResults++]);
+    }
+  }
+  if(inputs != NULL) closedir(inputs);
+
+  for(i = 0; i < numSizes; i++)
+  {
+    for(k = 0; k < 4; k++)
+    {
+      if(!makeCorpus(kinds[k], sizes[i], path))
+      {
+        fprintf(stderr, "Couldn't write %s!\n", path);
+        failures++;
+        continue;
+      }
+      sprintf(name, "%s-%lu", kinds[k], sizes[i]);
+      for(m = 0; m < numModes && numResults < MAX_RESULTS; m++)
+      {
+        if(!benchFile(path, name, modes[m], repeats, &results[numResults])) failures++;
+        else printResult(stdout, &results[numResults++]);
+      }
+      remove(path);
+    }
+  }
+  remove(ENCODED);
+  remove(DECODED);
+  rmdir(CORPUS);
+
+  if(update)
+  {
+    out = fopen(baselinePath, "w");
+    if(out == NULL)
+    {
+      fprintf(stderr, "Couldn't write %s!\n", baselinePath);
+      return 1;
+    }
+    printResult(out, NULL);
+    for(i = 0; i < numResults; i++) printResult(out, &results[i]);
+    fclose(out);
+  }
+  else
+  {
+    for(i = 0; i < numResults; i++)
+    {
+      regressions += compareResult(&results[i], baseline, numBaseline, tolerance);
+    }
+    fprintf(stderr, "%d regressions against %s\n", regressions, baselinePath);
+  }
+
+  if(failures > 0) fprintf(stderr, "%d files failed to round trip!\n", failures);
+  return (failures > 0 || regressions > 0) ? 1 : 0;
+}
+
+/*
+ * Runs a program and waits for it to finish, with its standard output
+ * thrown away.
+
+ * char** args - program followed by its arguments, ending with NULL
+ * double* seconds - filled with how long it ran for
+ * long* memory - filled with the peak KB of memory it used
+
+ * returns int - 1 if the program ran and exited with 0, 0 if not
+*/
+int runProgram(char** args, double* seconds, long* memory)
+{
+  struct timeval start, end;
+  struct rusage usage;
+  int status;
+  pid_t child;
+
+  gettimeofday(&start, NULL);
+  child = fork();
+  if(child == 0)
+  {
+    if(freopen("/dev/null", "w", stdout) == NULL) _exit(127);
+    execv(args[0], args);
+    _exit(127);
+  }
+  if(child < 0 || wait4(child, &status, 0, &usage) != child) return 0;
+  gettimeofday(&end, NULL);
+
+  *seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec) / 1e6;
+  *memory = usage.ru_maxrss;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Encodes and decodes a file a few times in one mode, keeping the fastest
+ * times and the largest memory use, and checks the decoded file.
+
+ * const char* path - file to measure
+ * const char* name - name of the file in the results
+ * char* mode - flags for huffencode separated by spaces, may be empty
+ * int repeats - how many times to run each program
+ * struct BenchResult* result - filled with the measurements
+
+ * returns int - 1 if every run worked and the file came back the same
+*/
+int benchFile(const char* path, const char* name, char* mode, int repeats,
+              struct BenchResult* result)
+{
+  char flags[64];
+  char* args[MAX_MODE_ARGS + 5];
+  char* flag;
+  double seconds, encodeTime = 0, decodeTime = 0;
+  long memory;
+  struct stat info;
+  int numArgs = 0, i;
+
+  sprintf(flags, "%.63s", mode);
+  args[numArgs++] = ENCODER;
+  args[numArgs++] = "-q";
+  for(flag = strtok(flags, " "); flag != NULL && numArgs < MAX_MODE_ARGS + 2;
+      flag = strtok(NULL, " "))
+  {
+    args[numArgs++] = flag;
+  }
+  args[numArgs++] = (char*)path;
+  args[numArgs++] = ENCODED;
+  args[numArgs] = NULL;
+
+  sprintf(result->name, "%.63s", name);
+  sprintf(result->mode, "%.63s", mode[0] == '\0' ? "-" : mode);
+  for(i = 0; result->mode[i] != '\0'; i++) if(result->mode[i] == ' ') result->mode[i] = '_';
+  result->encodeMemory = 0;
+  result->decodeMemory = 0;
+
+  for(i = 0; i < repeats; i++)
+  {
+    if(!runProgram(args, &seconds, &memory))
+    {
+      fprintf(stderr, "Encoding %s with \"%s\" failed!\n", path, mode);
+      return 0;
+    }
+    if(i == 0 || seconds < encodeTime) encodeTime = seconds;
+    if(memory > result->encodeMemory) result->encodeMemory = memory;
+  }
+
+  args[0] = DECODER;
+  args[1] = ENCODED;
+  args[2] = DECODED;
+  args[3] = NULL;
+  for(i = 0; i < repeats; i++)
+  {
+    if(!runProgram(args, &seconds, &memory))
+    {
+      fprintf(stderr, "Decoding %s with \"%s\" failed!\n", path, mode);
+      return 0;
+    }
+    if(i == 0 || seconds < decodeTime) decodeTime = seconds;
+    if(memory > result->decodeMemory) result->decodeMemory = memory;
+  }
+
+  if(!sameFiles(path, DECODED))
+  {
+    fprintf(stderr, "Decoding %s with \"%s\" gave a different file!\n", path, mode);
+    return 0;
+  }
+
+  stat(path, &info);
+  result->bytes = (unsigned long)info.st_size;
+  stat(ENCODED, &info);
+  result->encoded = (unsigned long)info.st_size;
+  result->ratio = result->bytes ? (double)result->encoded / (double)result->bytes : 0;
+  result->encodeSpeed = (double)result->bytes / 1e6 / (encodeTime > 1e-6 ? encodeTime : 1e-6);
+  result->decodeSpeed = (double)result->bytes / 1e6 / (decodeTime > 1e-6 ? decodeTime : 1e-6);
+  return 1;
+}
+
+/*
+ * Checks whether two files hold the same bytes
+
+ * const char* first - one file
+ * const char* second - the other file
+
+ * returns int - 1 if they are the same, 0 if not or either can't be read
+*/
+int sameFiles(const char* first, const char* second)
+{
+  static unsigned char a[1 << 16], b[1 << 16];
+  FILE* fa = fopen(first, "rb");
+  FILE* fb = fopen(second, "rb");
+  size_t na, nb;
+  int same = (fa != NULL && fb != NULL);
+
+  while(same)
+  {
+    na = fread(a, 1, sizeof(a), fa);
+    nb = fread(b, 1, sizeof(b), fb);
+    if(na != nb || memcmp(a, b, na) != 0) same = 0;
+    if(na == 0) break;
+  }
+
+  if(fa != NULL) fclose(fa);
+  if(fb != NULL) fclose(fb);
+  return same;
+}
+
+/*
+ * Writes a generated file, always the same for a given kind and size.
+ * "random" is uniform random bytes, "skewed" has every byte twice as
+ * likely as the next, "runs" repeats random bytes up to 64 times in a
+ * row and "text" is words of lowercase letters picked mostly from a
+ * small vocabulary, with spaces, punctuation and line breaks.
+
+ * const char* kind - which of the kinds to write
+ * unsigned long size - how many bytes to write
+ * char* path - filled with the path of the file, at least 256 bytes
+
+ * returns int - 1 if the file was written, 0 if not
+*/
+int makeCorpus(const char* kind, unsigned long size, char* path)
+{
+  static unsigned char buffer[1 << 16];
+  char words[256][12];
+  uint64_t state = ((uint64_t)0x9E3779B9 << 32) | 0x7F4A7C15;
+  unsigned long written = 0;
+  unsigned long used;
+  unsigned int run = 0, word = 0, letter = 0;
+  unsigned char value = 0;
+  int type = (strcmp(kind, "random") == 0) ? 0 : (strcmp(kind, "skewed") == 0) ? 1 :
+             (strcmp(kind, "runs") == 0) ? 2 : 3;
+  FILE* out;
+  int i, j;
+
+  sprintf(path, "%s/%.32s-%lu", CORPUS, kind, size);
+  out = fopen(path, "wb");
+  if(out == NULL) return 0;
+
+  for(i = 0; i < 256; i++)
+  {
+    int length = 1 + (int)(nextRandom(&state) % 10);
+    for(j = 0; j < length; j++) words[i][j] = (char)('a' + nextRandom(&state) % 26);
+    words[i][length] = '\0';
+  }
+
+  while(written < size)
+  {
+    used = (size - written < sizeof(buffer)) ? size - written : sizeof(buffer);
+    for(i = 0; i < (int)used; i++)
+    {
+      uint64_t r = nextRandom(&state);
+      if(type == 0) buffer[i] = (unsigned char)(r >> 56);
+      else if(type == 1)
+      {
+        /* the number of trailing zero bits is geometric, halving each time */
+        value = 0;
+        while(value < 63 && (r & 1) == 0)
+        {
+          value++;
+          r >>= 1;
+        }
+        buffer[i] = (unsigned char)(value * 4);
+      }
+      else if(type == 2)
+      {
+        if(run == 0)
+        {
+          value = (unsigned char)(r >> 56);
+          run = 1 + (unsigned int)((r >> 8) % 64);
+        }
+        buffer[i] = value;
+        run--;
+      }
+      else
+      {
+        if(words[word][letter] == '\0')
+        {
+          /* half the words come from the first 16, like common words do */
+          word = (unsigned int)((r & 1) ? (r >> 8) % 16 : (r >> 8) % 256);
+          letter = 0;
+          buffer[i] = (r >> 20) % 12 == 0 ? ((r >> 24) % 4 == 0 ? '\n' : ',') : ' ';
+        }
+        else buffer[i] = (unsigned char)words[word][letter++];
+      }
+    }
+    if(fwrite(buffer, 1, used, out) != used) break;
+    written += used;
+  }
+
+  fclose(out);
+  return written == size;
+}
+
+/*
+ * Reads a size that may end in k, m or g for kilobytes, megabytes
+ * or gigabytes
+
+ * const char* text - size to read
+
+ * returns unsigned long - the size, 0 if it isn't valid
+*/
+unsigned long parseBenchSize(const char* text)
+{
+  char* end;
+  unsigned long size = strtoul(text, &end, 10);
+  if(*end == 'k' || *end == 'K') size <<= 10, end++;
+  else if(*end == 'm' || *end == 'M') size <<= 20, end++;
+  else if(*end == 'g' || *end == 'G') size <<= 30, end++;
+  return *end == '\0' ? size : 0;
+}
+
+/*
+ * Steps a xorshift generator, so generated files are the same every run
+
+ * uint64_t* state - state of the generator, not 0
+
+ * returns uint64_t - next random number
+*/
+uint64_t nextRandom(uint64_t* state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/*
+ * Writes the measurements of one run as a line of tab separated fields
+
+ * FILE* out - where to write the line
+ * struct BenchResult* result - measurements, NULL for the heading line
+*/
+void printResult(FILE* out, struct BenchResult* result)
+{
+  if(result == NULL)
+  {
+    fprintf(out, "#name\tmode\tbytes\tencoded\tratio\tencodeMBs\tdecodeMBs\t"
+                 "encodeKB\tdecodeKB\n");
+  }
+  else fprintf(out, "%s\t%s\t%lu\t%lu\t%.4f\t%.1f\t%.1f\t%ld\t%ld\n", result->name, result->mode,
+          result->bytes, result->encoded, result->ratio, result->encodeSpeed,
+          result->decodeSpeed, result->encodeMemory, result->decodeMemory);
+  fflush(out); /* before the next fork copies anything still buffered */
+}
+
+/*
+ * Reads the lines written by printResult back in, skipping the heading
+
+ * const char* path - baseline file
+ * struct BenchResult* baseline - array of MAX_RESULTS to fill
+
+ * returns int - how many lines were read, 0 if there is no baseline yet
+*/
+int readBaseline(const char* path, struct BenchResult* baseline)
+{
+  FILE* in = fopen(path, "r");
+  char line[512];
+  int count = 0;
+
+  if(in == NULL)
+  {
+    fprintf(stderr, "No baseline at %s, storing this run as the baseline\n", path);
+    return 0;
+  }
+  while(count < MAX_RESULTS && fgets(line, sizeof(line), in) != NULL)
+  {
+    struct BenchResult* result = &baseline[count];
+    if(line[0] == '#') continue;
+    if(sscanf(line, "%63s %63s %lu %lu %lf %lf %lf %ld %ld", result->name, result->mode,
+              &result->bytes, &result->encoded, &result->ratio, &result->encodeSpeed,
+              &result->decodeSpeed, &result->encodeMemory, &result->decodeMemory) == 9)
+    {
+      count++;
+    }
+  }
+  fclose(in);
+  return count;
+}
+
+/*
+ * Compares a result with the baseline line for the same file and mode,
+ * reporting a regression when either speed dropped by more than the
+ * tolerance, the ratio grew or either program needed a lot more memory
+
+ * struct BenchResult* result - result to check
+ * struct BenchResult* baseline - lines of the baseline
+ * int numBaseline - how many lines there are
+ * double tolerance - percent of speed that may be lost
+
+ * returns int - how many regressions were found
+*/
+int compareResult(struct BenchResult* result, struct BenchResult* baseline, int numBaseline,
+                  double tolerance)
+{
+  double slow = 1 - tolerance / 100;
+  int found = 0, i;
+
+  for(i = 0; i < numBaseline; i++)
+  {
+    struct BenchResult* base = &baseline[i];
+    if(strcmp(base->name, result->name) != 0 || strcmp(base->mode, result->mode) != 0 ||
+       base->bytes != result->bytes)
+    {
+      continue;
+    }
+    if(result->encodeSpeed < base->encodeSpeed * slow)
+    {
+      fprintf(stderr, "REGRESSION %s %s encodeMBs %.1f was %.1f\n", result->name,
+              result->mode, result->encodeSpeed, base->encodeSpeed);
+      found++;
+    }
+    if(result->decodeSpeed < base->decodeSpeed * slow)
+    {
+      fprintf(stderr, "REGRESSION %s %s decodeMBs %.1f was %.1f\n", result->name,
+              result->mode, result->decodeSpeed, base->decodeSpeed);
+      found++;
+    }
+    if((double)result->encoded > (double)base->encoded * RATIO_SLACK)
+    {
+      fprintf(stderr, "REGRESSION %s %s encoded %lu was %lu\n", result->name,
+              result->mode, result->encoded, base->encoded);
+      found++;
+    }
+    if(result->encodeMemory > base->encodeMemory * MEMORY_SLACK + MEMORY_FLOOR ||
+       result->decodeMemory > base->decodeMemory * MEMORY_SLACK + MEMORY_FLOOR)
+    {
+      fprintf(stderr, "REGRESSION %s %s memoryKB %ld/%ld was %ld/%ld\n", result->name,
+              result->mode, result->encodeMemory, result->decodeMemory,
+              base->encodeMemory, base->decodeMemory);
+      found++;
+    }
+    return found;
+  }
+  return 0;
+}
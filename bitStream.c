@@ -0,0 +1,248 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for packing huffman codes into bytes for
+ * the encoder, either straight into memory or on their way to a file. 
+ * Codes are collected in a 64 bit accumulator so that a whole code is 
+ * added at once, and the accumulator is stored a full 64 bit word at a 
+ * time. Reading goes the other way, the bit buffer gets topped off with
+ * a whole word whenever there are 8 bytes left to load it from.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include "huffman.h"
+
+/* Function Declarations */
+int makeRoom(struct BitWriter* writer, unsigned long count);
+void storeWord(struct BitWriter* writer, uint64_t word);
+
+/*
+ * Gets a BitWriter ready to write to the given file
+
+ * struct BitWriter* writer - writer to set up
+ * FILE* out - file to write to
+*/
+void initBitWriter(struct BitWriter* writer, FILE* out)
+{
+  writer->bitBuf = 0;
+  writer->bitCount = 0;
+  writer->buffer = writer->fileBuffer;
+  writer->used = 0;
+  writer->capacity = BIT_WRITER_BYTES;
+  writer->overflow = 0;
+  writer->out = out;
+}
+
+/*
+ * Gets a BitWriter ready to write into memory. The memory needs to hold
+ * every byte that will be written, since it has nowhere to be emptied to.
+
+ * struct BitWriter* writer - writer to set up
+ * unsigned char* dest - memory to write to
+ * unsigned long capacity - how many bytes dest holds
+*/
+void initMemoryWriter(struct BitWriter* writer, unsigned char* dest, unsigned long capacity)
+{
+  writer->bitBuf = 0;
+  writer->bitCount = 0;
+  writer->buffer = dest;
+  writer->used = 0;
+  writer->capacity = capacity;
+  writer->overflow = 0;
+  writer->out = NULL;
+}
+
+/*
+ * Makes room for count more bytes in the writer's buffer, writing it out
+ * to the file if there is one.
+
+ * struct BitWriter* writer - writer needing room
+ * unsigned long count - bytes about to be stored
+
+ * returns int - 1 if there is room
+ *               0 if memory ran out, the writer is then marked as overflowed
+*/
+int makeRoom(struct BitWriter* writer, unsigned long count)
+{
+  if(writer->used + count <= writer->capacity) return 1;
+
+  if(writer->out == NULL)
+  {
+    writer->overflow = 1;
+    return 0;
+  }
+  fwrite(writer->buffer, 1, writer->used, writer->out);
+  writer->used = 0;
+  return 1;
+}
+
+/*
+ * Stores a full 64 bit word in the writer's buffer, highest byte first,
+ * making room for it first if the buffer is full.
+
+ * struct BitWriter* writer - writer to store to
+ * uint64_t word - 64 bits to store
+*/
+void storeWord(struct BitWriter* writer, uint64_t word)
+{
+  unsigned char* dest;
+
+  if(!makeRoom(writer, 8)) return;
+
+  dest = writer->buffer + writer->used;
+  dest[0] = (unsigned char)(word >> 56);
+  dest[1] = (unsigned char)(word >> 48);
+  dest[2] = (unsigned char)(word >> 40);
+  dest[3] = (unsigned char)(word >> 32);
+  dest[4] = (unsigned char)(word >> 24);
+  dest[5] = (unsigned char)(word >> 16);
+  dest[6] = (unsigned char)(word >> 8);
+  dest[7] = (unsigned char)word;
+  writer->used += 8;
+}
+
+/*
+ * Appends a code to the bits being written. While the code fits in the 
+ * accumulator it is just shifted in, once the accumulator fills up the
+ * part of the code that fits completes a word and the rest stays behind.
+
+ * struct BitWriter* writer - writer to append to
+ * uint64_t code - right aligned code, no bits set above its length
+ * unsigned int length - how many bits long the code is, at most 64
+*/
+void writeBits(struct BitWriter* writer, uint64_t code, unsigned int length)
+{
+  unsigned int space = 64 - writer->bitCount; /* room left in bitBuf */
+  uint64_t word;
+
+  if(length < space)
+  {
+    writer->bitBuf = (writer->bitBuf << length) | code;
+    writer->bitCount += length;
+    return;
+  }
+
+  /* Shifting by 64 isn't defined, and an empty bitBuf adds nothing anyway */
+  word = (writer->bitCount == 0) ? 0 : writer->bitBuf << space;
+  word |= code >> (length - space);
+  storeWord(writer, word);
+
+  writer->bitCount = length - space;
+  writer->bitBuf = code & (((uint64_t)1 << writer->bitCount) - 1);
+}
+
+/*
+ * Writes out every bit still held by the writer, padding the last 
+ * byte with zeroes.
+
+ * struct BitWriter* writer - writer to empty
+*/
+void flushBits(struct BitWriter* writer)
+{
+  unsigned int numBytes = (writer->bitCount + 7) / 8;
+  uint64_t word;
+  unsigned int i;
+
+  if(!makeRoom(writer, numBytes)) return;
+
+  /* Lining up the leftover bits at the top of a word */
+  word = (writer->bitCount == 0) ? 0 : writer->bitBuf << (64 - writer->bitCount);
+  for(i = 0; i < numBytes; i++)
+  {
+    writer->buffer[writer->used++] = (unsigned char)(word >> (56 - 8*i));
+  }
+
+  if(writer->out != NULL)
+  {
+    fwrite(writer->buffer, 1, writer->used, writer->out);
+    writer->used = 0;
+  }
+  writer->bitBuf = 0;
+  writer->bitCount = 0;
+}
+
+/*
+ * Gets a BitReader ready to read from memory
+
+ * struct BitReader* reader - reader to set up
+ * const unsigned char* src - bytes to read
+ * unsigned long srcLength - how many bytes src holds
+*/
+void initMemoryReader(struct BitReader* reader, const unsigned char* src, unsigned long srcLength)
+{
+  reader->bitBuf = 0;
+  reader->bitCount = 0;
+  reader->src = src;
+  reader->srcLength = srcLength;
+  reader->pos = 0;
+  reader->padding = 0;
+  reader->input = NULL;
+}
+
+/*
+ * Gets a BitReader ready to read the spans of an InputFile, the first
+ * span is read once the reader needs bits
+
+ * struct BitReader* reader - reader to set up
+ * struct InputFile* input - input to read from
+*/
+void initBitReader(struct BitReader* reader, struct InputFile* input)
+{
+  initMemoryReader(reader, NULL, 0);
+  reader->input = input;
+}
+
+/*
+ * Tops off the bit buffer so it holds at least 56 bits. With 8 bytes
+ * left in src they are loaded as one word, the bytes that don't fit stay
+ * in src and since they get loaded into the same spot next time, loading 
+ * part of one twice does no harm. Near the end of src it goes a byte at 
+ * a time, moving on to the next span or padding with zeroes.
+
+ * struct BitReader* reader - reader to refill
+*/
+void refillBits(struct BitReader* reader)
+{
+  if(reader->bitCount > 56) return;
+
+  if(reader->pos + 8 <= reader->srcLength)
+  {
+    const unsigned char* next = reader->src + reader->pos;
+    uint64_t word = ((uint64_t)next[0] << 56) | ((uint64_t)next[1] << 48) |
+                    ((uint64_t)next[2] << 40) | ((uint64_t)next[3] << 32) |
+                    ((uint64_t)next[4] << 24) | ((uint64_t)next[5] << 16) |
+                    ((uint64_t)next[6] << 8) | (uint64_t)next[7];
+    reader->bitBuf |= word >> reader->bitCount;
+    reader->pos += (63 - reader->bitCount) >> 3;
+    reader->bitCount |= 56;
+    return;
+  }
+
+  while(reader->bitCount <= 56)
+  {
+    uint64_t currByte = 0;
+    if(reader->pos == reader->srcLength && reader->input != NULL)
+    {
+      reader->srcLength = nextSpan(reader->input, &reader->src);
+      reader->pos = 0;
+    }
+    if(reader->pos < reader->srcLength) currByte = reader->src[reader->pos++];
+    else reader->padding++;
+
+    reader->bitBuf |= currByte << (56 - reader->bitCount);
+    reader->bitCount += 8;
+  }
+}
+
+/*
+ * Tells whether any of the zero padding past the end of the input has 
+ * been used, which means the input was cut short or is corrupt. Padding 
+ * still in the bit buffer is fine, it just hasn't been looked at.
+
+ * struct BitReader* reader - reader to check
+
+ * returns int - 1 if bits past the end were used
+*/
+int readPastEnd(struct BitReader* reader)
+{
+  return (uint64_t)reader->padding * 8 > reader->bitCount;
+}
@@ -0,0 +1,564 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for encoding and decoding single blocks of
+ * a FORMAT_BLOCKS file in memory. Every block gets its own canonical
+ * code, so blocks don't depend on each other and can be worked on by
+ * different threads at the same time.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "huffman.h"
+
+/* Function Declarations */
+int encodePart(struct Block* block, struct BlockPart* part, const unsigned char* raw,
+               unsigned char* packed);
+unsigned long writeStreams(struct HuffContext* context, const unsigned char* src,
+                           unsigned long srcLength, int numStreams, unsigned char* dest);
+int readStreams(const unsigned char* src, unsigned long srcLength,
+                struct BitReader* readers, int* numStreams);
+
+/*
+ * Writes the code lengths of all 256 symbols, run-length encoded since
+ * most blocks use only a few symbols. One byte each:
+ *   0 to 64    - code length of the next symbol
+ *   128 to 191 - the last length repeats for the next (byte-127) symbols
+ *   192 to 255 - the next (byte-191) symbols don't appear
+
+ * unsigned char* dest - where to write, needs room for 256 bytes
+ * const unsigned char* lengths - code length of each symbol
+
+ * returns unsigned long - how many bytes were written
+*/
+unsigned long writeLengths(unsigned char* dest, const unsigned char* lengths)
+{
+  unsigned long used = 0;
+  int i = 0;
+
+  while(i < 256)
+  {
+    int run = 1;
+    if(lengths[i] == 0)
+    {
+      while(i + run < 256 && run < 64 && lengths[i+run] == 0) run++;
+      dest[used++] = (unsigned char)(0xC0 | (run-1));
+      i += run;
+    }
+    else
+    {
+      dest[used++] = lengths[i];
+      i++;
+      run = 0;
+      while(i + run < 256 && run < 64 && lengths[i+run] == lengths[i-1]) run++;
+      if(run > 0) dest[used++] = (unsigned char)(0x80 | (run-1));
+      i += run;
+    }
+  }
+
+  return used;
+}
+
+/*
+ * Reads code lengths written by writeLengths
+
+ * const unsigned char* src - bytes to read from
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* lengths - array of 256 filled with each symbol's length
+
+ * returns long - how many bytes were read, -1 if they are malformed
+*/
+long readLengthsFrom(const unsigned char* src, unsigned long srcLength, unsigned char* lengths)
+{
+  unsigned long used = 0;
+  unsigned char last = 0;
+  int i = 0;
+
+  while(i < 256)
+  {
+    unsigned char currByte;
+    int run;
+    if(used >= srcLength) return -1;
+    currByte = src[used++];
+
+    if(currByte <= MAX_CODE_LENGTH)
+    {
+      last = currByte;
+      lengths[i++] = last;
+      continue;
+    }
+    else if(currByte >= 0xC0)
+    {
+      last = 0;
+      run = currByte - 0xBF;
+    }
+    else if(currByte >= 0x80) run = currByte - 0x7F;
+    else return -1;
+
+    if(i + run > 256) return -1;
+    for(; run > 0; run--) lengths[i++] = last;
+  }
+
+  return (long)used;
+}
+
+/*
+ * Encodes one part of a block, whose symbols are already counted in the
+ * block's context, into the block's packed buffer. The part holds the
+ * code lengths followed by the encoded bits, split into streams if the
+ * block asks for more than one. If the block asks for order-1 codes
+ * they are built as well, and used if they come out smaller than the
+ * single code, header and all. When neither saves enough, which the
+ * counts already tell before anything is encoded, the raw bytes are
+ * copied in as they are. The encoded bits never take more bytes than
+ * the part has, so the packed buffer needs room for
+ * MAX_LENGTHS_BYTES + MAX_STREAM_TABLE_BYTES + rawLength from packed on.
+
+ * struct Block* block - block the part is in, gets its bits and counts added
+ * struct BlockPart* part - part to encode, gets its kind and packed length
+ * const unsigned char* raw - raw bytes of the part
+ * unsigned char* packed - where the part goes
+
+ * returns int - 1 if encoded, 0 if the code couldn't be built
+*/
+int encodePart(struct Block* block, struct BlockPart* part, const unsigned char* raw,
+               unsigned char* packed)
+{
+  struct HuffContext* context = block->context;
+  struct ContextModel* model;
+  unsigned long rawLength = part->rawLength;
+  unsigned long headerLength, plainLength;
+  unsigned long storedLength = rawLength - rawLength / STORED_MIN_SAVING;
+  double start;
+  int i;
+
+  if(!buildCountedCode(context)) return 0;
+
+  for(i = 0; i < 256; i++) block->freq[i] += context->freq[i];
+
+  start = startPhase(context->stats);
+  headerLength = writeLengths(packed, context->lengths);
+  endPhase(context->stats, PHASE_HEADER_WRITE, start, headerLength);
+
+  plainLength = headerLength + (unsigned long)((context->bits + 7) / 8);
+  if(block->numStreams > 1) plainLength += 1 + 4 * (unsigned long)(block->numStreams - 1);
+  if(block->order && buildOrder1Code(context, raw, rawLength) &&
+     context->model->headerLength + (context->model->bits + 7) / 8 < plainLength &&
+     context->model->headerLength + (context->model->bits + 7) / 8 < storedLength)
+  {
+    model = context->model;
+    part->kind = BLOCK_ORDER1;
+    block->bits += model->bits;
+    block->extraBits += model->extraBits;
+
+    start = startPhase(context->stats);
+    memcpy(packed, model->header, model->headerLength);
+    endPhase(context->stats, PHASE_HEADER_WRITE, start, model->headerLength);
+
+    start = startPhase(context->stats);
+    writeOrder1Symbols(context, raw, rawLength, packed + model->headerLength);
+    part->packedLength = model->headerLength + (unsigned long)((model->bits + 7) / 8);
+    endPhase(context->stats, PHASE_ENCODE, start, part->packedLength - model->headerLength);
+
+    /* buildCountedCode counted the single code's bits, these replace them */
+    if(context->stats != NULL)
+    {
+      context->stats->codeBits += model->bits - context->bits;
+      if(model->longest > context->stats->longest) context->stats->longest = model->longest;
+    }
+    return 1;
+  }
+
+  if(plainLength >= storedLength)
+  {
+    part->kind = BLOCK_STORED;
+    block->bits += 8 * (uint64_t)rawLength;
+
+    start = startPhase(context->stats);
+    memcpy(packed, raw, rawLength);
+    part->packedLength = rawLength;
+    endPhase(context->stats, PHASE_ENCODE, start, part->packedLength);
+
+    if(context->stats != NULL) context->stats->codeBits += 8 * (uint64_t)rawLength - context->bits;
+    return 1;
+  }
+
+  block->bits += context->bits;
+  block->extraBits += context->extraBits;
+  start = startPhase(context->stats);
+  if(block->numStreams > 1)
+  {
+    part->kind = BLOCK_STREAMS;
+    part->packedLength = headerLength + writeStreams(context, raw, rawLength, block->numStreams,
+                                                     packed + headerLength);
+  }
+  else
+  {
+    part->kind = BLOCK_HUFFMAN;
+    writeContextSymbols(context, raw, rawLength, packed + headerLength);
+    part->packedLength = headerLength + (unsigned long)((context->bits + 7) / 8);
+  }
+  endPhase(context->stats, PHASE_ENCODE, start, part->packedLength - headerLength);
+  return 1;
+}
+
+/*
+ * Encodes the raw bytes of a block into its packed buffer. The block is
+ * first split where its bytes change enough for a new code to pay for
+ * itself, and every part is encoded with a code of its own, one after
+ * another in the packed buffer, to be written out as blocks of their
+ * own. The codes are built in the block's context, so encoding block
+ * after block allocates nothing.
+
+ * struct Block* block - block to encode, failed is set if it can't be
+*/
+void encodeBlock(struct Block* block)
+{
+  struct HuffContext* context = block->context;
+  const unsigned long* rows;
+  unsigned long rawUsed = 0;
+  int p, i;
+
+  block->failed = 1;
+  block->packedLength = 0;
+  block->bits = 0;
+  block->extraBits = 0;
+  for(i = 0; i < 256; i++) block->freq[i] = 0;
+
+  block->numParts = findBlockSplits(block);
+  rows = context->splitFreq;
+  for(p = 0; p < block->numParts; p++)
+  {
+    struct BlockPart* part = &block->parts[p];
+    for(i = 0; i < 256; i++) context->freq[i] = rows[256 * (p + 1) + i] - rows[256 * p + i];
+
+    if(!encodePart(block, part, block->raw + rawUsed, block->packed + block->packedLength)) return;
+    rawUsed += part->rawLength;
+    block->packedLength += part->packedLength;
+  }
+  block->kind = block->parts[0].kind;
+  block->failed = 0;
+}
+
+/*
+ * Writes the codes of a buffer split into streams, symbol i going to 
+ * stream i % numStreams, with the code last built in the context. Each 
+ * stream on its own is no longer than the symbols dealt to it, the same
+ * as for a single stream, so the streams never take more than srcLength
+ * bytes together.
+
+ * struct HuffContext* context - holds the code
+ * const unsigned char* src - bytes to encode
+ * unsigned long srcLength - how many bytes src holds
+ * int numStreams - how many streams, 2 to MAX_STREAMS
+ * unsigned char* dest - where the stream table and streams go
+
+ * returns unsigned long - how many bytes were written
+*/
+unsigned long writeStreams(struct HuffContext* context, const unsigned char* src,
+                           unsigned long srcLength, int numStreams, unsigned char* dest)
+{
+  struct CodeTable* table = &context->table;
+  struct BitWriter writer;
+  unsigned long tableLength = 1 + 4 * (unsigned long)(numStreams - 1);
+  unsigned long used = tableLength;
+  int k, j;
+
+  dest[0] = (unsigned char)numStreams;
+  for(k = 0; k < numStreams; k++)
+  {
+    unsigned long count = (srcLength + numStreams - 1 - k) / numStreams;
+    initMemoryWriter(&writer, dest + used, srcLength - (used - tableLength));
+    writeCodes(&writer, table, src + k, count, numStreams);
+    flushBits(&writer);
+    used += writer.used;
+
+    /* the last stream's length is whatever is left */
+    if(k < numStreams - 1)
+    {
+      for(j = 0; j < 4; j++) dest[1 + 4*k + j] = (unsigned char)((writer.used >> (8*j)) & 0xFF);
+    }
+  }
+  return used;
+}
+
+/*
+ * Decodes codes using a lookup table, a whole code per lookup unless it
+ * is longer than the table's bits. May be called again with the same
+ * reader to carry on where the last call stopped.
+
+ * struct DecodeTable* table - lookup table for the codes
+ * struct BitReader* reader - where the encoded bits come from
+ * unsigned char* dest - where decoded symbols go
+ * unsigned long count - how many symbols to decode
+
+ * returns int - 1 if all symbols were decoded
+ *               0 if the bits are corrupt or run out
+*/
+int decodeSymbols(struct DecodeTable* table, struct BitReader* reader,
+                  unsigned char* dest, unsigned long count)
+{
+  struct DecodeEntry* entries = table->entries;
+  DecodeKernel kernel = findDecodeKernel(table, 1);
+  unsigned long i;
+
+  /* A tree of one leaf has an empty code, every char is that symbol */
+  if(table->rootBits == 0)
+  {
+    memset(dest, (int)entries[0].value, count);
+    return 1;
+  }
+  if(table->useMulti) return decodeMultiSymbols(table, reader, dest, count);
+  if(kernel != NULL) return kernel(entries, reader, dest, count);
+
+  for(i = 0; i < count; i++)
+  {
+    struct DecodeEntry entry;
+    unsigned int bits = table->rootBits;
+    unsigned int base = 0;
+
+    while(1)
+    {
+      if(reader->bitCount < bits) refillBits(reader);
+
+      entry = entries[base + (unsigned int)(reader->bitBuf >> (64 - bits))];
+      if(entry.subBits == 0) break;
+
+      /* Code is longer than this table, continue in the sub-table */
+      reader->bitBuf <<= bits;
+      reader->bitCount -= bits;
+      base = entry.value;
+      bits = entry.subBits;
+    }
+
+    if(entry.length == 0) return 0;
+    reader->bitBuf <<= entry.length;
+    reader->bitCount -= entry.length;
+    dest[i] = (unsigned char)entry.value;
+  }
+
+  /* Bits used can't be more than were there */
+  return !readPastEnd(reader);
+}
+
+/*
+ * Decodes codes dealt out to several streams, a symbol from each stream
+ * in turn. Each stream has its own reader, and since no stream waits on
+ * another, the processor gets to work on all of their lookups at once
+ * instead of waiting on one code before it can find where the next starts.
+
+ * struct DecodeTable* table - lookup table for the codes
+ * struct BitReader* readers - a reader for every stream
+ * int numStreams - how many streams there are
+ * unsigned char* dest - where decoded symbols go
+ * unsigned long count - how many symbols to decode over all streams
+
+ * returns int - 1 if all symbols were decoded
+ *               0 if the bits are corrupt or run out
+*/
+int decodeStreams(struct DecodeTable* table, struct BitReader* readers, int numStreams,
+                  unsigned char* dest, unsigned long count)
+{
+  struct DecodeEntry* entries = table->entries;
+  unsigned int rootBits = table->rootBits;
+  DecodeKernel kernel = findDecodeKernel(table, numStreams);
+  unsigned long i = 0;
+  int k;
+
+  if(kernel != NULL) return kernel(entries, readers, dest, count);
+
+  /* A refilled bit buffer holds at least 56 bits, enough for a few whole
+   * codes, so each stream is refilled once per visit and gives up that
+   * many codes without checking for more bits in between */
+  if(table->longest <= 56)
+  {
+    unsigned int perRefill = 56 / table->longest;
+    unsigned long round = (unsigned long)perRefill * numStreams;
+    unsigned int bad = 0;
+
+    for(; i + round <= count; i += round)
+    {
+      for(k = 0; k < numStreams; k++)
+      {
+        struct BitReader* reader = &readers[k];
+        uint64_t bitBuf;
+        unsigned int bitCount, j;
+        unsigned char* out = dest + i + k;
+
+        refillBits(reader);
+        bitBuf = reader->bitBuf;
+        bitCount = reader->bitCount;
+        for(j = 0; j < perRefill; j++)
+        {
+          unsigned int bits = rootBits;
+          struct DecodeEntry entry = entries[bitBuf >> (64 - bits)];
+
+          /* Codes longer than the root table go on into sub-tables */
+          while(entry.subBits != 0)
+          {
+            bitBuf <<= bits;
+            bitCount -= bits;
+            bits = entry.subBits;
+            entry = entries[entry.value + (unsigned int)(bitBuf >> (64 - bits))];
+          }
+          bad |= entry.length == 0;
+          bitBuf <<= entry.length;
+          bitCount -= entry.length;
+          out[j * numStreams] = (unsigned char)entry.value;
+        }
+        reader->bitBuf = bitBuf;
+        reader->bitCount = bitCount;
+      }
+    }
+    if(bad) return 0;
+  }
+
+  for(; i < count; i += numStreams)
+  {
+    int left = (count - i < (unsigned long)numStreams) ? (int)(count - i) : numStreams;
+
+    for(k = 0; k < left; k++)
+    {
+      struct BitReader* reader = &readers[k];
+      struct DecodeEntry entry;
+      unsigned int bits = rootBits;
+      unsigned int base = 0;
+
+      while(1)
+      {
+        if(reader->bitCount < bits) refillBits(reader);
+
+        entry = entries[base + (unsigned int)(reader->bitBuf >> (64 - bits))];
+        if(entry.subBits == 0) break;
+
+        reader->bitBuf <<= bits;
+        reader->bitCount -= bits;
+        base = entry.value;
+        bits = entry.subBits;
+      }
+
+      if(entry.length == 0) return 0;
+      reader->bitBuf <<= entry.length;
+      reader->bitCount -= entry.length;
+      dest[i + k] = (unsigned char)entry.value;
+    }
+  }
+
+  for(k = 0; k < numStreams; k++)
+  {
+    if(readPastEnd(&readers[k])) return 0;
+  }
+  return 1;
+}
+
+/*
+ * Reads the stream table of a BLOCK_STREAMS block and sets up a reader
+ * for every stream.
+
+ * const unsigned char* src - stream table, followed by the streams
+ * unsigned long srcLength - how many bytes src holds
+ * struct BitReader* readers - array of MAX_STREAMS readers to set up
+ * int* numStreams - set to how many streams there are
+
+ * returns int - 1 if the table was read
+ *               0 if it is malformed
+*/
+int readStreams(const unsigned char* src, unsigned long srcLength,
+                struct BitReader* readers, int* numStreams)
+{
+  unsigned long pos, tableLength;
+  int k, j;
+
+  if(srcLength < 1 || src[0] < 2 || src[0] > MAX_STREAMS) return 0;
+  *numStreams = src[0];
+  tableLength = 1 + 4 * (unsigned long)(*numStreams - 1);
+  if(srcLength < tableLength) return 0;
+
+  pos = tableLength;
+  for(k = 0; k < *numStreams; k++)
+  {
+    unsigned long length = 0;
+    if(k < *numStreams - 1)
+    {
+      for(j = 0; j < 4; j++) length |= (unsigned long)src[1 + 4*k + j] << (8*j);
+      if(length > srcLength - pos) return 0;
+    }
+    else length = srcLength - pos;
+
+    initMemoryReader(&readers[k], src + pos, length);
+    pos += length;
+  }
+  return 1;
+}
+
+/*
+ * Decodes the packed bytes of a block of any kind. The lookup tables
+ * are built in the context, so decoding block after block reuses them.
+
+ * struct HuffContext* context - scratch memory
+ * int kind - BLOCK_HUFFMAN, BLOCK_STREAMS, BLOCK_ORDER1 or BLOCK_STORED
+ * const unsigned char* packed - code lengths followed by the encoded bits
+ * unsigned long packedLength - how many bytes packed holds
+ * unsigned char* raw - where the decoded bytes go
+ * unsigned long rawLength - how many bytes the block decodes to
+
+ * returns int - 1 if decoded
+ *               0 if the block is corrupt
+*/
+int decodePayload(struct HuffContext* context, int kind, const unsigned char* packed,
+                  unsigned long packedLength, unsigned char* raw, unsigned long rawLength)
+{
+  struct BitReader readers[MAX_STREAMS];
+  int numStreams, decoded;
+  double start;
+  long headerLength;
+
+  if(kind == BLOCK_ORDER1) return decodeOrder1(context, packed, packedLength, raw, rawLength);
+  if(kind == BLOCK_STORED)
+  {
+    if(packedLength != rawLength) return 0;
+    start = startPhase(context->stats);
+    memcpy(raw, packed, rawLength);
+    endPhase(context->stats, PHASE_DECODE, start, packedLength);
+    if(context->stats != NULL) context->stats->symbols += rawLength;
+    return 1;
+  }
+
+  start = startPhase(context->stats);
+  headerLength = readLengthsFrom(packed, packedLength, context->lengths);
+  if(headerLength < 0) return 0;
+  packed += headerLength;
+  packedLength -= (unsigned long)headerLength;
+  endPhase(context->stats, PHASE_HEADER_PARSE, start, (uint64_t)headerLength);
+
+  if(kind == BLOCK_HUFFMAN)
+  {
+    return decodeContextSymbols(context, context->lengths, packed, packedLength, raw, rawLength);
+  }
+
+  start = startPhase(context->stats);
+  if(kind != BLOCK_STREAMS || !readStreams(packed, packedLength, readers, &numStreams) ||
+     !fillCanonicalTable(&context->decodeTable, context->lengths))
+  {
+    return 0;
+  }
+  endPhase(context->stats, PHASE_HEADER_PARSE, start, 0);
+
+  start = startPhase(context->stats);
+  decoded = decodeStreams(&context->decodeTable, readers, numStreams, raw, rawLength);
+  endPhase(context->stats, PHASE_DECODE, start, packedLength);
+  addTableStats(context->stats, &context->decodeTable, rawLength);
+  return decoded;
+}
+
+/*
+ * Decodes the packed bytes of a block into its raw buffer, which must
+ * already hold rawLength bytes. Works in the block's context.
+
+ * struct Block* block - block to decode, failed is set if it is corrupt
+*/
+void decodeBlock(struct Block* block)
+{
+  block->failed = !decodePayload(block->context, block->kind, block->packed,
+                                 block->packedLength, block->raw, block->rawLength);
+}
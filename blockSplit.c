@@ -0,0 +1,207 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for finding where a block is better off
+ * split into blocks with codes of their own. A block is counted a
+ * segment at a time, and the bits any run of segments would take as a
+ * block of its own are estimated from the counts: their entropy, plus
+ * the block header and the code lengths. Runs are split in two where
+ * that estimate comes out lowest, for as long as splitting saves enough
+ * over keeping them whole. Files made of pieces that look nothing alike,
+ * like archives of text and images, then get a code for each piece,
+ * while blocks that look the same all the way through stay whole.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "huffman.h"
+
+/* Function Declarations */
+double countBits(const double* table, unsigned long count);
+double partBits(const double* table, const unsigned long* first, const unsigned long* last);
+double runBits(const double* table, const unsigned long* rows, double* known,
+               int first, int last);
+void splitSegments(const double* table, const unsigned long* rows, double* known,
+                   int first, int last, unsigned char* splits);
+
+/*
+ * Gives count * log2(count), from the table for small counts
+
+ * const double* table - count * log2(count) of counts below SPLIT_TABLE_COUNTS
+ * unsigned long count - count to look up
+
+ * returns double - count * log2(count), 0 for a count of 0
+*/
+double countBits(const double* table, unsigned long count)
+{
+  if(count < SPLIT_TABLE_COUNTS) return table[count];
+  return (double)count * log((double)count) / log(2.0);
+}
+
+/*
+ * Estimates the bits a run of segments takes as a block of its own: the
+ * entropy of its counts, its header and index entry, and a byte for the
+ * code length of each symbol in it
+
+ * const double* table - count * log2(count) of counts below SPLIT_TABLE_COUNTS
+ * const unsigned long* first - running counts where the run starts
+ * const unsigned long* last - running counts where it ends
+
+ * returns double - estimated bits
+*/
+double partBits(const double* table, const unsigned long* first, const unsigned long* last)
+{
+  unsigned long total = 0;
+  double sum = 0;
+  int used = 0;
+  int i;
+
+  for(i = 0; i < 256; i++)
+  {
+    unsigned long count = last[i] - first[i];
+    if(count == 0) continue;
+    sum += countBits(table, count);
+    total += count;
+    used++;
+  }
+  if(used == 0) return 0;
+  return countBits(table, total) - sum + 8.0 * (SPLIT_BLOCK_BYTES + used);
+}
+
+/*
+ * Gives the estimated bits of a run of segments, working them out only
+ * the first time a run is asked for
+
+ * const double* table - count * log2(count) of counts below SPLIT_TABLE_COUNTS
+ * const unsigned long* rows - running counts at every segment boundary
+ * double* known - bits of each run worked out so far, negative if not yet
+ * int first - segment the run starts at
+ * int last - segment boundary the run ends at
+
+ * returns double - estimated bits
+*/
+double runBits(const double* table, const unsigned long* rows, double* known,
+               int first, int last)
+{
+  double* bits = &known[first * (SPLIT_MAX_SEGMENTS + 1) + last];
+  if(*bits < 0) *bits = partBits(table, rows + 256 * first, rows + 256 * last);
+  return *bits;
+}
+
+/*
+ * Splits a run of segments in two where the parts are estimated to take
+ * the fewest bits, if that saves at least 1/SPLIT_MIN_SAVING of the bits
+ * the run takes whole, and then does the same for each part
+
+ * const double* table - count * log2(count) of counts below SPLIT_TABLE_COUNTS
+ * const unsigned long* rows - running counts at every segment boundary
+ * double* known - bits of each run worked out so far, negative if not yet
+ * int first - segment the run starts at
+ * int last - segment boundary the run ends at
+ * unsigned char* splits - set to 1 at each boundary split at
+*/
+void splitSegments(const double* table, const unsigned long* rows, double* known,
+                   int first, int last, unsigned char* splits)
+{
+  double best;
+  int bestSplit = -1;
+  int k;
+
+  if(last - first < 2) return;
+  best = runBits(table, rows, known, first, last);
+  best -= best / SPLIT_MIN_SAVING;
+  for(k = first + 1; k < last; k++)
+  {
+    double bits = runBits(table, rows, known, first, k) +
+                  runBits(table, rows, known, k, last);
+    if(bits < best)
+    {
+      best = bits;
+      bestSplit = k;
+    }
+  }
+  if(bestSplit < 0) return;
+
+  splits[bestSplit] = 1;
+  splitSegments(table, rows, known, first, bestSplit, splits);
+  splitSegments(table, rows, known, bestSplit, last, splits);
+}
+
+/*
+ * Counts the symbols of a block a segment at a time and picks where to
+ * split it. The counts go to the block's context, which keeps them and
+ * the table of count * log2(count) from block to block, and end up as
+ * the running counts at the end of each part, so the parts need not be
+ * counted again. Building with -DNO_BLOCK_SPLITS leaves every block
+ * whole, to measure what splitting gains.
+
+ * struct Block* block - block to split, gets its parts' raw lengths
+
+ * returns int - how many parts the block is split into
+*/
+int findBlockSplits(struct Block* block)
+{
+  struct HuffContext* context = block->context;
+  unsigned long numSegments = block->rawLength / SPLIT_SEGMENT_BYTES;
+  unsigned long segmentBytes, s, end, from = 0;
+  unsigned long* rows;
+  unsigned char splits[SPLIT_MAX_SEGMENTS];
+  int numParts = 0;
+  double start = startPhase(context->stats);
+
+  if(numSegments < 1) numSegments = 1;
+  if(numSegments > SPLIT_MAX_SEGMENTS) numSegments = SPLIT_MAX_SEGMENTS;
+  segmentBytes = block->rawLength / numSegments;
+  if(context->splitRows < numSegments + 1)
+  {
+    context->splitRows = numSegments + 1;
+    context->splitFreq = (unsigned long*)realloc(context->splitFreq,
+                                                 sizeof(unsigned long) * 256 * context->splitRows);
+  }
+  rows = context->splitFreq;
+
+  /* row s holds the counts of everything before segment s */
+  memset(rows, 0, sizeof(unsigned long) * 256);
+  countSegments(block->raw, block->rawLength, segmentBytes, numSegments, rows + 256);
+  for(s = 0; s < numSegments; s++) splits[s] = 0;
+  endPhase(context->stats, PHASE_COUNT, start, block->rawLength);
+
+  start = startPhase(context->stats);
+#ifndef NO_BLOCK_SPLITS
+  {
+    double known[(SPLIT_MAX_SEGMENTS + 1) * (SPLIT_MAX_SEGMENTS + 1)];
+    int i, j;
+
+    if(context->splitBits == NULL)
+    {
+      context->splitBits = (double*)malloc(sizeof(double) * SPLIT_TABLE_COUNTS);
+      context->splitBits[0] = 0;
+      for(i = 1; i < SPLIT_TABLE_COUNTS; i++)
+      {
+        context->splitBits[i] = (double)i * log((double)i) / log(2.0);
+      }
+    }
+    for(i = 0; i <= (int)numSegments; i++)
+    {
+      for(j = 0; j <= (int)numSegments; j++) known[i * (SPLIT_MAX_SEGMENTS + 1) + j] = -1;
+    }
+    splitSegments(context->splitBits, rows, known, 0, (int)numSegments, splits);
+  }
+#endif
+
+  /* only the rows where parts end are kept, part p ending at row p + 1 */
+  for(s = 1; s <= numSegments; s++)
+  {
+    if(s < numSegments && !splits[s]) continue;
+    end = (s == numSegments) ? block->rawLength : s * segmentBytes;
+    block->parts[numParts].rawLength = end - from;
+    from = end;
+    numParts++;
+    if((unsigned long)numParts < s)
+    {
+      memcpy(rows + 256 * numParts, rows + 256 * s, sizeof(unsigned long) * 256);
+    }
+  }
+  endPhase(context->stats, PHASE_TREE, start, 0);
+  return numParts;
+}
@@ -0,0 +1,496 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for encoding and decoding whole buffers in
+ * memory, for programs that want huffman coding without going through
+ * files. All the scratch memory lives in a HuffContext made once and
+ * handed to every call, so once its decode table has grown to what the
+ * codes need, calls don't allocate anything. Buffers are encoded in the
+ * FORMAT_CANONICAL layout, the same bytes huffencode -c writes, and both
+ * that and FORMAT_BLOCKS can be decoded.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "huffman.h"
+
+/* Function Declarations */
+unsigned long loadU32(const unsigned char* src);
+uint64_t loadU64(const unsigned char* src);
+void storeU64(unsigned char* dest, uint64_t value);
+int decodeCanonicalBuffer(struct HuffContext* context, const unsigned char* src,
+                          unsigned long srcLength, unsigned char* dest,
+                          unsigned long destCapacity, unsigned long* destLength);
+int decodeBlocksBuffer(struct HuffContext* context, const unsigned char* src,
+                       unsigned long srcLength, unsigned char* dest,
+                       unsigned long destCapacity, unsigned long* destLength);
+
+/*
+ * Creates a context for encoding and decoding buffers in memory. The
+ * decode table starts out with room for a full root table, so only codes
+ * needing sub-tables ever make it grow.
+
+ * int maxLength - longest code allowed when encoding, 0 for no limit
+ * int numThreads - threads to count symbols with, 1 to never allocate
+
+ * returns HuffContext* - newly allocated context, free with freeHuffContext
+*/
+struct HuffContext* createHuffContext(int maxLength, int numThreads)
+{
+  struct HuffContext* context = (struct HuffContext*)malloc(sizeof(struct HuffContext));
+
+  context->maxLength = maxLength;
+  context->numThreads = (numThreads < 1) ? 1 : numThreads;
+  context->bits = 0;
+  context->extraBits = 0;
+  context->stats = NULL;
+  context->model = NULL;
+  context->splitFreq = NULL;
+  context->splitRows = 0;
+  context->splitBits = NULL;
+  context->decodeTable.size = 0;
+  context->decodeTable.rootBits = 0;
+  context->decodeTable.multi = NULL;
+  context->decodeTable.useMulti = 0;
+  context->decodeTable.capacity = 1 << TABLE_BITS;
+  context->decodeTable.entries = (struct DecodeEntry*)malloc(sizeof(struct DecodeEntry) *
+                                                             context->decodeTable.capacity);
+  return context;
+}
+
+/*
+ * Frees a context and all of its scratch memory
+
+ * struct HuffContext* context - context to free
+*/
+void freeHuffContext(struct HuffContext* context)
+{
+  if(context == NULL) return;
+  free(context->decodeTable.entries);
+  free(context->decodeTable.multi);
+  freeContextModel(context->model);
+  free(context->splitFreq);
+  free(context->splitBits);
+  free(context);
+}
+
+/*
+ * Gives the most bytes encodeBuffer can write for a buffer. No huffman
+ * code does worse than the 8 bit code every byte already has, so the
+ * encoded bits never take more bytes than were encoded.
+
+ * unsigned long srcLength - bytes to be encoded
+
+ * returns unsigned long - largest possible encoded size
+*/
+unsigned long encodeBound(unsigned long srcLength)
+{
+  return MAX_HEADER_BYTES + srcLength;
+}
+
+/*
+ * Counts the symbols of a buffer and builds the canonical code for it in
+ * the context
+
+ * struct HuffContext* context - gets the counts, lengths, codes and bits
+ * const unsigned char* src - bytes the code is for
+ * unsigned long srcLength - how many bytes src holds
+
+ * returns int - 1 if the code was built
+ *               0 if the length limit is out of range
+*/
+int buildContextCode(struct HuffContext* context, const unsigned char* src, unsigned long srcLength)
+{
+  int i;
+  double start = startPhase(context->stats);
+
+  for(i = 0; i < 256; i++) context->freq[i] = 0;
+  countBytesParallel(src, srcLength, context->freq, context->numThreads);
+  endPhase(context->stats, PHASE_COUNT, start, srcLength);
+  return buildCountedCode(context);
+}
+
+/*
+ * Builds the canonical code for the symbol counts already in the
+ * context, for callers that counted them some other way. The tree is
+ * built in the context's arena, and only codes longer than the limit go
+ * through the slower package-merge. Without a limit, codes are still
+ * kept to MAX_CODE_LENGTH, which only matters for buffers of many
+ * terabytes.
+
+ * struct HuffContext* context - holds the counts, gets the lengths, codes and bits
+
+ * returns int - 1 if the code was built
+ *               0 if the length limit is out of range
+*/
+int buildCountedCode(struct HuffContext* context)
+{
+  struct SymbolNode** codes;
+  struct SymbolNode* root;
+  int maxLength = context->maxLength;
+  int longest = 0;
+  int i;
+  double start = startPhase(context->stats);
+
+  codes = buildCodes(&context->arena, context->freq, &root);
+  context->bits = 0;
+  for(i = 0; i < 256; i++)
+  {
+    unsigned int length = (codes[i] == NULL) ? 0 : codes[i]->length;
+    if((int)length > longest) longest = (int)length;
+    context->lengths[i] = (length > MAX_CODE_LENGTH) ? MAX_CODE_LENGTH : (unsigned char)length;
+    context->bits += (uint64_t)context->freq[i] * length;
+  }
+
+  context->extraBits = 0;
+  if(maxLength == 0 && longest > MAX_CODE_LENGTH) maxLength = MAX_CODE_LENGTH;
+  if(maxLength > 0 && longest > maxLength)
+  {
+    uint64_t unlimitedBits = context->bits;
+    if(!limitCodeLengths(&context->arena, context->freq, context->lengths, maxLength)) return 0;
+    context->bits = 0;
+    for(i = 0; i < 256; i++) context->bits += (uint64_t)context->freq[i] * context->lengths[i];
+    context->extraBits = context->bits - unlimitedBits;
+  }
+
+  if(canonicalCodes(context->lengths, context->table.code) < 0) return 0;
+  for(i = 0; i < 256; i++) context->table.length[i] = context->lengths[i];
+  endPhase(context->stats, PHASE_TREE, start, 0);
+  addCodeStats(context->stats, context->freq, context->lengths);
+  return 1;
+}
+
+/*
+ * Writes the codes of a buffer with the code last built in the context,
+ * exactly (bits + 7) / 8 bytes of them, the last byte padded with zeroes.
+
+ * struct HuffContext* context - holds the code
+ * const unsigned char* src - bytes to encode, those the code was built for
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where the encoded bits go
+*/
+void writeContextSymbols(struct HuffContext* context, const unsigned char* src,
+                         unsigned long srcLength, unsigned char* dest)
+{
+  struct CodeTable* table = &context->table;
+  struct BitWriter writer;
+
+  initMemoryWriter(&writer, dest, (unsigned long)((context->bits + 7) / 8));
+  writeCodes(&writer, table, src, srcLength, 1);
+  flushBits(&writer);
+}
+
+/*
+ * Decodes bits written with a canonical code of the given lengths. The
+ * lookup table is filled into the context's table, which keeps its
+ * entries from one call to the next.
+
+ * struct HuffContext* context - scratch memory
+ * const unsigned char* lengths - code length of each of the 256 symbols
+ * const unsigned char* src - encoded bits
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where decoded symbols go
+ * unsigned long count - how many symbols to decode
+
+ * returns int - 1 if all symbols were decoded
+ *               0 if the lengths or bits are corrupt
+*/
+int decodeContextSymbols(struct HuffContext* context, const unsigned char* lengths,
+                         const unsigned char* src, unsigned long srcLength,
+                         unsigned char* dest, unsigned long count)
+{
+  struct BitReader reader;
+  double start = startPhase(context->stats);
+  int decoded;
+
+  if(!fillCanonicalTable(&context->decodeTable, lengths)) return 0;
+  fillMultiTable(&context->decodeTable);
+  endPhase(context->stats, PHASE_HEADER_PARSE, start, 0);
+
+  start = startPhase(context->stats);
+  initMemoryReader(&reader, src, srcLength);
+  decoded = decodeSymbols(&context->decodeTable, &reader, dest, count);
+  endPhase(context->stats, PHASE_DECODE, start, srcLength);
+  addTableStats(context->stats, &context->decodeTable, count);
+  return decoded;
+}
+
+/*
+ * Encodes a buffer as a FORMAT_CANONICAL stream: the magic bytes, the
+ * format, the run-length encoded code lengths, the number of bytes
+ * encoded (8 bytes) and then the encoded bits.
+
+ * struct HuffContext* context - scratch memory, also keeps the code used
+ * const unsigned char* src - bytes to encode
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where the encoded stream goes
+ * unsigned long destCapacity - bytes dest holds, encodeBound is always enough
+ * unsigned long* destLength - set to how many bytes were written
+
+ * returns int - 1 if encoded
+ *               0 if dest is too small
+*/
+int encodeBuffer(struct HuffContext* context, const unsigned char* src, unsigned long srcLength,
+                 unsigned char* dest, unsigned long destCapacity, unsigned long* destLength)
+{
+  unsigned char packedLengths[MAX_LENGTHS_BYTES];
+  unsigned long numBytes, headerLength, bitBytes, i;
+  double start;
+
+  *destLength = 0;
+  if(!buildContextCode(context, src, srcLength)) return 0;
+
+  start = startPhase(context->stats);
+  numBytes = writeLengths(packedLengths, context->lengths);
+  headerLength = 4 + numBytes + 8;
+  bitBytes = (unsigned long)((context->bits + 7) / 8);
+  if(headerLength > destCapacity || bitBytes > destCapacity - headerLength) return 0;
+
+  dest[0] = MAGIC_0;
+  dest[1] = MAGIC_1;
+  dest[2] = MAGIC_2;
+  dest[3] = FORMAT_CANONICAL;
+  for(i = 0; i < numBytes; i++) dest[4 + i] = packedLengths[i];
+  storeU64(dest + 4 + numBytes, srcLength);
+  endPhase(context->stats, PHASE_HEADER_WRITE, start, headerLength);
+
+  start = startPhase(context->stats);
+  writeContextSymbols(context, src, srcLength, dest + headerLength);
+  endPhase(context->stats, PHASE_ENCODE, start, bitBytes);
+  *destLength = headerLength + bitBytes;
+  return 1;
+}
+
+/*
+ * Finds how many bytes an encoded stream decodes to, from its headers
+
+ * const unsigned char* src - FORMAT_CANONICAL or FORMAT_BLOCKS stream
+ * unsigned long srcLength - how many bytes src holds
+ * uint64_t* length - set to the decoded length
+
+ * returns int - 1 if the length was found
+ *               0 if the stream is malformed or in another format
+*/
+int decodedLength(const unsigned char* src, unsigned long srcLength, uint64_t* length)
+{
+  if(srcLength < 4 || src[0] != MAGIC_0 || src[1] != MAGIC_1 || src[2] != MAGIC_2) return 0;
+  return formatLength(src[3], src + 4, srcLength - 4, length);
+}
+
+/*
+ * Finds how many bytes the part of a stream after the magic bytes and
+ * the format decodes to. Every code is at least a bit long, so a
+ * canonical stream can't decode to more bytes than it has bits. Blocks
+ * each say how long they are, so their headers are added up.
+
+ * int format - FORMAT_CANONICAL or FORMAT_BLOCKS
+ * const unsigned char* src - stream after the format byte
+ * unsigned long srcLength - how many bytes src holds
+ * uint64_t* length - set to the decoded length
+
+ * returns int - 1 if the length was found
+ *               0 if the stream is malformed or in another format
+*/
+int formatLength(int format, const unsigned char* src, unsigned long srcLength, uint64_t* length)
+{
+  unsigned char lengths[256];
+  unsigned long pos;
+  long numBytes;
+
+  *length = 0;
+  if(format == FORMAT_CANONICAL)
+  {
+    numBytes = readLengthsFrom(src, srcLength, lengths);
+    if(numBytes < 0 || srcLength - (unsigned long)numBytes < 8) return 0;
+    pos = (unsigned long)numBytes + 8;
+    *length = loadU64(src + numBytes);
+    return *length / 8 <= srcLength - pos;
+  }
+  if(format != FORMAT_BLOCKS || srcLength < 4) return 0;
+
+  pos = 4;
+  while(pos < srcLength && (src[pos] == BLOCK_HUFFMAN || src[pos] == BLOCK_STREAMS ||
+                             src[pos] == BLOCK_ORDER1 || src[pos] == BLOCK_STORED))
+  {
+    unsigned long packedLength;
+    if(srcLength - pos < 9) return 0;
+    *length += loadU32(src + pos + 1);
+    packedLength = loadU32(src + pos + 5);
+    pos += 9;
+    if(packedLength > srcLength - pos) return 0;
+    pos += packedLength;
+  }
+  return pos < srcLength && src[pos] == BLOCK_END;
+}
+
+/*
+ * Decodes a FORMAT_CANONICAL or FORMAT_BLOCKS stream held in memory
+
+ * struct HuffContext* context - scratch memory
+ * const unsigned char* src - encoded stream, starting with the magic bytes
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where decoded bytes go
+ * unsigned long destCapacity - bytes dest holds, see decodedLength
+ * unsigned long* destLength - set to how many bytes were decoded
+
+ * returns int - 1 if decoded
+ *               0 if the stream is corrupt or dest is too small
+*/
+int decodeBuffer(struct HuffContext* context, const unsigned char* src, unsigned long srcLength,
+                 unsigned char* dest, unsigned long destCapacity, unsigned long* destLength)
+{
+  *destLength = 0;
+  if(srcLength < 4 || src[0] != MAGIC_0 || src[1] != MAGIC_1 || src[2] != MAGIC_2) return 0;
+  return decodeFormat(context, src[3], src + 4, srcLength - 4, dest, destCapacity, destLength);
+}
+
+/*
+ * Decodes the part of a stream after the magic bytes and the format
+
+ * struct HuffContext* context - scratch memory
+ * int format - FORMAT_CANONICAL or FORMAT_BLOCKS
+ * const unsigned char* src - stream after the format byte
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where decoded bytes go
+ * unsigned long destCapacity - bytes dest holds
+ * unsigned long* destLength - set to how many bytes were decoded
+
+ * returns int - 1 if decoded
+ *               0 if the stream is corrupt or dest is too small
+*/
+int decodeFormat(struct HuffContext* context, int format, const unsigned char* src,
+                 unsigned long srcLength, unsigned char* dest, unsigned long destCapacity,
+                 unsigned long* destLength)
+{
+  *destLength = 0;
+  if(format == FORMAT_CANONICAL)
+  {
+    return decodeCanonicalBuffer(context, src, srcLength, dest, destCapacity, destLength);
+  }
+  if(format == FORMAT_BLOCKS)
+  {
+    return decodeBlocksBuffer(context, src, srcLength, dest, destCapacity, destLength);
+  }
+  return 0;
+}
+
+/*
+ * Decodes a canonical code stream, after the magic bytes and the format
+
+ * struct HuffContext* context - scratch memory
+ * const unsigned char* src - code lengths, then the count and the bits
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where decoded bytes go
+ * unsigned long destCapacity - bytes dest holds
+ * unsigned long* destLength - set to how many bytes were decoded
+
+ * returns int - 1 if decoded
+ *               0 if the stream is corrupt or dest is too small
+*/
+int decodeCanonicalBuffer(struct HuffContext* context, const unsigned char* src,
+                          unsigned long srcLength, unsigned char* dest,
+                          unsigned long destCapacity, unsigned long* destLength)
+{
+  double start = startPhase(context->stats);
+  long numBytes = readLengthsFrom(src, srcLength, context->lengths);
+  unsigned long pos;
+  uint64_t numChars;
+
+  if(numBytes < 0 || srcLength - (unsigned long)numBytes < 8) return 0;
+  numChars = loadU64(src + numBytes);
+  pos = (unsigned long)numBytes + 8;
+  endPhase(context->stats, PHASE_HEADER_PARSE, start, pos);
+  if(numChars > destCapacity) return 0;
+
+  if(!decodeContextSymbols(context, context->lengths, src + pos, srcLength - pos,
+                           dest, (unsigned long)numChars)) return 0;
+  *destLength = (unsigned long)numChars;
+  return 1;
+}
+
+/*
+ * Decodes the blocks of a FORMAT_BLOCKS stream one after another, after
+ * the magic bytes and the format. The index at the end isn't needed.
+
+ * struct HuffContext* context - scratch memory
+ * const unsigned char* src - block size, then the blocks
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where decoded bytes go
+ * unsigned long destCapacity - bytes dest holds
+ * unsigned long* destLength - set to how many bytes were decoded
+
+ * returns int - 1 if every block was decoded
+ *               0 if the stream is corrupt or dest is too small
+*/
+int decodeBlocksBuffer(struct HuffContext* context, const unsigned char* src,
+                       unsigned long srcLength, unsigned char* dest,
+                       unsigned long destCapacity, unsigned long* destLength)
+{
+  unsigned long pos = 4; /* past the block size */
+  unsigned long used = 0;
+
+  if(srcLength < 4) return 0;
+  while(1)
+  {
+    unsigned long rawLength, packedLength;
+    int kind;
+
+    if(pos >= srcLength) return 0;
+    kind = src[pos];
+    if(kind == BLOCK_END) break;
+    if(srcLength - pos < 9) return 0;
+
+    rawLength = loadU32(src + pos + 1);
+    packedLength = loadU32(src + pos + 5);
+    pos += 9;
+    if(packedLength > srcLength - pos || rawLength > destCapacity - used) return 0;
+
+    if(!decodePayload(context, kind, src + pos, packedLength, dest + used, rawLength)) return 0;
+    used += rawLength;
+    pos += packedLength;
+  }
+
+  *destLength = used;
+  return 1;
+}
+
+/*
+ * Reads a 32 bit value stored as 4 bytes, least significant byte first
+
+ * const unsigned char* src - bytes to read
+
+ * returns unsigned long - value read
+*/
+unsigned long loadU32(const unsigned char* src)
+{
+  unsigned long value = 0;
+  int i;
+  for(i = 0; i < 4; i++) value |= (unsigned long)src[i] << (8*i);
+  return value;
+}
+
+/*
+ * Reads a 64 bit value stored as 8 bytes, least significant byte first
+
+ * const unsigned char* src - bytes to read
+
+ * returns uint64_t - value read
+*/
+uint64_t loadU64(const unsigned char* src)
+{
+  uint64_t value = 0;
+  int i;
+  for(i = 0; i < 8; i++) value |= (uint64_t)src[i] << (8*i);
+  return value;
+}
+
+/*
+ * Stores a 64 bit value as 8 bytes, least significant byte first
+
+ * unsigned char* dest - where to store it
+ * uint64_t value - value to store
+*/
+void storeU64(unsigned char* dest, uint64_t value)
+{
+  int i;
+  for(i = 0; i < 8; i++) dest[i] = (unsigned char)((value >> (8*i)) & 0xFF);
+}
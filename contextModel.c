@@ -0,0 +1,451 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for order-1 blocks, where the code each byte
+ * is written with depends on the byte before it. Text follows a letter
+ * with much more predictable letters than it uses overall, so this gets
+ * well below what a single code can. A code for every previous byte would
+ * need a big header, so previous bytes that are followed by much the same
+ * bytes are grouped together and share a code, and only up to
+ * ORDER1_MAX_CODES codes are stored. The codes are kept short enough to
+ * decode with a single table lookup, the decoder just switching tables
+ * from one symbol to the next.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "huffman.h"
+
+/* Function Declarations */
+void countContexts(struct ContextModel* model, const unsigned char* src, unsigned long srcLength);
+void clusterContexts(struct ContextModel* model, unsigned long srcLength);
+void estimateCosts(struct ContextModel* model, int numCodes);
+void sumClusters(struct ContextModel* model, int numCodes);
+
+/*
+ * Gives the context's order-1 model, making it the first time it is
+ * needed. The decode tables get room for a whole single level table up
+ * front, which is all an order-1 code can need, so they never grow.
+
+ * struct HuffContext* context - context the model belongs to
+
+ * returns ContextModel* - the model, freed along with the context
+*/
+struct ContextModel* getContextModel(struct HuffContext* context)
+{
+  struct ContextModel* model = context->model;
+  int k;
+
+  if(model != NULL) return model;
+  model = (struct ContextModel*)malloc(sizeof(struct ContextModel));
+  model->numCodes = 0;
+  for(k = 0; k < ORDER1_MAX_CODES; k++)
+  {
+    model->decodeTables[k].size = 0;
+    model->decodeTables[k].rootBits = 0;
+    model->decodeTables[k].multi = NULL;
+    model->decodeTables[k].useMulti = 0;
+    model->decodeTables[k].capacity = 1 << TABLE_BITS;
+    model->decodeTables[k].entries = (struct DecodeEntry*)malloc(sizeof(struct DecodeEntry) *
+                                                                 model->decodeTables[k].capacity);
+  }
+  context->model = model;
+  return model;
+}
+
+/*
+ * Frees an order-1 model and its decode tables
+
+ * struct ContextModel* model - model to free, may be NULL
+*/
+void freeContextModel(struct ContextModel* model)
+{
+  int k;
+  if(model == NULL) return;
+  for(k = 0; k < ORDER1_MAX_CODES; k++) free(model->decodeTables[k].entries);
+  free(model);
+}
+
+/*
+ * Counts how often each byte comes after each other byte, and lists for
+ * every previous byte only the bytes that do come after it, so the
+ * clustering doesn't have to look through 256 counts that are mostly 0.
+
+ * struct ContextModel* model - gets the counts and the lists
+ * const unsigned char* src - bytes to count
+ * unsigned long srcLength - how many bytes src holds
+*/
+void countContexts(struct ContextModel* model, const unsigned char* src, unsigned long srcLength)
+{
+  unsigned int used = 0;
+  unsigned char prev = 0;
+  unsigned long i;
+  int c, s;
+
+  memset(model->counts, 0, sizeof(model->counts));
+  for(i = 0; i < srcLength; i++)
+  {
+    model->counts[prev][src[i]]++;
+    prev = src[i];
+  }
+
+  for(c = 0; c < 256; c++)
+  {
+    model->listStart[c] = used;
+    model->total[c] = 0;
+    for(s = 0; s < 256; s++)
+    {
+      if(model->counts[c][s] == 0) continue;
+      model->listSymbol[used] = (unsigned char)s;
+      model->listCount[used] = model->counts[c][s];
+      model->total[c] += model->counts[c][s];
+      used++;
+    }
+  }
+  model->listStart[256] = used;
+}
+
+/*
+ * Estimates how many bits each symbol would take in each cluster's code
+ * from the cluster's counts. Symbols the cluster hasn't seen get half a
+ * count so that moving a previous byte into it has a price, not an
+ * infinite one.
+
+ * struct ContextModel* model - gets the costs of the clusters' counts
+ * int numCodes - how many clusters there are
+*/
+void estimateCosts(struct ContextModel* model, int numCodes)
+{
+  double bitsPerLog = 1.0 / log(2.0);
+  int k, s;
+
+  for(k = 0; k < numCodes; k++)
+  {
+    unsigned long total = 0;
+    double base;
+    for(s = 0; s < 256; s++) total += model->freq[k][s];
+    base = log((double)total + 128.0);
+    for(s = 0; s < 256; s++)
+    {
+      model->cost[k][s] = (base - log((double)model->freq[k][s] + 0.5)) * bitsPerLog;
+    }
+  }
+}
+
+/*
+ * Adds up the counts of the previous bytes in each cluster
+
+ * struct ContextModel* model - gets the counts of each cluster
+ * int numCodes - how many clusters there are
+*/
+void sumClusters(struct ContextModel* model, int numCodes)
+{
+  int k, c;
+  unsigned int j;
+
+  for(k = 0; k < numCodes; k++) memset(model->freq[k], 0, sizeof(model->freq[k]));
+  for(c = 0; c < 256; c++)
+  {
+    unsigned long* freq;
+    if(model->total[c] == 0) continue;
+    freq = model->freq[model->map[c]];
+    for(j = model->listStart[c]; j < model->listStart[c+1]; j++)
+    {
+      freq[model->listSymbol[j]] += model->listCount[j];
+    }
+  }
+}
+
+/*
+ * Groups the previous bytes into clusters that share a code, k-means
+ * style: the busiest previous bytes each start a cluster, then every
+ * previous byte moves to the cluster whose counts would code what follows
+ * it in the fewest bits, and the counts are summed up again. Small blocks
+ * get fewer clusters, since every code adds its lengths to the header.
+
+ * struct ContextModel* model - counted with countContexts, gets the map
+ *                              from previous bytes to clusters and the
+ *                              counts of every cluster
+ * unsigned long srcLength - how many bytes were counted
+*/
+void clusterContexts(struct ContextModel* model, unsigned long srcLength)
+{
+  int renumber[ORDER1_MAX_CODES];
+  unsigned long limit = 1 + srcLength / ORDER1_BYTES_PER_CODE;
+  int numCodes = ORDER1_MAX_CODES;
+  int numActive = 0;
+  int pass, k, c, s;
+
+  for(c = 0; c < 256; c++)
+  {
+    if(model->total[c] > 0) numActive++;
+    model->map[c] = ORDER1_MAX_CODES; /* not a seed yet */
+  }
+  if(numCodes > numActive) numCodes = numActive;
+  if((unsigned long)numCodes > limit) numCodes = (int)limit;
+
+  for(k = 0; k < numCodes; k++)
+  {
+    int seed = -1;
+    for(c = 0; c < 256; c++)
+    {
+      if(model->map[c] == ORDER1_MAX_CODES && model->total[c] > 0 &&
+         (seed < 0 || model->total[c] > model->total[seed]))
+      {
+        seed = c;
+      }
+    }
+    model->map[seed] = (unsigned char)k;
+    for(s = 0; s < 256; s++) model->freq[k][s] = model->counts[seed][s];
+  }
+
+  for(pass = 0; pass < ORDER1_PASSES; pass++)
+  {
+    estimateCosts(model, numCodes);
+    for(c = 0; c < 256; c++)
+    {
+      double bestCost = 0;
+      int best = 0;
+      if(model->total[c] == 0) continue;
+
+      for(k = 0; k < numCodes; k++)
+      {
+        const double* cost = model->cost[k];
+        double bits = 0;
+        unsigned int j;
+        for(j = model->listStart[c]; j < model->listStart[c+1]; j++)
+        {
+          bits += model->listCount[j] * cost[model->listSymbol[j]];
+        }
+        if(k == 0 || bits < bestCost)
+        {
+          bestCost = bits;
+          best = k;
+        }
+      }
+      model->map[c] = (unsigned char)best;
+    }
+    sumClusters(model, numCodes);
+  }
+
+  /* Seeds can lose every previous byte to other clusters, those are dropped */
+  model->numCodes = 0;
+  for(k = 0; k < numCodes; k++)
+  {
+    int used = 0;
+    for(s = 0; s < 256; s++) used |= (model->freq[k][s] != 0);
+    renumber[k] = model->numCodes;
+    if(!used) continue;
+    if(model->numCodes != k) memcpy(model->freq[model->numCodes], model->freq[k], sizeof(model->freq[k]));
+    model->numCodes++;
+  }
+  for(c = 0; c < 256; c++)
+  {
+    model->map[c] = (model->total[c] == 0) ? 0 : (unsigned char)renumber[model->map[c]];
+  }
+}
+
+/*
+ * Builds order-1 codes for a buffer in the context's model and writes the
+ * header of a BLOCK_ORDER1 block into the model. Every code is kept within
+ * TABLE_BITS, or the context's length limit if that is shorter.
+
+ * struct HuffContext* context - scratch memory, gets the codes in its model
+ * const unsigned char* src - bytes the codes are for
+ * unsigned long srcLength - how many bytes src holds
+
+ * returns int - 1 if the codes were built
+ *               0 if src is empty or the length limit is out of range
+*/
+int buildOrder1Code(struct HuffContext* context, const unsigned char* src, unsigned long srcLength)
+{
+  struct ContextModel* model = getContextModel(context);
+  struct SymbolNode** codes;
+  struct SymbolNode* root;
+  int maxLength = TABLE_BITS;
+  int k, i;
+  double start;
+
+  if(srcLength == 0) return 0;
+  if(context->maxLength > 0 && context->maxLength < maxLength) maxLength = context->maxLength;
+
+  start = startPhase(context->stats);
+  countContexts(model, src, srcLength);
+  endPhase(context->stats, PHASE_COUNT, start, srcLength);
+
+  start = startPhase(context->stats);
+  clusterContexts(model, srcLength);
+  model->bits = 0;
+  model->extraBits = 0;
+  model->longest = 0;
+  for(k = 0; k < model->numCodes; k++)
+  {
+    const unsigned long* freq = model->freq[k];
+    unsigned char* lengths = model->lengths[k];
+    uint64_t bits = 0;
+    int longest = 0;
+
+    codes = buildCodes(&context->arena, freq, &root);
+    for(i = 0; i < 256; i++)
+    {
+      unsigned int length = (codes[i] == NULL) ? 0 : codes[i]->length;
+      if((int)length > longest) longest = (int)length;
+      lengths[i] = (length > MAX_CODE_LENGTH) ? MAX_CODE_LENGTH : (unsigned char)length;
+      bits += (uint64_t)freq[i] * length;
+    }
+
+    if(longest > maxLength)
+    {
+      uint64_t unlimitedBits = bits;
+      if(!limitCodeLengths(&context->arena, freq, lengths, maxLength)) return 0;
+      bits = 0;
+      for(i = 0; i < 256; i++) bits += (uint64_t)freq[i] * lengths[i];
+      model->extraBits += bits - unlimitedBits;
+      longest = maxLength;
+    }
+
+    if(canonicalCodes(lengths, model->tables[k].code) < 0) return 0;
+    for(i = 0; i < 256; i++) model->tables[k].length[i] = lengths[i];
+    if(longest > model->longest) model->longest = longest;
+    model->bits += bits;
+  }
+
+  model->header[0] = (unsigned char)model->numCodes;
+  model->headerLength = 1 + writeLengths(model->header + 1, model->map);
+  for(k = 0; k < model->numCodes; k++)
+  {
+    model->headerLength += writeLengths(model->header + model->headerLength, model->lengths[k]);
+  }
+  endPhase(context->stats, PHASE_TREE, start, 0);
+  return 1;
+}
+
+/*
+ * Writes the codes of a buffer with the order-1 codes last built in the
+ * context's model, exactly (bits + 7) / 8 bytes of them, the last byte
+ * padded with zeroes.
+
+ * struct HuffContext* context - holds the codes
+ * const unsigned char* src - bytes to encode, those the codes were built for
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where the encoded bits go
+*/
+void writeOrder1Symbols(struct HuffContext* context, const unsigned char* src,
+                        unsigned long srcLength, unsigned char* dest)
+{
+  struct ContextModel* model = context->model;
+  const struct CodeTable* tableOf[256]; /* code to use after each byte */
+  struct BitWriter writer;
+  unsigned char prev = 0;
+  unsigned long i;
+  int c;
+
+  for(c = 0; c < 256; c++) tableOf[c] = &model->tables[model->map[c]];
+
+  initMemoryWriter(&writer, dest, (unsigned long)((model->bits + 7) / 8));
+  for(i = 0; i < srcLength; i++)
+  {
+    const struct CodeTable* table = tableOf[prev];
+    writeBits(&writer, table->code[src[i]], table->length[src[i]]);
+    prev = src[i];
+  }
+  flushBits(&writer);
+}
+
+/*
+ * Decodes the packed bytes of a BLOCK_ORDER1 block. Every code fits in
+ * its table's root, so each symbol is one lookup in the table picked by
+ * the symbol before it, and a refilled bit buffer holds enough bits for
+ * 56 / TABLE_BITS symbols without checking in between.
+
+ * struct HuffContext* context - scratch memory
+ * const unsigned char* packed - order-1 header followed by the encoded bits
+ * unsigned long packedLength - how many bytes packed holds
+ * unsigned char* raw - where the decoded bytes go
+ * unsigned long rawLength - how many bytes the block decodes to
+
+ * returns int - 1 if decoded
+ *               0 if the block is corrupt
+*/
+int decodeOrder1(struct HuffContext* context, const unsigned char* packed,
+                 unsigned long packedLength, unsigned char* raw, unsigned long rawLength)
+{
+  struct ContextModel* model = getContextModel(context);
+  const struct DecodeEntry* entriesOf[256]; /* table to use after each byte */
+  unsigned int shiftOf[256]; /* and how far to shift the bits to index it */
+  unsigned int perRefill = 56 / TABLE_BITS;
+  struct BitReader reader;
+  unsigned long pos = 1, i = 0;
+  unsigned int bad = 0, prev = 0;
+  double start = startPhase(context->stats);
+  long numBytes;
+  int k, c;
+
+  if(packedLength < 1 || packed[0] < 1 || packed[0] > ORDER1_MAX_CODES) return 0;
+  model->numCodes = packed[0];
+  model->longest = 0;
+  numBytes = readLengthsFrom(packed + pos, packedLength - pos, model->map);
+  if(numBytes < 0) return 0;
+  pos += (unsigned long)numBytes;
+  for(c = 0; c < 256; c++)
+  {
+    if(model->map[c] >= model->numCodes) return 0;
+  }
+
+  for(k = 0; k < model->numCodes; k++)
+  {
+    struct DecodeTable* table = &model->decodeTables[k];
+    numBytes = readLengthsFrom(packed + pos, packedLength - pos, model->lengths[k]);
+    if(numBytes < 0) return 0;
+    pos += (unsigned long)numBytes;
+    for(c = 0; c < 256; c++)
+    {
+      if(model->lengths[k][c] > TABLE_BITS) return 0;
+    }
+    if(!fillCanonicalTable(table, model->lengths[k])) return 0;
+    if((int)table->longest > model->longest) model->longest = (int)table->longest;
+  }
+  for(c = 0; c < 256; c++)
+  {
+    struct DecodeTable* table = &model->decodeTables[model->map[c]];
+    entriesOf[c] = table->entries;
+    shiftOf[c] = 64 - table->rootBits;
+  }
+  endPhase(context->stats, PHASE_HEADER_PARSE, start, pos);
+
+  start = startPhase(context->stats);
+  initMemoryReader(&reader, packed + pos, packedLength - pos);
+  while(i < rawLength)
+  {
+    unsigned long left = rawLength - i;
+    unsigned long n = (left < perRefill) ? left : perRefill;
+    uint64_t bitBuf;
+    unsigned int bitCount;
+    unsigned long j;
+
+    refillBits(&reader);
+    bitBuf = reader.bitBuf;
+    bitCount = reader.bitCount;
+    for(j = 0; j < n; j++)
+    {
+      struct DecodeEntry entry = entriesOf[prev][bitBuf >> shiftOf[prev]];
+      bad |= entry.length == 0;
+      bitBuf <<= entry.length;
+      bitCount -= entry.length;
+      prev = entry.value;
+      raw[i + j] = (unsigned char)prev;
+    }
+    reader.bitBuf = bitBuf;
+    reader.bitCount = bitCount;
+    i += n;
+  }
+  endPhase(context->stats, PHASE_DECODE, start, packedLength - pos);
+
+  if(context->stats != NULL)
+  {
+    context->stats->symbols += rawLength;
+    if(model->longest > context->stats->longest) context->stats->longest = model->longest;
+  }
+  return !bad && !readPastEnd(&reader);
+}
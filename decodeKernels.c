@@ -0,0 +1,276 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for decode loops written out for one table
+ * size, one longest code and one number of streams each, picked at run
+ * time from the table a block was decoded with. With these fixed, the
+ * compiler knows how many codes every refill gives, so it unrolls those
+ * loops and works out the shifts up front, and kernels whose codes all
+ * fit in the root table don't check for sub-tables at all. Tables that
+ * aren't covered go through the general loops in blockCodec.c instead.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "huffman.h"
+
+/*
+ * Tops off a stream's bits like refillBits, reading a whole word at once
+ * while there are 8 bytes left of what the reader is reading, and
+ * leaving anything else to refillBits.
+*/
+#define REFILL_KERNEL(reader, bitBuf, bitCount) \
+  if((bitCount) <= 56 && (reader)->pos + 8 <= (reader)->srcLength) \
+  { \
+    const unsigned char* next = (reader)->src + (reader)->pos; \
+    uint64_t word = ((uint64_t)next[0] << 56) | ((uint64_t)next[1] << 48) | \
+                    ((uint64_t)next[2] << 40) | ((uint64_t)next[3] << 32) | \
+                    ((uint64_t)next[4] << 24) | ((uint64_t)next[5] << 16) | \
+                    ((uint64_t)next[6] << 8) | (uint64_t)next[7]; \
+    (bitBuf) |= word >> (bitCount); \
+    (reader)->pos += (63 - (bitCount)) >> 3; \
+    (bitCount) |= 56; \
+  } \
+  else \
+  { \
+    (reader)->bitBuf = (bitBuf); \
+    (reader)->bitCount = (bitCount); \
+    refillBits(reader); \
+    (bitBuf) = (reader)->bitBuf; \
+    (bitCount) = (reader)->bitCount; \
+  }
+
+/*
+ * Defines a kernel for tables of ROOT_BITS root bits and codes of at
+ * most MAX_BITS, read from NUM_STREAMS streams. Symbols are dealt out to
+ * the streams in turn as in decodeStreams, one stream being what
+ * decodeSymbols reads. A refill leaves at least 56 bits, so each stream
+ * gives 56 / MAX_BITS codes per visit without looking at how many bits
+ * are left. Codes that aren't in the table have a length of 0 and are
+ * only checked for once at the end.
+*/
+#define DEFINE_DECODE_KERNEL(name, ROOT_BITS, MAX_BITS, NUM_STREAMS) \
+int name(const struct DecodeEntry* entries, struct BitReader* readers, \
+         unsigned char* dest, unsigned long count) \
+{ \
+  unsigned long round = (unsigned long)(56 / (MAX_BITS)) * (NUM_STREAMS); \
+  unsigned long i = 0; \
+  unsigned int bad = 0; \
+  int k; \
+  \
+  for(; i + round <= count; i += round) \
+  { \
+    for(k = 0; k < (NUM_STREAMS); k++) \
+    { \
+      struct BitReader* reader = &readers[k]; \
+      unsigned char* out = dest + i + k; \
+      uint64_t bitBuf = reader->bitBuf; \
+      unsigned int bitCount = reader->bitCount; \
+      int j; \
+      \
+      REFILL_KERNEL(reader, bitBuf, bitCount) \
+      for(j = 0; j < 56 / (MAX_BITS); j++) \
+      { \
+        unsigned int bits = (ROOT_BITS); \
+        struct DecodeEntry entry = entries[bitBuf >> (64 - (ROOT_BITS))]; \
+        \
+        /* Only kernels for codes longer than the root have sub-tables */ \
+        while((MAX_BITS) > (ROOT_BITS) && entry.subBits != 0) \
+        { \
+          bitBuf <<= bits; \
+          bitCount -= bits; \
+          bits = entry.subBits; \
+          entry = entries[entry.value + (unsigned int)(bitBuf >> (64 - bits))]; \
+        } \
+        bad |= entry.length == 0; \
+        bitBuf <<= entry.length; \
+        bitCount -= entry.length; \
+        out[j * (NUM_STREAMS)] = (unsigned char)entry.value; \
+      } \
+      reader->bitBuf = bitBuf; \
+      reader->bitCount = bitCount; \
+    } \
+  } \
+  \
+  for(; i < count; i++) \
+  { \
+    struct BitReader* reader = &readers[i % (NUM_STREAMS)]; \
+    unsigned int bits = (ROOT_BITS); \
+    unsigned int base = 0; \
+    struct DecodeEntry entry; \
+    \
+    while(1) \
+    { \
+      if(reader->bitCount < bits) refillBits(reader); \
+      entry = entries[base + (unsigned int)(reader->bitBuf >> (64 - bits))]; \
+      if((MAX_BITS) == (ROOT_BITS) || entry.subBits == 0) break; \
+      \
+      reader->bitBuf <<= bits; \
+      reader->bitCount -= bits; \
+      base = entry.value; \
+      bits = entry.subBits; \
+    } \
+    bad |= entry.length == 0; \
+    reader->bitBuf <<= entry.length; \
+    reader->bitCount -= entry.length; \
+    dest[i] = (unsigned char)entry.value; \
+  } \
+  \
+  for(k = 0; k < (NUM_STREAMS); k++) bad |= readPastEnd(&readers[k]); \
+  return !bad; \
+}
+
+DEFINE_DECODE_KERNEL(decode6x1, 6, 6, 1)
+DEFINE_DECODE_KERNEL(decode6x2, 6, 6, 2)
+DEFINE_DECODE_KERNEL(decode6x4, 6, 6, 4)
+DEFINE_DECODE_KERNEL(decode7x1, 7, 7, 1)
+DEFINE_DECODE_KERNEL(decode7x2, 7, 7, 2)
+DEFINE_DECODE_KERNEL(decode7x4, 7, 7, 4)
+DEFINE_DECODE_KERNEL(decode8x1, 8, 8, 1)
+DEFINE_DECODE_KERNEL(decode8x2, 8, 8, 2)
+DEFINE_DECODE_KERNEL(decode8x4, 8, 8, 4)
+DEFINE_DECODE_KERNEL(decode9x1, 9, 9, 1)
+DEFINE_DECODE_KERNEL(decode9x2, 9, 9, 2)
+DEFINE_DECODE_KERNEL(decode9x4, 9, 9, 4)
+DEFINE_DECODE_KERNEL(decode10x1, 10, 10, 1)
+DEFINE_DECODE_KERNEL(decode10x2, 10, 10, 2)
+DEFINE_DECODE_KERNEL(decode10x4, 10, 10, 4)
+DEFINE_DECODE_KERNEL(decode11x1, 11, 11, 1)
+DEFINE_DECODE_KERNEL(decode11x2, 11, 11, 2)
+DEFINE_DECODE_KERNEL(decode11x4, 11, 11, 4)
+DEFINE_DECODE_KERNEL(decode14x1, 11, 14, 1)
+DEFINE_DECODE_KERNEL(decode14x2, 11, 14, 2)
+DEFINE_DECODE_KERNEL(decode14x4, 11, 14, 4)
+DEFINE_DECODE_KERNEL(decode18x1, 11, 18, 1)
+DEFINE_DECODE_KERNEL(decode18x2, 11, 18, 2)
+DEFINE_DECODE_KERNEL(decode18x4, 11, 18, 4)
+DEFINE_DECODE_KERNEL(decode28x1, 11, 28, 1)
+DEFINE_DECODE_KERNEL(decode28x2, 11, 28, 2)
+DEFINE_DECODE_KERNEL(decode28x4, 11, 28, 4)
+
+/*
+ * Kernels by the longest code they take, then by 1, 2 or 4 streams. The
+ * first rows are for tables of KERNEL_MIN_BITS to TABLE_BITS bits
+ * holding every code, the rest for TABLE_BITS roots with sub-tables.
+*/
+const DecodeKernel decodeKernels[TABLE_BITS - KERNEL_MIN_BITS + 4][3] =
+{
+  {decode6x1, decode6x2, decode6x4},
+  {decode7x1, decode7x2, decode7x4},
+  {decode8x1, decode8x2, decode8x4},
+  {decode9x1, decode9x2, decode9x4},
+  {decode10x1, decode10x2, decode10x4},
+  {decode11x1, decode11x2, decode11x4},
+  {decode14x1, decode14x2, decode14x4},
+  {decode18x1, decode18x2, decode18x4},
+  {decode28x1, decode28x2, decode28x4}
+};
+
+/*
+ * Picks the kernel written out for a table and number of streams. Tables
+ * of KERNEL_MIN_BITS to TABLE_BITS bits with every code in the root, or
+ * with a root of TABLE_BITS and codes of at most 28 bits, have one when
+ * there are 1, 2 or 4 streams. Building with -DNO_DECODE_KERNELS turns
+ * them all off, to measure what they gain.
+
+ * const struct DecodeTable* table - table the codes will be decoded with
+ * int numStreams - how many streams the codes are dealt out to
+
+ * returns DecodeKernel - the kernel, NULL if the general loop has to do
+*/
+DecodeKernel findDecodeKernel(const struct DecodeTable* table, int numStreams)
+{
+#ifdef NO_DECODE_KERNELS
+  return NULL;
+#else
+  int column = (numStreams == 4) ? 2 : numStreams - 1;
+  int row;
+
+  if(numStreams < 1 || numStreams == 3 || numStreams > 4) return NULL;
+  if(table->rootBits < KERNEL_MIN_BITS || table->rootBits > TABLE_BITS) return NULL;
+
+  if(table->longest <= table->rootBits) row = table->rootBits - KERNEL_MIN_BITS;
+  else if(table->rootBits != TABLE_BITS || table->longest > 28) return NULL;
+  else if(table->longest <= 14) row = TABLE_BITS - KERNEL_MIN_BITS + 1;
+  else if(table->longest <= 18) row = TABLE_BITS - KERNEL_MIN_BITS + 2;
+  else row = TABLE_BITS - KERNEL_MIN_BITS + 3;
+
+  return decodeKernels[row][column];
+#endif
+}
+
+/*
+ * Decodes codes with a table's multi-symbol entries. Each lookup on the
+ * next MULTI_BITS bits stores all MULTI_MAX_SYMBOLS symbols of its entry
+ * and moves on by however many of them were whole, so while there is
+ * room for all of them the stores need no checks. Codes longer than a
+ * window, and the last few symbols, are decoded one at a time through
+ * the plain entries and sub-tables.
+
+ * const struct DecodeTable* table - table with its multi-symbol entries in use
+ * struct BitReader* reader - where the encoded bits come from
+ * unsigned char* dest - where decoded symbols go
+ * unsigned long count - how many symbols to decode
+
+ * returns int - 1 if all symbols were decoded
+ *               0 if the bits are corrupt or run out
+*/
+int decodeMultiSymbols(const struct DecodeTable* table, struct BitReader* reader,
+                       unsigned char* dest, unsigned long count)
+{
+  const struct MultiEntry* multi = table->multi;
+  const struct DecodeEntry* entries = table->entries;
+  uint64_t bitBuf = reader->bitBuf;
+  unsigned int bitCount = reader->bitCount;
+  unsigned long i = 0;
+  int k;
+
+  while(i < count)
+  {
+    struct DecodeEntry entry;
+    unsigned int bits = table->rootBits;
+    unsigned int base = 0;
+
+    if(bitCount < MULTI_BITS)
+    {
+      REFILL_KERNEL(reader, bitBuf, bitCount)
+    }
+
+    if(i + MULTI_MAX_SYMBOLS <= count)
+    {
+      const struct MultiEntry* window = &multi[bitBuf >> (64 - MULTI_BITS)];
+      if(window->count > 0)
+      {
+        for(k = 0; k < MULTI_MAX_SYMBOLS; k++) dest[i + k] = window->symbols[k];
+        i += window->count;
+        bitBuf <<= window->length;
+        bitCount -= window->length;
+        continue;
+      }
+    }
+
+    /* One code at a time, through sub-tables if it is long */
+    while(1)
+    {
+      if(bitCount < bits)
+      {
+        REFILL_KERNEL(reader, bitBuf, bitCount)
+      }
+
+      entry = entries[base + (unsigned int)(bitBuf >> (64 - bits))];
+      if(entry.subBits == 0) break;
+
+      bitBuf <<= bits;
+      bitCount -= bits;
+      base = entry.value;
+      bits = entry.subBits;
+    }
+    if(entry.length == 0) break;
+    bitBuf <<= entry.length;
+    bitCount -= entry.length;
+    dest[i++] = (unsigned char)entry.value;
+  }
+
+  reader->bitBuf = bitBuf;
+  reader->bitCount = bitCount;
+  return i == count && !readPastEnd(reader);
+}
@@ -0,0 +1,357 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for turning a huffman tree into a lookup
+ * table, so that the decoder can decode a whole code with a table
+ * lookup on the next few bits instead of following one pointer in
+ * the tree for every bit. Tables can be built from a tree or, for
+ * canonical codes, from the code lengths alone. Codes that don't fit 
+ * in the first table are finished in sub-tables, so codes of any length 
+ * are supported.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "huffman.h"
+
+/* Function Declarations */
+unsigned int treeDepth(struct SymbolNode* root);
+unsigned int allocEntries(struct DecodeTable* table, unsigned int count);
+void fillEntries(struct DecodeTable* table, unsigned int base, unsigned int bits,
+                 struct SymbolNode* node, unsigned int prefix, unsigned int depth);
+void fillCanonical(struct DecodeTable* table, unsigned int base, unsigned int bits,
+                   const unsigned char* order, int count, const uint64_t* codes,
+                   const unsigned char* lengths, unsigned int consumed);
+
+/*
+ * Given a root of a tree, returns how deep the deepest leaf is.
+ * A lone leaf has a depth of 0.
+
+ * struct SymbolNode* root - root of partial (or full) Huffman Tree
+
+ * returns unsigned int - length of the longest code in the tree
+*/
+unsigned int treeDepth(struct SymbolNode* root)
+{
+  unsigned int leftDepth, rightDepth;
+  if(root == NULL || isLeaf(root)) return 0;
+
+  leftDepth = treeDepth(root->left);
+  rightDepth = treeDepth(root->right);
+  return 1 + (leftDepth > rightDepth ? leftDepth : rightDepth);
+}
+
+/*
+ * Reserves room for count more entries at the end of the table,
+ * growing the entry array if needed. Since the array may move, callers
+ * hold on to entry indices rather than pointers.
+
+ * struct DecodeTable* table - table to grow
+ * unsigned int count - number of entries to reserve
+
+ * returns unsigned int - index of the first reserved entry
+*/
+unsigned int allocEntries(struct DecodeTable* table, unsigned int count)
+{
+  unsigned int first = table->size;
+  unsigned int i;
+
+  if(table->size + count > table->capacity)
+  {
+    while(table->size + count > table->capacity) table->capacity *= 2;
+    table->entries = (struct DecodeEntry*)realloc(table->entries,
+                       sizeof(struct DecodeEntry) * table->capacity);
+  }
+
+  /* unused entries mean a code that isn't in the tree */
+  for(i = first; i < first + count; i++)
+  {
+    table->entries[i].value = 0;
+    table->entries[i].length = 0;
+    table->entries[i].subBits = 0;
+  }
+  table->size += count;
+  return first;
+}
+
+/*
+ * Fills in the entries of a (sub-)table for the given subtree. A leaf
+ * reached within the table's bits fills every entry starting with its code,
+ * a node reached at exactly the table's bits gets its own sub-table.
+
+ * struct DecodeTable* table - table being built
+ * unsigned int base - index of the first entry of the (sub-)table
+ * unsigned int bits - how many bits index the (sub-)table
+ * struct SymbolNode* node - current node in the tree
+ * unsigned int prefix - code bits followed from the table's root to node
+ * unsigned int depth - how many bits are in prefix, pass in 0 to start
+*/
+void fillEntries(struct DecodeTable* table, unsigned int base, unsigned int bits,
+                 struct SymbolNode* node, unsigned int prefix, unsigned int depth)
+{
+  if(node == NULL) return;
+  else if(isLeaf(node))
+  {
+    unsigned int first = prefix << (bits - depth);
+    unsigned int span = 1 << (bits - depth);
+    unsigned int i;
+    for(i = first; i < first + span; i++)
+    {
+      table->entries[base + i].value = node->symbol;
+      table->entries[base + i].length = depth;
+      table->entries[base + i].subBits = 0;
+    }
+  }
+  else if(depth == bits)
+  {
+    unsigned int subBits = treeDepth(node);
+    unsigned int sub;
+    if(subBits > TABLE_BITS) subBits = TABLE_BITS;
+
+    sub = allocEntries(table, 1 << subBits);
+    fillEntries(table, sub, subBits, node, 0, 0);
+    table->entries[base + prefix].value = sub;
+    table->entries[base + prefix].length = 0;
+    table->entries[base + prefix].subBits = subBits;
+  }
+  else
+  {
+    fillEntries(table, base, bits, node->left, prefix << 1, depth+1);
+    fillEntries(table, base, bits, node->right, (prefix << 1) | 1, depth+1);
+  }
+}
+
+/*
+ * Builds the lookup table used for decoding from a completed huffman tree.
+ * Codes no longer than the root table's bits are decoded with one lookup,
+ * longer codes continue through sub-tables TABLE_BITS at a time.
+
+ * struct SymbolNode* root - root of the huffman tree
+
+ * returns DecodeTable* - newly allocated table, free with freeDecodeTable
+*/
+struct DecodeTable* buildDecodeTable(struct SymbolNode* root)
+{
+  struct DecodeTable* table = (struct DecodeTable*)malloc(sizeof(struct DecodeTable));
+  unsigned int rootBits = treeDepth(root);
+
+  table->longest = rootBits;
+  if(rootBits > TABLE_BITS) rootBits = TABLE_BITS;
+  table->rootBits = rootBits;
+  table->size = 0;
+  table->capacity = 1 << TABLE_BITS;
+  table->entries = (struct DecodeEntry*)malloc(sizeof(struct DecodeEntry) * table->capacity);
+  table->multi = NULL;
+  table->useMulti = 0;
+
+  allocEntries(table, 1 << rootBits);
+  fillEntries(table, 0, rootBits, root, 0, 0);
+  return table;
+}
+
+/*
+ * Fills in the entries of a (sub-)table for a run of canonical codes. 
+ * Canonical codes sorted by length and value are also sorted as bit strings,
+ * so codes sharing the bits that index a sub-table are next to each other.
+
+ * struct DecodeTable* table - table being built
+ * unsigned int base - index of the first entry of the (sub-)table
+ * unsigned int bits - how many bits index the (sub-)table
+ * const unsigned char* order - symbols to place, in canonical order
+ * int count - how many symbols are in order
+ * const uint64_t* codes - canonical code of each symbol
+ * const unsigned char* lengths - code length of each symbol
+ * unsigned int consumed - code bits used up by the tables above this one
+*/
+void fillCanonical(struct DecodeTable* table, unsigned int base, unsigned int bits,
+                   const unsigned char* order, int count, const uint64_t* codes,
+                   const unsigned char* lengths, unsigned int consumed)
+{
+  uint64_t mask = ((uint64_t)1 << bits) - 1;
+  int i = 0;
+
+  while(i < count)
+  {
+    unsigned char symbol = order[i];
+    unsigned int remaining = lengths[symbol] - consumed; /* bits left of code */
+
+    if(remaining <= bits)
+    {
+      /* Code ends in this table, fill every entry it is a prefix of */
+      unsigned int first = (unsigned int)(codes[symbol] & (((uint64_t)1 << remaining) - 1))
+                           << (bits - remaining);
+      unsigned int span = 1 << (bits - remaining);
+      unsigned int j;
+      for(j = first; j < first + span; j++)
+      {
+        table->entries[base + j].value = symbol;
+        table->entries[base + j].length = remaining;
+        table->entries[base + j].subBits = 0;
+      }
+      i++;
+    }
+    else
+    {
+      /* Gathering every code that goes through the same sub-table */
+      unsigned int key = (unsigned int)((codes[symbol] >> (remaining - bits)) & mask);
+      unsigned int longest = remaining;
+      unsigned int subBits, sub;
+      int end = i + 1;
+
+      while(end < count)
+      {
+        unsigned char next = order[end];
+        unsigned int nextRemaining = lengths[next] - consumed;
+        if(nextRemaining <= bits) break;
+        if(((codes[next] >> (nextRemaining - bits)) & mask) != key) break;
+        if(nextRemaining > longest) longest = nextRemaining;
+        end++;
+      }
+
+      subBits = longest - bits;
+      if(subBits > TABLE_BITS) subBits = TABLE_BITS;
+      sub = allocEntries(table, 1 << subBits);
+      fillCanonical(table, sub, subBits, order + i, end - i, codes, lengths, consumed + bits);
+      table->entries[base + key].value = sub;
+      table->entries[base + key].length = 0;
+      table->entries[base + key].subBits = subBits;
+      i = end;
+    }
+  }
+}
+
+/*
+ * Fills in a lookup table for decoding straight from the code lengths 
+ * of a canonical code, without making a tree. The table's entries are
+ * reused and only grow, so a table filled over and over stops allocating
+ * once it is as large as the codes need.
+
+ * struct DecodeTable* table - table to fill in, its old entries are lost
+ * const unsigned char* lengths - code length of each of the 256 symbols
+
+ * returns int - 1 if the table was filled in
+ *               0 if the lengths don't make a valid code
+*/
+int fillCanonicalTable(struct DecodeTable* table, const unsigned char* lengths)
+{
+  uint64_t codes[256];
+  unsigned char order[256]; /* symbols sorted by length, then value */
+  unsigned int rootBits = 1;
+  int numSymbols = canonicalCodes(lengths, codes);
+  int len, i, count = 0;
+
+  if(numSymbols < 0) return 0;
+
+  for(len = 1; len <= MAX_CODE_LENGTH; len++)
+  {
+    for(i = 0; i < 256; i++)
+    {
+      if(lengths[i] == len) order[count++] = (unsigned char)i;
+    }
+  }
+  if(count > 0 && lengths[order[count-1]] > rootBits) rootBits = lengths[order[count-1]];
+  table->longest = rootBits;
+  if(rootBits > TABLE_BITS) rootBits = TABLE_BITS;
+
+  table->rootBits = rootBits;
+  table->size = 0;
+  table->useMulti = 0;
+  allocEntries(table, 1 << rootBits);
+  fillCanonical(table, 0, rootBits, order, count, codes, lengths, 0);
+  return 1;
+}
+
+/*
+ * Builds the lookup table used for decoding straight from the code lengths 
+ * of a canonical code, without making a tree.
+
+ * const unsigned char* lengths - code length of each of the 256 symbols
+
+ * returns DecodeTable* - newly allocated table, free with freeDecodeTable
+ *                        NULL if the lengths don't make a valid code
+*/
+struct DecodeTable* buildCanonicalTable(const unsigned char* lengths)
+{
+  struct DecodeTable* table = (struct DecodeTable*)malloc(sizeof(struct DecodeTable));
+  table->capacity = 1 << TABLE_BITS;
+  table->entries = (struct DecodeEntry*)malloc(sizeof(struct DecodeEntry) * table->capacity);
+  table->multi = NULL;
+  table->useMulti = 0;
+
+  if(!fillCanonicalTable(table, lengths))
+  {
+    freeDecodeTable(table);
+    return NULL;
+  }
+  return table;
+}
+
+/*
+ * Frees a table created by buildDecodeTable
+
+ * struct DecodeTable* table - table to free
+*/
+void freeDecodeTable(struct DecodeTable* table)
+{
+  if(table == NULL) return;
+  free(table->entries);
+  free(table->multi);
+  free(table);
+}
+
+/*
+ * Fills in the multi-symbol entries of a table when its codes are short
+ * enough on average for a lookup to give several symbols. The average
+ * comes from the root table, where a code of length n fills 1/2^n of the
+ * entries, the same share of the input the code stands for if the code
+ * is as good as the lengths say. Codes that go on into sub-tables are
+ * counted as longer than a window. Each window of MULTI_BITS bits then
+ * gets every whole code at its start, looked up in the root table with
+ * the bits past the window as zeroes, stopping at the first code that
+ * doesn't end inside the window.
+
+ * struct DecodeTable* table - table whose entries were just filled in
+
+ * returns int - 1 if the table now uses its multi-symbol entries
+ *               0 if the codes are too long, it uses the plain entries
+*/
+int fillMultiTable(struct DecodeTable* table)
+{
+  unsigned int rootSize = 1u << table->rootBits;
+  unsigned long totalBits = 0;
+  unsigned int window, i;
+
+  table->useMulti = 0;
+  if(table->rootBits == 0 || table->rootBits > MULTI_BITS) return 0;
+
+  for(i = 0; i < rootSize; i++)
+  {
+    struct DecodeEntry entry = table->entries[i];
+    totalBits += (entry.subBits != 0 || entry.length == 0) ? MULTI_BITS + 1 : entry.length;
+  }
+  if(totalBits > (unsigned long)MULTI_MAX_AVERAGE * rootSize) return 0;
+
+  if(table->multi == NULL)
+  {
+    table->multi = (struct MultiEntry*)malloc(sizeof(struct MultiEntry) << MULTI_BITS);
+  }
+  for(window = 0; window < (1u << MULTI_BITS); window++)
+  {
+    struct MultiEntry* multi = &table->multi[window];
+    unsigned int used = 0;
+
+    multi->count = 0;
+    while(multi->count < MULTI_MAX_SYMBOLS)
+    {
+      unsigned int rest = (window << used) & ((1u << MULTI_BITS) - 1);
+      struct DecodeEntry entry = table->entries[rest >> (MULTI_BITS - table->rootBits)];
+      if(entry.subBits != 0 || entry.length == 0 || used + entry.length > MULTI_BITS) break;
+      multi->symbols[multi->count++] = (unsigned char)entry.value;
+      used += entry.length;
+    }
+    multi->length = (unsigned char)used;
+    for(i = multi->count; i < MULTI_MAX_SYMBOLS; i++) multi->symbols[i] = 0;
+  }
+
+  table->useMulti = 1;
+  return 1;
+}
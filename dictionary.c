@@ -0,0 +1,388 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for dictionaries, codes trained ahead of time
+ * on files like the ones that will be encoded. A small message encoded
+ * with a dictionary needs no counting pass and no code in its header,
+ * only the dictionary's ID, which is where most of the size of a small
+ * file goes otherwise. Bytes the training never saw get no code of their
+ * own, they are written as an escape code followed by the byte itself.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "huffman.h"
+
+/* Function Declarations */
+int setupDictionary(struct Dictionary* dict);
+uint32_t dictionaryID(const struct Dictionary* dict);
+unsigned long countFreqTable(FILE* in, unsigned long* freq);
+
+/*
+ * Builds a dictionary from the byte counts of a training corpus. If some
+ * byte never appears, it is made the escape: its code gets a share of
+ * the counts so it stays reasonably short, and stands for every byte
+ * without a code of its own.
+
+ * struct Dictionary* dict - dictionary to fill in
+ * const unsigned long* freq - how often each byte appears in the corpus
+ * int maxLength - longest code allowed, 0 for DICT_MAX_LENGTH
+
+ * returns int - 1 if the dictionary was built
+ *               0 if maxLength is out of range
+*/
+int trainDictionary(struct Dictionary* dict, const unsigned long* freq, int maxLength)
+{
+  struct CodeArena arena;
+  struct SymbolNode** codes;
+  struct SymbolNode* root;
+  unsigned long counts[256];
+  unsigned long total = 0;
+  int longest = 0;
+  int i;
+
+  if(maxLength == 0 || maxLength > DICT_MAX_LENGTH) maxLength = DICT_MAX_LENGTH;
+
+  dict->escape = DICT_NO_ESCAPE;
+  for(i = 0; i < 256; i++)
+  {
+    counts[i] = freq[i];
+    total += freq[i];
+    if(freq[i] == 0 && dict->escape == DICT_NO_ESCAPE) dict->escape = i;
+  }
+  if(dict->escape != DICT_NO_ESCAPE) counts[dict->escape] = 1 + total / DICT_ESCAPE_SHARE;
+
+  codes = buildCodes(&arena, counts, &root);
+  for(i = 0; i < 256; i++)
+  {
+    unsigned int length = (codes[i] == NULL) ? 0 : codes[i]->length;
+    if((int)length > longest) longest = (int)length;
+    dict->lengths[i] = (length > MAX_CODE_LENGTH) ? MAX_CODE_LENGTH : (unsigned char)length;
+  }
+  if(longest > maxLength && !limitCodeLengths(&arena, counts, dict->lengths, maxLength)) return 0;
+
+  return setupDictionary(dict);
+}
+
+/*
+ * Works out the codes of a dictionary from its code lengths and escape,
+ * and its ID. The table holds a code for every byte: bytes without a code
+ * of their own get the escape code with the byte appended, which fits in
+ * one write since codes are at most DICT_MAX_LENGTH bits.
+
+ * struct Dictionary* dict - dictionary with lengths and escape filled in
+
+ * returns int - 1 if the lengths make a code
+ *               0 if they don't, or a code is too long
+*/
+int setupDictionary(struct Dictionary* dict)
+{
+  uint64_t escapeCode = 0;
+  unsigned int escapeLength = 0;
+  int i;
+
+  if(canonicalCodes(dict->lengths, dict->table.code) < 0) return 0;
+  if(dict->escape != DICT_NO_ESCAPE)
+  {
+    escapeCode = dict->table.code[dict->escape];
+    escapeLength = dict->lengths[dict->escape];
+    if(escapeLength == 0) return 0;
+  }
+
+  for(i = 0; i < 256; i++)
+  {
+    if(dict->lengths[i] > DICT_MAX_LENGTH) return 0;
+    if(dict->lengths[i] > 0 && i != dict->escape)
+    {
+      dict->table.length[i] = dict->lengths[i];
+      continue;
+    }
+
+    /* a byte that can't be written at all fails encodeDictionary */
+    if(escapeLength == 0) dict->table.length[i] = 0;
+    else
+    {
+      dict->table.code[i] = (escapeCode << 8) | (uint64_t)i;
+      dict->table.length[i] = (unsigned char)(escapeLength + 8);
+    }
+  }
+
+  dict->id = dictionaryID(dict);
+  return 1;
+}
+
+/*
+ * Works out a dictionary's ID, a 32 bit FNV-1a hash of its escape and
+ * code lengths, so files are never decoded with a different dictionary
+ * than they were encoded with
+
+ * const struct Dictionary* dict - dictionary to hash
+
+ * returns uint32_t - the ID
+*/
+uint32_t dictionaryID(const struct Dictionary* dict)
+{
+  uint32_t hash = 2166136261UL;
+  int i;
+
+  hash = (hash ^ (uint32_t)(dict->escape & 0xFF)) * 16777619UL;
+  hash = (hash ^ (uint32_t)(dict->escape >> 8)) * 16777619UL;
+  for(i = 0; i < 256; i++) hash = (hash ^ dict->lengths[i]) * 16777619UL;
+  return hash & 0xFFFFFFFFUL;
+}
+
+/*
+ * Adds the byte counts of one training file. A table of codes printed by
+ * huffencode -p, like those in inputs/codes, adds the counts it lists
+ * instead of its own bytes.
+
+ * FILE* in - training file
+ * unsigned long* freq - array of 256 counts to add to
+
+ * returns unsigned long - how many bytes the counts added up to
+*/
+unsigned long countTrainingFile(FILE* in, unsigned long* freq)
+{
+  unsigned char buffer[INPUT_CHUNK_BYTES];
+  unsigned long total = 0, numBytes;
+  const char* title = "Symbol\tFreq\tCode\n";
+
+  numBytes = (unsigned long)fread(buffer, 1, strlen(title), in);
+  if(numBytes == strlen(title) && memcmp(buffer, title, numBytes) == 0)
+  {
+    return countFreqTable(in, freq);
+  }
+
+  while(numBytes > 0)
+  {
+    countBytes(buffer, numBytes, freq);
+    total += numBytes;
+    numBytes = (unsigned long)fread(buffer, 1, sizeof(buffer), in);
+  }
+  return total;
+}
+
+/*
+ * Adds the counts of a table printed by huffencode -p, after its title.
+ * Each line is the symbol, itself or "=" and its value if it doesn't
+ * print, then a tab and its count. Other lines, like the total, are skipped.
+
+ * FILE* in - table to read, past the title
+ * unsigned long* freq - array of 256 counts to add to
+
+ * returns unsigned long - how many bytes the counts added up to
+*/
+unsigned long countFreqTable(FILE* in, unsigned long* freq)
+{
+  char line[256];
+  unsigned long total = 0;
+
+  while(fgets(line, sizeof(line), in) != NULL)
+  {
+    char* count = strchr(line, '\t');
+    char* end;
+    unsigned long symbol, value;
+
+    if(count == NULL || count == line) continue;
+    if(count == line + 1) symbol = (unsigned char)line[0];
+    else if(line[0] == '=')
+    {
+      symbol = strtoul(line + 1, &end, 10);
+      if(end != count || symbol > 255) continue;
+    }
+    else continue;
+
+    value = strtoul(count + 1, &end, 10);
+    if(end == count + 1) continue;
+    freq[symbol] += value;
+    total += value;
+  }
+  return total;
+}
+
+/*
+ * Writes a dictionary file: DICT_MAGIC, the ID (4 bytes), the escape
+ * (2 bytes) and the code lengths as writeLengths writes them
+
+ * const struct Dictionary* dict - dictionary to write
+ * FILE* out - file to write it to
+
+ * returns int - 1 if written
+ *               0 if the file couldn't be written
+*/
+int saveDictionary(const struct Dictionary* dict, FILE* out)
+{
+  unsigned char header[10 + MAX_LENGTHS_BYTES];
+  unsigned long length = 10;
+  int i;
+
+  memcpy(header, DICT_MAGIC, 4);
+  for(i = 0; i < 4; i++) header[4 + i] = (unsigned char)((dict->id >> (8*i)) & 0xFF);
+  header[8] = (unsigned char)(dict->escape & 0xFF);
+  header[9] = (unsigned char)(dict->escape >> 8);
+  length += writeLengths(header + 10, dict->lengths);
+  return fwrite(header, 1, length, out) == length;
+}
+
+/*
+ * Reads a dictionary file written by saveDictionary
+
+ * struct Dictionary* dict - dictionary to fill in
+ * FILE* in - dictionary file
+
+ * returns int - 1 if read
+ *               0 if it isn't a dictionary or is corrupt
+*/
+int loadDictionary(struct Dictionary* dict, FILE* in)
+{
+  unsigned char header[10 + MAX_LENGTHS_BYTES];
+  unsigned long length = (unsigned long)fread(header, 1, sizeof(header), in);
+  uint32_t id = 0;
+  int i;
+
+  if(length < 10 || memcmp(header, DICT_MAGIC, 4) != 0) return 0;
+  for(i = 0; i < 4; i++) id |= (uint32_t)header[4 + i] << (8*i);
+  dict->escape = header[8] | (header[9] << 8);
+  if(dict->escape > DICT_NO_ESCAPE) return 0;
+  if(readLengthsFrom(header + 10, length - 10, dict->lengths) < 0) return 0;
+
+  return setupDictionary(dict) && dict->id == id;
+}
+
+/*
+ * Writes the codes of a buffer with a dictionary. Bytes without a code
+ * of their own go out as the escape code and the byte.
+
+ * const struct Dictionary* dict - dictionary to encode with
+ * const unsigned char* src - bytes to encode
+ * unsigned long srcLength - how many bytes src holds
+ * struct BitWriter* writer - where the bits go, not flushed
+
+ * returns uint64_t - how many bits were written
+ *                    (uint64_t)-1 if a byte has no code and there is no escape
+*/
+uint64_t encodeDictionary(const struct Dictionary* dict, const unsigned char* src,
+                          unsigned long srcLength, struct BitWriter* writer)
+{
+  const struct CodeTable* table = &dict->table;
+  uint64_t bits = 0;
+  unsigned long i;
+
+  for(i = 0; i < srcLength; i++)
+  {
+    unsigned int length = table->length[src[i]];
+    if(length == 0) return (uint64_t)-1;
+    writeBits(writer, table->code[src[i]], length);
+    bits += length;
+  }
+  return bits;
+}
+
+/*
+ * Decodes bits written with a dictionary. May be called again with the
+ * same reader to carry on where the last call stopped. Without an escape
+ * this is decodeSymbols, otherwise every escape code is followed by the
+ * 8 bits of a byte.
+
+ * const struct Dictionary* dict - dictionary the bits were written with
+ * struct DecodeTable* table - lookup table made from the dictionary's lengths
+ * struct BitReader* reader - where the encoded bits come from
+ * unsigned char* dest - where decoded bytes go
+ * unsigned long count - how many bytes to decode
+
+ * returns int - 1 if all bytes were decoded
+ *               0 if the bits are corrupt or run out
+*/
+int decodeDictionary(const struct Dictionary* dict, struct DecodeTable* table,
+                     struct BitReader* reader, unsigned char* dest, unsigned long count)
+{
+  struct DecodeEntry* entries = table->entries;
+  unsigned int escape = (unsigned int)dict->escape;
+  unsigned long i;
+
+  if(dict->escape == DICT_NO_ESCAPE) return decodeSymbols(table, reader, dest, count);
+
+  for(i = 0; i < count; i++)
+  {
+    struct DecodeEntry entry;
+    unsigned int bits = table->rootBits;
+    unsigned int base = 0;
+
+    while(1)
+    {
+      if(reader->bitCount < bits) refillBits(reader);
+
+      entry = entries[base + (unsigned int)(reader->bitBuf >> (64 - bits))];
+      if(entry.subBits == 0) break;
+
+      reader->bitBuf <<= bits;
+      reader->bitCount -= bits;
+      base = entry.value;
+      bits = entry.subBits;
+    }
+
+    if(entry.length == 0) return 0;
+    reader->bitBuf <<= entry.length;
+    reader->bitCount -= entry.length;
+    if(entry.value != escape)
+    {
+      dest[i] = (unsigned char)entry.value;
+      continue;
+    }
+
+    /* the byte itself follows the escape */
+    if(reader->bitCount < 8) refillBits(reader);
+    dest[i] = (unsigned char)(reader->bitBuf >> 56);
+    reader->bitBuf <<= 8;
+    reader->bitCount -= 8;
+  }
+
+  return !readPastEnd(reader);
+}
+
+/*
+ * Writes a number 7 bits a byte, lowest bits first, with the top bit set
+ * on every byte but the last, so small numbers take a single byte
+
+ * FILE* out - file to write to
+ * uint64_t value - number to write
+
+ * returns unsigned long - how many bytes were written
+*/
+unsigned long writeVarint(FILE* out, uint64_t value)
+{
+  unsigned long used = 1;
+  while(value >= 0x80)
+  {
+    fputc((int)((value & 0x7F) | 0x80), out);
+    value >>= 7;
+    used++;
+  }
+  fputc((int)value, out);
+  return used;
+}
+
+/*
+ * Reads a number written by writeVarint
+
+ * FILE* in - file to read from
+ * uint64_t* value - set to the number
+
+ * returns int - 1 if read
+ *               0 if the file ends first or the number is too long
+*/
+int readVarint(FILE* in, uint64_t* value)
+{
+  unsigned int shift = 0;
+  int currByte;
+
+  *value = 0;
+  do
+  {
+    currByte = fgetc(in);
+    if(currByte == EOF || shift > 63) return 0;
+    *value |= (uint64_t)(currByte & 0x7F) << shift;
+    shift += 7;
+  } while(currByte & 0x80);
+  return 1;
+}
@@ -0,0 +1,171 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for encode loops that pack a fixed number of
+ * codes between stores, picked from the longest code of a table. After
+ * a store at most 7 bits are left over, so when every code is at most
+ * 56 / n bits long, n codes can be shifted into the accumulator without
+ * checking for room in between, and then all of the whole bytes are
+ * stored with one 8 byte write. Each loop is built twice, once for any
+ * processor and once for those with BMI2, whose shifts by a variable
+ * count don't touch the flags, and the processor is asked at run time
+ * which one to use. Both write exactly the same bits as writeBits.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "huffman.h"
+
+/* Function Declarations */
+int haveBMI2(void);
+
+/* Encode loops are only built for BMI2 where gcc and clang can target it */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BMI2_KERNELS 1
+#define BMI2_TARGET __attribute__((target("bmi2")))
+#else
+#define BMI2_KERNELS 0
+#endif
+
+/*
+ * Defines an encode kernel adding PER_FLUSH codes between stores, for
+ * tables with no code longer than 56 / PER_FLUSH bits. It writes from
+ * src, stride bytes apart, until there are fewer than PER_FLUSH symbols
+ * left or a writer in memory has less than 8 bytes of room, and returns
+ * how many symbols it wrote, leaving the rest to writeBits. The writer
+ * is left holding at most 7 bits, same as if writeBits had written them.
+*/
+#define DEFINE_ENCODE_KERNEL(name, PER_FLUSH, TARGET) \
+TARGET unsigned long name(struct BitWriter* writer, const struct CodeTable* table, \
+                          const unsigned char* src, unsigned long count, int stride) \
+{ \
+  uint64_t bitBuf = writer->bitBuf; \
+  unsigned int bitCount = writer->bitCount; \
+  unsigned char* dest = writer->buffer + writer->used; \
+  unsigned char* end = writer->buffer + writer->capacity; \
+  unsigned long i = 0; \
+  \
+  while(1) \
+  { \
+    uint64_t word; \
+    int j; \
+    \
+    if(dest + 8 > end) \
+    { \
+      if(writer->out == NULL) break; \
+      fwrite(writer->buffer, 1, (size_t)(dest - writer->buffer), writer->out); \
+      dest = writer->buffer; \
+    } \
+    \
+    /* Stores every whole byte held, the two shifts allow for 0 bits */ \
+    word = bitBuf << (63 - bitCount) << 1; \
+    dest[0] = (unsigned char)(word >> 56); \
+    dest[1] = (unsigned char)(word >> 48); \
+    dest[2] = (unsigned char)(word >> 40); \
+    dest[3] = (unsigned char)(word >> 32); \
+    dest[4] = (unsigned char)(word >> 24); \
+    dest[5] = (unsigned char)(word >> 16); \
+    dest[6] = (unsigned char)(word >> 8); \
+    dest[7] = (unsigned char)word; \
+    dest += bitCount >> 3; \
+    bitCount &= 7; \
+    \
+    if(i + (PER_FLUSH) > count) break; \
+    for(j = 0; j < (PER_FLUSH); j++) \
+    { \
+      unsigned char symbol = *src; \
+      bitBuf = (bitBuf << table->length[symbol]) | table->code[symbol]; \
+      bitCount += table->length[symbol]; \
+      src += stride; \
+    } \
+    i += (PER_FLUSH); \
+  } \
+  \
+  writer->bitBuf = bitBuf & (((uint64_t)1 << bitCount) - 1); \
+  writer->bitCount = bitCount; \
+  writer->used = (unsigned long)(dest - writer->buffer); \
+  return i; \
+}
+
+/* Kernels for any processor, by codes added between stores */
+#define PORTABLE_TARGET
+DEFINE_ENCODE_KERNEL(encode2, 2, PORTABLE_TARGET)
+DEFINE_ENCODE_KERNEL(encode3, 3, PORTABLE_TARGET)
+DEFINE_ENCODE_KERNEL(encode4, 4, PORTABLE_TARGET)
+DEFINE_ENCODE_KERNEL(encode5, 5, PORTABLE_TARGET)
+DEFINE_ENCODE_KERNEL(encode6, 6, PORTABLE_TARGET)
+DEFINE_ENCODE_KERNEL(encode7, 7, PORTABLE_TARGET)
+DEFINE_ENCODE_KERNEL(encode8, 8, PORTABLE_TARGET)
+
+#if BMI2_KERNELS
+DEFINE_ENCODE_KERNEL(encode2BMI2, 2, BMI2_TARGET)
+DEFINE_ENCODE_KERNEL(encode3BMI2, 3, BMI2_TARGET)
+DEFINE_ENCODE_KERNEL(encode4BMI2, 4, BMI2_TARGET)
+DEFINE_ENCODE_KERNEL(encode5BMI2, 5, BMI2_TARGET)
+DEFINE_ENCODE_KERNEL(encode6BMI2, 6, BMI2_TARGET)
+DEFINE_ENCODE_KERNEL(encode7BMI2, 7, BMI2_TARGET)
+DEFINE_ENCODE_KERNEL(encode8BMI2, 8, BMI2_TARGET)
+#endif
+
+/* Kernels by codes added between stores, from 2 to 8, then with BMI2 */
+const EncodeKernel encodeKernels[2][7] =
+{
+  {encode2, encode3, encode4, encode5, encode6, encode7, encode8},
+#if BMI2_KERNELS
+  {encode2BMI2, encode3BMI2, encode4BMI2, encode5BMI2, encode6BMI2, encode7BMI2, encode8BMI2}
+#else
+  {encode2, encode3, encode4, encode5, encode6, encode7, encode8}
+#endif
+};
+
+/*
+ * Asks the processor whether it has BMI2
+
+ * returns int - 1 if the BMI2 kernels can run
+*/
+int haveBMI2(void)
+{
+#if BMI2_KERNELS && !defined(NO_ENCODE_KERNELS)
+  return __builtin_cpu_supports("bmi2") != 0;
+#else
+  return 0;
+#endif
+}
+
+/*
+ * Writes the codes of symbols stride bytes apart, through a kernel when
+ * the table's codes are short enough for one and writeBits for the rest.
+ * Building with -DNO_ENCODE_KERNELS leaves it all to writeBits, to
+ * measure what the kernels gain.
+
+ * struct BitWriter* writer - writer to append to
+ * const struct CodeTable* table - code and code length of every symbol
+ * const unsigned char* src - first symbol to write
+ * unsigned long count - how many symbols to write
+ * int stride - bytes from one symbol to the next, 1 for all of them
+*/
+void writeCodes(struct BitWriter* writer, const struct CodeTable* table,
+                const unsigned char* src, unsigned long count, int stride)
+{
+  unsigned long i = 0;
+  int longest = 0;
+  int s;
+
+  for(s = 0; s < 256; s++)
+  {
+    if(table->length[s] > longest) longest = table->length[s];
+  }
+
+#ifndef NO_ENCODE_KERNELS
+  if(longest > 0 && longest <= 28)
+  {
+    int perFlush = (56 / longest > 8) ? 8 : 56 / longest;
+    i = encodeKernels[haveBMI2()][perFlush - 2](writer, table, src, count, stride);
+  }
+#endif
+
+  for(; i < count; i++)
+  {
+    unsigned char symbol = src[i * (unsigned long)stride];
+    writeBits(writer, table->code[symbol], table->length[symbol]);
+  }
+}
@@ -0,0 +1,390 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for getting bytes in and out of files in
+ * large spans instead of a library call per byte. Regular input files
+ * are memory mapped and handed out a window of MAP_WINDOW_BYTES at a
+ * time, anything else (pipes, terminals) is read in chunks. Output of a
+ * known size up to a window goes straight into a mapping of the output
+ * file when possible, otherwise it is collected in a buffer and written
+ * out in chunks. Either way no more than a window of a file is held in
+ * memory, however large the file is.
+*/
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "huffman.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Function Declarations */
+void* mapFile(FILE* file, uint64_t start, unsigned long length, int writable,
+              unsigned long* mapLength, unsigned long* skip);
+int mapWindow(struct InputFile* input, uint64_t offset, uint64_t length);
+void readChunksFrom(struct InputFile* input, uint64_t offset);
+
+/*
+ * Maps part of a file into memory. Mappings have to start at a page
+ * boundary, so the mapping may start a little before the part asked for.
+
+ * FILE* file - file to map, stdio buffers should be empty or flushed
+ * uint64_t start - offset in the file of the first byte wanted
+ * unsigned long length - how many bytes are wanted, more than 0
+ * int writable - 1 to map for writing, the file must then be open for both
+ * unsigned long* mapLength - set to the length of the whole mapping
+ * unsigned long* skip - set to how far into the mapping start is
+
+ * returns void* - start of the mapping, NULL if the file can't be mapped
+*/
+void* mapFile(FILE* file, uint64_t start, unsigned long length, int writable,
+              unsigned long* mapLength, unsigned long* skip)
+{
+#ifdef _WIN32
+  return NULL;
+#else
+  long pageSize = sysconf(_SC_PAGESIZE);
+  void* map;
+
+  if(pageSize < 1) return NULL;
+  *skip = (unsigned long)(start % (uint64_t)pageSize);
+  *mapLength = length + *skip;
+  map = mmap(NULL, *mapLength, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+             writable ? MAP_SHARED : MAP_PRIVATE, fileno(file), (off_t)(start - *skip));
+  return (map == MAP_FAILED) ? NULL : map;
+#endif
+}
+
+/*
+ * Maps part of the rest of a mapped input in place of the part mapped
+ * before, so a file of any size only ever has one window in memory.
+
+ * struct InputFile* input - input to map more of
+ * uint64_t offset - bytes after the start of the input the window starts at
+ * uint64_t length - bytes in the window, more than 0
+
+ * returns int - 1 if mapped
+ *               0 if it couldn't be, nothing is mapped then
+*/
+int mapWindow(struct InputFile* input, uint64_t offset, uint64_t length)
+{
+  unsigned long skip;
+
+#ifndef _WIN32
+  if(input->map != NULL) munmap(input->map, input->mapLength);
+#endif
+  input->map = NULL;
+  input->length = 0;
+  input->pos = 0;
+  if(length != (unsigned long)length) return 0;
+
+  input->map = mapFile(input->in, (uint64_t)input->start + offset, (unsigned long)length, 0,
+                       &input->mapLength, &skip);
+  if(input->map == NULL) return 0;
+  input->data = (const unsigned char*)input->map + skip;
+  input->length = (unsigned long)length;
+  input->mapped = offset + length;
+  return 1;
+}
+
+/*
+ * Switches an input whose window couldn't be mapped over to reading
+ * chunks, carrying on from where the window would have started
+
+ * struct InputFile* input - input to read in chunks from now on
+ * uint64_t offset - bytes after the start of the input to read from
+*/
+void readChunksFrom(struct InputFile* input, uint64_t offset)
+{
+  if(input->buffer == NULL) input->buffer = (unsigned char*)malloc(INPUT_CHUNK_BYTES);
+  input->data = input->buffer;
+  input->length = 0;
+  input->pos = 0;
+  fseek(input->in, input->start + (long)offset, SEEK_SET);
+}
+
+/*
+ * Gets the rest of a file, from where it is now, ready to be read in
+ * spans. Regular files are mapped, so nothing gets copied at all, but
+ * only a window at a time, so memory doesn't grow with the file.
+
+ * struct InputFile* input - input to set up
+ * FILE* in - file to read
+
+ * returns int - 1 if the file was mapped
+ *               0 if it will be read in chunks
+*/
+int openInput(struct InputFile* input, FILE* in)
+{
+#ifndef _WIN32
+  struct stat info;
+#endif
+
+  input->in = in;
+  input->data = NULL;
+  input->length = 0;
+  input->pos = 0;
+  input->map = NULL;
+  input->mapLength = 0;
+  input->buffer = NULL;
+  input->start = ftell(in);
+  input->total = 0;
+  input->mapped = 0;
+
+#ifndef _WIN32
+  if(input->start >= 0 && fstat(fileno(in), &info) == 0 && S_ISREG(info.st_mode) &&
+     info.st_size > input->start)
+  {
+    input->total = (uint64_t)(info.st_size - input->start);
+    if(mapWindow(input, 0, (input->total < MAP_WINDOW_BYTES) ? input->total : MAP_WINDOW_BYTES))
+    {
+      return 1;
+    }
+  }
+#endif
+
+  input->buffer = (unsigned char*)malloc(INPUT_CHUNK_BYTES);
+  input->data = input->buffer;
+  return 0;
+}
+
+/*
+ * Hands out the next span of bytes. A mapped file comes out a window at
+ * a time, the window before being unmapped once the next is asked for,
+ * and other files a chunk at a time.
+
+ * struct InputFile* input - input to read from
+ * const unsigned char** span - set to the first byte of the span
+
+ * returns unsigned long - bytes in the span, 0 at the end of the input
+*/
+unsigned long nextSpan(struct InputFile* input, const unsigned char** span)
+{
+  unsigned long length;
+
+  if(input->map != NULL && input->pos == input->length && input->mapped < input->total)
+  {
+    uint64_t offset = input->mapped;
+    uint64_t left = input->total - offset;
+    if(!mapWindow(input, offset, (left < MAP_WINDOW_BYTES) ? left : MAP_WINDOW_BYTES))
+    {
+      readChunksFrom(input, offset);
+    }
+  }
+
+  if(input->map == NULL)
+  {
+    input->length = fread(input->buffer, 1, INPUT_CHUNK_BYTES, input->in);
+    input->pos = 0;
+  }
+
+  length = input->length - input->pos;
+  *span = input->data + input->pos;
+  input->pos = input->length;
+  return length;
+}
+
+/*
+ * Hands out all the rest of the input as one span, for code that needs
+ * every byte in memory at once. A mapped file is mapped in full for it,
+ * anything else is read in full into a buffer that doubles in size as
+ * it fills.
+
+ * struct InputFile* input - input to read, nothing handed out yet
+ * const unsigned char** data - set to the first byte of the input
+
+ * returns unsigned long - bytes of input
+*/
+unsigned long wholeInput(struct InputFile* input, const unsigned char** data)
+{
+  unsigned long capacity = INPUT_CHUNK_BYTES;
+  unsigned long got;
+
+  if(input->map != NULL)
+  {
+    if(input->mapped == input->total || mapWindow(input, 0, input->total))
+    {
+      return nextSpan(input, data);
+    }
+    readChunksFrom(input, 0);
+  }
+
+  input->length = 0;
+  while((got = fread(input->buffer + input->length, 1, capacity - input->length, input->in)) > 0)
+  {
+    input->length += got;
+    if(input->length == capacity)
+    {
+      capacity *= 2;
+      input->buffer = (unsigned char*)realloc(input->buffer, capacity);
+    }
+  }
+
+  input->data = input->buffer;
+  input->pos = input->length;
+  *data = input->data;
+  return input->length;
+}
+
+/*
+ * Goes back to where the input started, so it can be read again
+
+ * struct InputFile* input - input to rewind
+
+ * returns int - 1 if rewound
+ *               0 if the file can't seek, like a pipe
+*/
+int rewindInput(struct InputFile* input)
+{
+  input->pos = 0;
+
+  /* Only the first window starts where the input does */
+  if(input->map != NULL && input->mapped == input->length) return 1;
+  if(input->map != NULL)
+  {
+    if(mapWindow(input, 0, (input->total < MAP_WINDOW_BYTES) ? input->total : MAP_WINDOW_BYTES))
+    {
+      return 1;
+    }
+    readChunksFrom(input, 0);
+  }
+
+  input->length = 0;
+  return input->start >= 0 && fseek(input->in, input->start, SEEK_SET) == 0;
+}
+
+/*
+ * Unmaps or frees whatever the input was read through
+
+ * struct InputFile* input - input to close, the file itself stays open
+*/
+void closeInput(struct InputFile* input)
+{
+#ifndef _WIN32
+  if(input->map != NULL) munmap(input->map, input->mapLength);
+#endif
+  free(input->buffer);
+  input->map = NULL;
+  input->buffer = NULL;
+}
+
+/*
+ * Gets ready to write a known number of bytes at the file's current
+ * position. The space is reserved up front and mapped if the file is
+ * regular and open for reading and writing, so the bytes can be written
+ * right where they belong. Otherwise, or if there are more bytes than
+ * MAP_WINDOW_BYTES, bytes are collected in a buffer, since every page of
+ * a mapping written to stays in memory until the mapping is gone.
+
+ * struct OutputFile* output - output to set up
+ * FILE* out - file to write to
+ * uint64_t length - how many bytes will be written
+
+ * returns int - 1 if the output was mapped
+ *               0 if it will be written in chunks
+*/
+int openOutput(struct OutputFile* output, FILE* out, uint64_t length)
+{
+#ifndef _WIN32
+  struct stat info;
+#endif
+
+  output->out = out;
+  output->used = 0;
+  output->map = NULL;
+  output->mapLength = 0;
+  fflush(out);
+  output->start = ftell(out);
+
+#ifndef _WIN32
+  if(length > 0 && length <= MAP_WINDOW_BYTES && output->start >= 0 &&
+     fstat(fileno(out), &info) == 0 && S_ISREG(info.st_mode))
+  {
+    /* Reserving the blocks now, a full disk would otherwise only show up
+     * as a crash when the mapping gets written to */
+    if(posix_fallocate(fileno(out), (off_t)output->start, (off_t)length) == 0)
+    {
+      unsigned long skip;
+      output->map = mapFile(out, output->start, (unsigned long)length, 1,
+                            &output->mapLength, &skip);
+      if(output->map != NULL)
+      {
+        output->data = (unsigned char*)output->map + skip;
+        output->capacity = (unsigned long)length;
+        return 1;
+      }
+    }
+    ftruncate(fileno(out), (off_t)output->start);
+  }
+#endif
+
+  output->data = (unsigned char*)malloc(OUTPUT_CHUNK_BYTES);
+  output->capacity = OUTPUT_CHUNK_BYTES;
+  return 0;
+}
+
+/*
+ * Writes out the bytes collected so far, making room for more. A mapped
+ * output already holds everything, so there is nothing to do.
+
+ * struct OutputFile* output - output to flush
+*/
+void flushOutput(struct OutputFile* output)
+{
+  if(output->map != NULL) return;
+  fwrite(output->data, 1, output->used, output->out);
+  output->used = 0;
+}
+
+/*
+ * Makes sure the next length bytes can be written at data + used in one
+ * go. A buffered output is flushed to make room but never grows, so
+ * callers write OUTPUT_CHUNK_BYTES at most at a time, and a mapped one
+ * is already as large as it will get.
+
+ * struct OutputFile* output - output to make room in
+ * unsigned long length - bytes about to be written
+
+ * returns int - 1 if there is room
+ *               0 if a mapped output is too short or length is over a chunk
+*/
+int reserveOutput(struct OutputFile* output, unsigned long length)
+{
+  if(output->capacity - output->used >= length) return 1;
+  if(output->map != NULL) return 0;
+
+  flushOutput(output);
+  return length <= output->capacity;
+}
+
+/*
+ * Writes out anything left and unmaps or frees the output. A mapped
+ * file is cut off after the bytes written into it, in case fewer were
+ * written than were asked for, and left positioned there.
+
+ * struct OutputFile* output - output to close, the file itself stays open
+*/
+void closeOutput(struct OutputFile* output)
+{
+  if(output->map == NULL)
+  {
+    flushOutput(output);
+    free(output->data);
+  }
+#ifndef _WIN32
+  else
+  {
+    munmap(output->map, output->mapLength);
+    if(output->used < output->capacity)
+    {
+      ftruncate(fileno(output->out), (off_t)(output->start + (long)output->used));
+    }
+    fseek(output->out, output->start + (long)output->used, SEEK_SET);
+  }
+#endif
+  output->data = NULL;
+  output->map = NULL;
+}
@@ -0,0 +1,180 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for counting how often every byte value
+ * appears in a buffer, the first step of building any huffman code.
+ * A single table of counts means every byte waits on the count the last
+ * byte stored, which stalls whenever the same byte repeats. Counting
+ * into several tables in turn breaks that chain, and large buffers are
+ * also split between threads that each count their own part.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "huffman.h"
+
+/* Part of a buffer counted by one task of countBytesParallel */
+struct HistogramTask
+{
+  const unsigned char* data;
+  unsigned long length;
+  unsigned long freq[256];
+};
+
+/* Function Declarations */
+void countBytesTask(void* context, unsigned long index);
+
+/*
+ * Adds how often every byte value appears in a buffer to freq. Bytes
+ * are loaded 8 at a time and spread over HISTOGRAM_WAYS tables of 32 bit
+ * counts, which are added up every HISTOGRAM_SPAN bytes so none of them
+ * can overflow.
+
+ * const unsigned char* data - bytes to count
+ * unsigned long length - how many bytes data holds
+ * unsigned long* freq - array of 256 counts to add to
+*/
+void countBytes(const unsigned char* data, unsigned long length, unsigned long* freq)
+{
+  uint32_t counts[HISTOGRAM_WAYS][256];
+
+  while(length > 0)
+  {
+    unsigned long part = (length < HISTOGRAM_SPAN) ? length : HISTOGRAM_SPAN;
+    unsigned long i = 0;
+    int way, j;
+
+    memset(counts, 0, sizeof(counts));
+    for(; i + 8 <= part; i += 8)
+    {
+      uint64_t word; /* byte order doesn't matter, every byte gets counted */
+      memcpy(&word, data + i, 8);
+      counts[0][word & 0xFF]++;
+      counts[1][(word >> 8) & 0xFF]++;
+      counts[2][(word >> 16) & 0xFF]++;
+      counts[3][(word >> 24) & 0xFF]++;
+      counts[0][(word >> 32) & 0xFF]++;
+      counts[1][(word >> 40) & 0xFF]++;
+      counts[2][(word >> 48) & 0xFF]++;
+      counts[3][word >> 56]++;
+    }
+    for(; i < part; i++) counts[0][data[i]]++;
+
+    for(j = 0; j < 256; j++)
+    {
+      for(way = 0; way < HISTOGRAM_WAYS; way++) freq[j] += counts[way][j];
+    }
+    data += part;
+    length -= part;
+  }
+}
+
+/*
+ * Counts a buffer a segment at a time, giving the running counts of
+ * everything up to the end of each segment. The tables are the same as
+ * countBytes uses, but since the counts only ever go up they are never
+ * cleared, just added up at the end of every segment.
+
+ * const unsigned char* data - bytes to count, at most HISTOGRAM_SPAN of them
+ * unsigned long length - how many bytes data holds
+ * unsigned long segmentBytes - bytes in every segment but the last, which has the rest
+ * unsigned long numSegments - how many segments there are
+ * unsigned long* rows - 256 counts for each segment, set to the counts up to its end
+*/
+void countSegments(const unsigned char* data, unsigned long length, unsigned long segmentBytes,
+                   unsigned long numSegments, unsigned long* rows)
+{
+  uint32_t counts[HISTOGRAM_WAYS][256];
+  unsigned long i = 0, s;
+  int way, j;
+
+  memset(counts, 0, sizeof(counts));
+  for(s = 0; s < numSegments; s++)
+  {
+    unsigned long end = (s + 1 == numSegments) ? length : (s + 1) * segmentBytes;
+    unsigned long* row = rows + 256 * s;
+
+    for(; i + 8 <= end; i += 8)
+    {
+      uint64_t word;
+      memcpy(&word, data + i, 8);
+      counts[0][word & 0xFF]++;
+      counts[1][(word >> 8) & 0xFF]++;
+      counts[2][(word >> 16) & 0xFF]++;
+      counts[3][(word >> 24) & 0xFF]++;
+      counts[0][(word >> 32) & 0xFF]++;
+      counts[1][(word >> 40) & 0xFF]++;
+      counts[2][(word >> 48) & 0xFF]++;
+      counts[3][word >> 56]++;
+    }
+    for(; i < end; i++) counts[0][data[i]]++;
+
+    for(j = 0; j < 256; j++)
+    {
+      row[j] = 0;
+      for(way = 0; way < HISTOGRAM_WAYS; way++) row[j] += counts[way][j];
+    }
+  }
+}
+
+/*
+ * Task for the thread pool, counts one part of the buffer
+
+ * void* context - array of HistogramTasks
+ * unsigned long index - which part to count
+*/
+void countBytesTask(void* context, unsigned long index)
+{
+  struct HistogramTask* task = (struct HistogramTask*)context + index;
+  countBytes(task->data, task->length, task->freq);
+}
+
+/*
+ * Adds how often every byte value appears in a buffer to freq, splitting
+ * buffers of at least HISTOGRAM_THREAD_BYTES a thread between threads.
+ * Each thread counts its own part into its own table, and the tables are
+ * added up at the end. Smaller buffers are counted on this thread.
+
+ * const unsigned char* data - bytes to count
+ * unsigned long length - how many bytes data holds
+ * unsigned long* freq - array of 256 counts to add to
+ * int numThreads - most threads to use
+*/
+void countBytesParallel(const unsigned char* data, unsigned long length, unsigned long* freq,
+                        int numThreads)
+{
+  struct HistogramTask* tasks;
+  struct ThreadPool* pool;
+  unsigned long share, numTasks, i;
+  int j;
+
+  if(numThreads > 1 && length / numThreads < HISTOGRAM_THREAD_BYTES)
+  {
+    numThreads = (int)(length / HISTOGRAM_THREAD_BYTES);
+  }
+  if(numThreads <= 1)
+  {
+    countBytes(data, length, freq);
+    return;
+  }
+
+  numTasks = (unsigned long)numThreads;
+  share = length / numTasks;
+  tasks = (struct HistogramTask*)malloc(sizeof(struct HistogramTask) * numTasks);
+  for(i = 0; i < numTasks; i++)
+  {
+    tasks[i].data = data + i * share;
+    tasks[i].length = (i == numTasks - 1) ? length - i * share : share;
+    for(j = 0; j < 256; j++) tasks[i].freq[j] = 0;
+  }
+
+  pool = createThreadPool(numThreads);
+  runTasks(pool, countBytesTask, tasks, numTasks);
+  freeThreadPool(pool);
+
+  for(i = 0; i < numTasks; i++)
+  {
+    for(j = 0; j < 256; j++) freq[j] += tasks[i].freq[j];
+  }
+  free(tasks);
+}
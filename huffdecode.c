@@ -3,15 +3,74 @@
  * This file is responsible for decoding a given 
  * file that was previously encoded by the huffencode program.
  * The program's command arguments are in the following format: 
- * ./huffdecode inputFile outputFile
- * Where inputFile is a file encoded by the huffman algorithm and 
- * outputFile is the file to write the decoded information to.
+ * ./huffdecode [-t threads] [--range offset:length] [--stats=json] [--dict dictFile] 
+ *              inputFile outputFile
+ * ./huffdecode [-t threads] --batch outputDir inputs...
+ * Where inputFile is a file encoded by the huffman algorithm, in any of
+ * the formats, and outputFile is the file to write the decoded information 
+ * to. Either may be "-" for standard input/output, every format is decoded 
+ * in a single pass so the input may be a pipe. --range decodes only the
+ * given bytes of a block format file, finding the block they start in
+ * from the index at the end of the file, so the input must be a file.
+ * --stats=json writes how long each phase took to standard error.
+ * --batch decodes every canonical or block format input file, directory
+ * or list of names given on standard input as "-" into outputDir.
+ * Files encoded with a dictionary need the same one given with --dict.
 */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include "huffman.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
+/* Everything the stages of decodeBlocks share, each batch of blocks
+ * having a slot of batchSize blocks */
+struct BlockDecoder
+{
+  FILE* in;
+  FILE* out;
+  struct ThreadPool* pool;
+  struct Block* blocks; /* PIPELINE_DEPTH slots of batchSize blocks */
+  unsigned long* capacity; /* bytes allocated for each block's packed bytes */
+  unsigned long* rawCapacity; /* bytes allocated for each block's raw bytes */
+  struct CodecStats* slotStats; /* each block times its own phases, NULL for none */
+  unsigned long batchSize; /* blocks in a slot */
+  unsigned long counts[PIPELINE_DEPTH]; /* blocks read into each slot */
+  unsigned long blockSize; /* largest raw length of a block */
+  uint64_t skip, length; /* decoded bytes to leave out, then to write */
+  uint64_t writeSkip, writeLength; /* what is left of them for the write stage */
+  uint64_t readRaw; /* decoded bytes of the blocks read so far */
+  uint64_t readBytes; /* encoded bytes of the blocks read so far */
+  int inputEnded; /* set by the read stage once no more blocks will be read */
+  int corrupt; /* set if a block couldn't be read or decoded */
+};
+
+FILE* openFile(const char* name, const char* mode);
 struct SymbolNode* readHeader(FILE* in, int numSymbols, struct SymbolNode* root);
-void decodeChars(FILE* in, FILE* out, int numChars, struct SymbolNode* root);
+struct SymbolNode* readCode(FILE* in, unsigned char symbol, unsigned char codeLength,
+                            struct SymbolNode* root);
+unsigned long readU32(FILE* in);
+int decodeBlocks(FILE* in, FILE* out, struct DecodeOptions* options, unsigned long blockSize,
+                 uint64_t skip, uint64_t length);
+int decodeRange(FILE* in, FILE* out, struct DecodeOptions* options);
+int findBlock(FILE* in, long indexOffset, uint64_t numBlocks, uint64_t rawOffset,
+              uint64_t* blockRaw, uint64_t* blockFile);
+int parseRange(const char* text, uint64_t* start, uint64_t* length);
+int parseU64(const char** text, uint64_t* value);
+uint64_t readU64(FILE* in);
+int decodeCanonicalFile(FILE* in, FILE* out, struct CodecStats* stats);
+unsigned long readPackedLengths(FILE* in, unsigned char* packed);
+int decodeDictFile(FILE* in, FILE* out, struct DecodeOptions* options);
+uint64_t fileLength(FILE* file);
+void decodeBlockTask(void* context, unsigned long index);
+int readDecodeBatch(void* context, int slot);
+int decodeBatch(void* context, int slot);
+int writeDecodeBatch(void* context, int slot);
+int decodeChars(FILE* in, FILE* out, uint64_t numChars, struct DecodeTable* table);
 
 int main(int argc, char** argv)
 {
@@ -19,36 +78,138 @@ int main(int argc, char** argv)
   char* outfile;
   FILE* in;
   FILE* out;
+  struct DecodeOptions options;
+  struct CodecStats stats;
+  struct Dictionary dictionary;
+  FILE* dictFile;
+  int argi = 1;
+  int batch = 0;
+  int decoded;
+  double start = wallClock();
+
+  options.numThreads = countProcessors();
+  options.useRange = 0;
+  options.dictionary = NULL;
+  options.stats = NULL;
+
+  /* reading any flags before the file names, a lone "-" is a file name */
+  while(argi + 1 < argc && argv[argi][0] == '-' && argv[argi][1] != '\0')
+  {
+    if(strcmp(argv[argi], "--stats=json") == 0)
+    {
+      options.stats = &stats;
+      argi++;
+      continue;
+    }
+    if(strcmp(argv[argi], "--batch") == 0)
+    {
+      batch = 1;
+      argi++;
+      continue;
+    }
+    if(strcmp(argv[argi], "-t") == 0)
+    {
+      options.numThreads = atoi(argv[argi+1]);
+      if(options.numThreads < 1)
+      {
+        fprintf(stderr, "invalid thread count %s\n", argv[argi+1]);
+        return 1;
+      }
+    }
+    else if(strcmp(argv[argi], "--dict") == 0)
+    {
+      dictFile = fopen(argv[argi+1], "rb");
+      if(dictFile == NULL || !loadDictionary(&dictionary, dictFile))
+      {
+        fprintf(stderr, "invalid dictionary %s\n", argv[argi+1]);
+        return 1;
+      }
+      fclose(dictFile);
+      options.dictionary = &dictionary;
+    }
+    else if(strcmp(argv[argi], "--range") == 0)
+    {
+      options.useRange = 1;
+      if(!parseRange(argv[argi+1], &options.rangeStart, &options.rangeLength))
+      {
+        fprintf(stderr, "invalid range %s, expected offset:length\n", argv[argi+1]);
+        return 1;
+      }
+    }
+    else break;
+    argi += 2;
+  }
 
-  if(argc != 3) 
+  /* a batch takes the output directory and then any number of inputs */
+  if(batch && argc - argi >= 2)
   {
-    printf("wrong number of args\n");
+    return runBatch(0, argv[argi], argv + argi + 1, argc - argi - 1, options.numThreads, 0) ? 0 : 4;
+  }
+
+  if(argc - argi != 2) 
+  {
+    fprintf(stderr, "wrong number of args\n");
     return 1;
   }
 
-  infile = argv[1];
-  outfile = argv[2];
+  infile = argv[argi];
+  outfile = argv[argi+1];
 
-  in = fopen(infile, "rb");
+  in = openFile(infile, "rb");
   if(in == NULL)
   {
-    printf("couldn't open %s for reading\n", infile);
+    fprintf(stderr, "couldn't open %s for reading\n", infile);
     return 2;
   }
 
-  out = fopen(outfile, "wb");
+  /* opened for reading too so it can be mapped */
+  out = openFile(outfile, "w+b");
   if(out == NULL)
   {
-    printf("couldn't open %s for writing\n", outfile);
+    fprintf(stderr, "couldn't open %s for writing\n", outfile);
     return 3;
   }
 
-  decodeFile(in, out);
+  if(options.stats != NULL) resetStats(options.stats);
+  decoded = decodeFileOptions(in, out, &options);
+  fflush(out);
 
-  fclose(in);
-  fclose(out);
+  /* sizes come from the files when they can, pipes are counted as read */
+  if(options.stats != NULL)
+  {
+    stats.totalSeconds = wallClock() - start;
+    if(fileLength(in) > 0) stats.inputBytes = fileLength(in);
+    if(fileLength(out) > 0) stats.outputBytes = fileLength(out);
+    else stats.outputBytes = stats.symbols;
+    writeStatsJson(stderr, "huffdecode", &stats);
+  }
+
+  if(in != stdin) fclose(in);
+  if(out != stdout) fclose(out);
 
-  return 0;
+  return decoded ? 0 : 4;
+}
+
+/*
+ * Opens a file for the command line, "-" meaning standard input or
+ * output depending on the mode, which gets switched to binary where
+ * that makes a difference.
+ 
+ * const char* name - file name as typed
+ * const char* mode - "rb", or "wb"/"w+b"
+ 
+ * returns FILE* - opened file, NULL if it couldn't be opened
+*/
+FILE* openFile(const char* name, const char* mode)
+{
+  FILE* file;
+  if(strcmp(name, "-") != 0) return fopen(name, mode);
+
+  file = (mode[0] == 'r') ? stdin : stdout;
+#ifdef _WIN32
+  _setmode(_fileno(file), _O_BINARY);
+#endif
+  return file;
 }
 
 /***************************************************/
@@ -57,18 +218,651 @@ int main(int argc, char** argv)
 /* out -- File where decoded data will be written. */
 /***************************************************/
 void decodeFile(FILE* in, FILE* out)
+{
+  struct DecodeOptions options;
+  options.numThreads = countProcessors();
+  options.useRange = 0;
+  options.dictionary = NULL;
+  options.stats = NULL;
+  decodeFileOptions(in, out, &options);
+}
+
+/***************************************************/
+/* Decode a Huffman encoded file with settings.    */
+/* in -- File to decode.                           */
+/* out -- File where decoded data will be written. */
+/* options -- Threads and other settings.          */
+/* returns 1 if decoded, 0 if the file is corrupt  */
+/***************************************************/
+int decodeFileOptions(FILE* in, FILE* out, struct DecodeOptions* options)
 {
   struct SymbolNode* root;
-  unsigned long numChars;
+  struct DecodeTable* table;
+  uint64_t numChars;
   int numSymbols = (unsigned int)fgetc(in); 
+  int symbol, codeLength;
+  int decoded;
+  uint64_t headerEnd; /* where the legacy header stops */
+  double start = startPhase(options->stats);
+  
+  /* In the legacy format the next two bytes are the first symbol and its 
+   * code length, unless they turn out to be the rest of the magic bytes */
+  symbol = fgetc(in);
+  codeLength = fgetc(in);
+  if(numSymbols == MAGIC_0 && symbol == MAGIC_1 && codeLength == MAGIC_2)
+  {
+    int format = fgetc(in);
+
+    if(options->stats != NULL) options->stats->format = format;
+    if(format == FORMAT_BLOCKS && options->useRange) return decodeRange(in, out, options);
+    if(format == FORMAT_BLOCKS) return decodeBlocks(in, out, options, readU32(in), 0, (uint64_t)-1);
+    if(options->useRange)
+    {
+      fprintf(stderr, "Ranges can only be decoded from the block format!\n");
+      return 0;
+    }
+    if(format == FORMAT_CANONICAL) return decodeCanonicalFile(in, out, options->stats);
+    if(format == FORMAT_DICT) return decodeDictFile(in, out, options);
+    if(format == FORMAT_ADAPTIVE)
+    {
+      start = startPhase(options->stats);
+      decoded = decodeAdaptive(in, out);
+      if(options->stats != NULL)
+      {
+        endPhase(options->stats, PHASE_DECODE, start, (fileLength(in) > 4) ? fileLength(in) - 4 : 0);
+        options->stats->symbols = fileLength(out);
+      }
+      if(!decoded) fprintf(stderr, "Invalid or truncated adaptive code!\n");
+      return decoded;
+    }
+    fprintf(stderr, "Invalid or unsupported header!\n");
+    return 0;
+  }
+
+  if(options->useRange)
+  {
+    fprintf(stderr, "Ranges can only be decoded from the block format!\n");
+    return 0;
+  }
+
+  /* An empty file is written with no symbols and a count of 0, which reads
+   * like 256 symbols except that no code can be 0 bits long */
+  if(numSymbols == 0 && codeLength == 0) return 1;
   if(numSymbols == 0) numSymbols = 256;
+  if(options->stats != NULL) options->stats->format = FORMAT_LEGACY;
 
-  root = readHeader(in, numSymbols, NULL); 
+  root = readCode(in, symbol, codeLength, NULL);
+  root = readHeader(in, numSymbols-1, root); 
+  table = buildDecodeTable(root);
+  fillMultiTable(table);
+  numChars = readU64(in); 
+  headerEnd = (ftell(in) > 0) ? (uint64_t)ftell(in) : 0;
+  endPhase(options->stats, PHASE_HEADER_PARSE, start, headerEnd);
 
-  fread(&numChars, sizeof(unsigned long), 1, in); 
-  decodeChars(in, out, numChars, root);
+  start = startPhase(options->stats);
+  decoded = decodeChars(in, out, numChars, table);
+  if(options->stats != NULL)
+  {
+    endPhase(options->stats, PHASE_DECODE, start, 
+             (fileLength(in) > headerEnd) ? fileLength(in) - headerEnd : 0);
+    addTableStats(options->stats, table, numChars);
+  }
 
+  freeDecodeTable(table);
   freeTree(root);
+  return decoded;
+}
+
+/*
+ * Decodes a dictionary file, after the magic and format, with the
+ * dictionary given on the command line. The bits are read in spans and
+ * the bytes written out a chunk at a time, so nothing but the lookup
+ * table is held in memory.
+ 
+ * FILE* in - file to decode
+ * FILE* out - file to write decoded characters to 
+ * struct DecodeOptions* options - the dictionary and stats
+ 
+ * returns int - 1 if every character was decoded
+ *               0 if the dictionary is missing or wrong or the file is corrupt
+*/
+int decodeDictFile(FILE* in, FILE* out, struct DecodeOptions* options)
+{
+  struct Dictionary* dict = options->dictionary;
+  struct DecodeTable* table;
+  struct InputFile input;
+  struct OutputFile output;
+  struct BitReader reader;
+  unsigned long id;
+  uint64_t length, left;
+  int decoded = 1, mapped;
+  double start = startPhase(options->stats);
+
+  id = readU32(in);
+  if(!readVarint(in, &length))
+  {
+    fprintf(stderr, "Invalid or truncated encoded data!\n");
+    return 0;
+  }
+  if(dict == NULL || dict->id != id)
+  {
+    fprintf(stderr, "This file needs dictionary %08lx, give it with --dict!\n", id);
+    return 0;
+  }
+  table = buildCanonicalTable(dict->lengths);
+  /* escapes are decoded a symbol at a time, so only codes without one
+   * use the multi-symbol table */
+  if(table != NULL && dict->escape == DICT_NO_ESCAPE) fillMultiTable(table);
+  endPhase(options->stats, PHASE_HEADER_PARSE, start, 0);
+
+  /* no code is shorter than a bit, so a mapped input shows a corrupt length */
+  start = startPhase(options->stats);
+  mapped = openInput(&input, in);
+  if(mapped && length / 8 > input.total) length = 0, decoded = 0;
+  initBitReader(&reader, &input);
+  openOutput(&output, out, length);
+
+  for(left = length; left > 0 && decoded; )
+  {
+    unsigned long count = (left < OUTPUT_CHUNK_BYTES) ? (unsigned long)left : OUTPUT_CHUNK_BYTES;
+    decoded = reserveOutput(&output, count) &&
+              decodeDictionary(dict, table, &reader, output.data + output.used, count);
+    output.used += count;
+    left -= count;
+  }
+  closeOutput(&output);
+  if(options->stats != NULL)
+  {
+    endPhase(options->stats, PHASE_DECODE, start, mapped ? input.total : 0);
+    addTableStats(options->stats, table, length);
+  }
+  closeInput(&input);
+  freeDecodeTable(table);
+
+  if(!decoded) fprintf(stderr, "Invalid or truncated encoded data!\n");
+  return decoded;
+}
+
+/*
+ * Decodes a canonical code file, after the magic and format. The code
+ * lengths and the length are read first, then the bits go through a
+ * reader over the input, which is mapped a window at a time or read in
+ * chunks, and are decoded OUTPUT_CHUNK_BYTES at a time, so memory doesn't
+ * grow with the file.
+ 
+ * FILE* in - file to decode
+ * FILE* out - file to write decoded characters to 
+ * struct CodecStats* stats - phases are timed into this unless NULL
+ 
+ * returns int - 1 if every character was decoded
+ *               0 if the file is corrupt
+*/
+int decodeCanonicalFile(FILE* in, FILE* out, struct CodecStats* stats)
+{
+  unsigned char packedLengths[MAX_LENGTHS_BYTES];
+  unsigned char lengths[256];
+  struct DecodeTable* table = NULL;
+  struct InputFile input;
+  struct OutputFile output;
+  struct BitReader reader;
+  unsigned long numBytes;
+  uint64_t length, left;
+  int decoded, mapped;
+  double start = startPhase(stats);
+
+  numBytes = readPackedLengths(in, packedLengths);
+  length = readU64(in);
+  if(numBytes > 0 && !feof(in) &&
+     readLengthsFrom(packedLengths, numBytes, lengths) == (long)numBytes)
+  {
+    table = buildCanonicalTable(lengths);
+  }
+  if(table != NULL) fillMultiTable(table);
+  endPhase(stats, PHASE_HEADER_PARSE, start, 4 + numBytes + 8);
+  if(table == NULL)
+  {
+    fprintf(stderr, "Invalid or truncated encoded data!\n");
+    return 0;
+  }
+
+  /* no code is shorter than a bit, so a mapped input shows a corrupt length */
+  start = startPhase(stats);
+  decoded = 1;
+  mapped = openInput(&input, in);
+  if(mapped && length / 8 > input.total) length = 0, decoded = 0;
+  initBitReader(&reader, &input);
+  openOutput(&output, out, length);
+
+  for(left = length; left > 0 && decoded; )
+  {
+    unsigned long count = (left < OUTPUT_CHUNK_BYTES) ? (unsigned long)left : OUTPUT_CHUNK_BYTES;
+    decoded = reserveOutput(&output, count) &&
+              decodeSymbols(table, &reader, output.data + output.used, count);
+    output.used += count;
+    left -= count;
+  }
+  closeOutput(&output);
+  if(stats != NULL)
+  {
+    endPhase(stats, PHASE_DECODE, start, mapped ? input.total : 0);
+    addTableStats(stats, table, length);
+  }
+  closeInput(&input);
+  freeDecodeTable(table);
+
+  if(!decoded) fprintf(stderr, "Invalid or truncated encoded data!\n");
+  return decoded;
+}
+
+/*
+ * Reads the run-length encoded code lengths of a canonical code, a byte
+ * at a time until they cover all 256 symbols, without decoding them.
+ 
+ * FILE* in - file to read from, left just after the lengths
+ * unsigned char* packed - MAX_LENGTHS_BYTES bytes to read them into
+ 
+ * returns unsigned long - bytes read, 0 if they are malformed or cut off
+*/
+unsigned long readPackedLengths(FILE* in, unsigned char* packed)
+{
+  unsigned long numBytes = 0;
+  int symbols = 0;
+  int c;
+
+  while(symbols < 256 && numBytes < MAX_LENGTHS_BYTES && (c = fgetc(in)) != EOF)
+  {
+    packed[numBytes++] = (unsigned char)c;
+    if(c <= MAX_CODE_LENGTH) symbols++;
+    else if(c >= 0xC0) symbols += c - 0xBF; /* a run of zeroes */
+    else if(c >= 0x80) symbols += c - 0x7F; /* repeats of the last length */
+    else return 0;
+  }
+  return (symbols == 256) ? numBytes : 0;
+}
+
+/*
+ * Task for the thread pool, decodes one block of a batch
+ 
+ * void* context - array of blocks in the batch
+ * unsigned long index - which block to decode
+*/
+void decodeBlockTask(void* context, unsigned long index)
+{
+  decodeBlock((struct Block*)context + index);
+}
+
+/*
+ * Reads the next batch of blocks of a file being decoded, the read stage
+ * of decodeBlocks. Reading stops at the end block, at a block that is
+ * corrupt, or once every byte that will be written has been read.
+ 
+ * void* context - the BlockDecoder
+ * int slot - which slot's blocks to read into
+ 
+ * returns int - 1 if any blocks were read, 0 if there are no more
+*/
+int readDecodeBatch(void* context, int slot)
+{
+  struct BlockDecoder* decoder = (struct BlockDecoder*)context;
+  unsigned long first = (unsigned long)slot * decoder->batchSize;
+  unsigned long count = 0;
+  FILE* in = decoder->in;
+
+  while(!decoder->inputEnded && count < decoder->batchSize &&
+        (decoder->readRaw < decoder->skip || decoder->readRaw - decoder->skip < decoder->length))
+  {
+    struct Block* block = &decoder->blocks[first + count];
+    unsigned long* capacity = &decoder->capacity[first + count];
+    unsigned long* rawCapacity = &decoder->rawCapacity[first + count];
+    int kind = fgetc(in);
+    if(kind == BLOCK_END)
+    {
+      decoder->inputEnded = 1;
+      break;
+    }
+
+    block->kind = kind;
+    block->rawLength = readU32(in);
+    block->packedLength = readU32(in);
+
+    /* Lengths are checked so a corrupt file can't ask for lots of memory */
+    if((kind != BLOCK_HUFFMAN && kind != BLOCK_STREAMS && kind != BLOCK_ORDER1 &&
+        kind != BLOCK_STORED) ||
+       block->rawLength > decoder->blockSize ||
+       block->packedLength > 256 + 8 * decoder->blockSize)
+    {
+      decoder->inputEnded = 1;
+      decoder->corrupt = 1;
+      break;
+    }
+    if(block->context == NULL)
+    {
+      block->context = createHuffContext(0, 1);
+      if(decoder->slotStats != NULL) block->context->stats = &decoder->slotStats[first + count];
+    }
+    if(block->packedLength > *capacity)
+    {
+      *capacity = block->packedLength;
+      block->packed = (unsigned char*)realloc(block->packed, *capacity);
+    }
+    if(block->rawLength > *rawCapacity)
+    {
+      *rawCapacity = block->rawLength;
+      block->raw = (unsigned char*)realloc(block->raw, *rawCapacity);
+    }
+    if(fread(block->packed, 1, block->packedLength, in) != block->packedLength)
+    {
+      decoder->inputEnded = 1;
+      decoder->corrupt = 1;
+      break;
+    }
+    decoder->readRaw += block->rawLength;
+    decoder->readBytes += 9 + block->packedLength;
+    count++;
+  }
+  decoder->counts[slot] = count;
+  return count > 0;
+}
+
+/*
+ * Decodes a batch of blocks on the thread pool, the code stage of
+ * decodeBlocks
+ 
+ * void* context - the BlockDecoder
+ * int slot - which slot's blocks to decode
+ 
+ * returns int - always 1
+*/
+int decodeBatch(void* context, int slot)
+{
+  struct BlockDecoder* decoder = (struct BlockDecoder*)context;
+  runTasks(decoder->pool, decodeBlockTask,
+           decoder->blocks + (unsigned long)slot * decoder->batchSize, decoder->counts[slot]);
+  return 1;
+}
+
+/*
+ * Writes out the decoded bytes of a batch of blocks, leaving out any
+ * still to be skipped, the write stage of decodeBlocks
+ 
+ * void* context - the BlockDecoder
+ * int slot - which slot's blocks to write
+ 
+ * returns int - 1 if written, 0 if a block was corrupt
+*/
+int writeDecodeBatch(void* context, int slot)
+{
+  struct BlockDecoder* decoder = (struct BlockDecoder*)context;
+  struct Block* blocks = decoder->blocks + (unsigned long)slot * decoder->batchSize;
+  unsigned long b;
+
+  for(b = 0; b < decoder->counts[slot]; b++)
+  {
+    if(blocks[b].failed)
+    {
+      decoder->corrupt = 1;
+      return 0;
+    }
+    if(decoder->writeSkip >= blocks[b].rawLength) decoder->writeSkip -= blocks[b].rawLength;
+    else
+    {
+      uint64_t write = blocks[b].rawLength - decoder->writeSkip;
+      if(write > decoder->writeLength) write = decoder->writeLength;
+      fwrite(blocks[b].raw + decoder->writeSkip, 1, (size_t)write, decoder->out);
+      decoder->writeSkip = 0;
+      decoder->writeLength -= write;
+    }
+  }
+  fflush(decoder->out); /* so a reader on a pipe gets each batch right away */
+  return 1;
+}
+
+/*
+ * Decodes the blocks of a FORMAT_BLOCKS file, after the block size.
+ * Blocks are read in batches of a few per thread and go through a
+ * pipeline: while one batch is decoded by the thread pool, the next is
+ * being read and the one before written out in order. The index at
+ * the end isn't needed since every block says how long it is, so the
+ * file is read in one pass and may come from a pipe. Buffers only grow
+ * to the size of the blocks actually seen, which bounds the memory used
+ * by the batch size rather than the file size. Only length bytes after
+ * the first skip are written, and no more blocks are read once they are.
+ 
+ * FILE* in - file to decode, positioned at a block
+ * FILE* out - file to write decoded characters to 
+ * struct DecodeOptions* options - number of threads
+ * unsigned long blockSize - largest raw length of a block
+ * uint64_t skip - decoded bytes to leave out before writing
+ * uint64_t length - most decoded bytes to write, (uint64_t)-1 for all
+ 
+ * returns int - 1 if every block was decoded
+ *               0 if the file is corrupt
+*/
+int decodeBlocks(FILE* in, FILE* out, struct DecodeOptions* options, unsigned long blockSize,
+                 uint64_t skip, uint64_t length)
+{
+  struct BlockDecoder decoder;
+  unsigned long numSlots = (unsigned long)options->numThreads * BLOCKS_PER_THREAD * PIPELINE_DEPTH;
+  unsigned long b;
+
+  decoder.in = in;
+  decoder.out = out;
+  decoder.pool = createThreadPool(options->numThreads);
+  decoder.batchSize = (unsigned long)options->numThreads * BLOCKS_PER_THREAD;
+  decoder.blocks = (struct Block*)calloc(numSlots, sizeof(struct Block));
+  decoder.capacity = (unsigned long*)calloc(numSlots, sizeof(unsigned long));
+  decoder.rawCapacity = (unsigned long*)calloc(numSlots, sizeof(unsigned long));
+  decoder.slotStats = NULL;
+  decoder.blockSize = blockSize;
+  decoder.skip = skip;
+  decoder.length = length;
+  decoder.writeSkip = skip;
+  decoder.writeLength = length;
+  decoder.readRaw = 0;
+  decoder.readBytes = 0;
+  decoder.inputEnded = 0;
+  decoder.corrupt = 0;
+
+  if(blockSize == 0 || blockSize > MAX_BLOCK_SIZE) decoder.inputEnded = 1, decoder.corrupt = 1;
+  if(options->stats != NULL)
+  {
+    decoder.slotStats = (struct CodecStats*)malloc(sizeof(struct CodecStats) * numSlots);
+    for(b = 0; b < numSlots; b++) resetStats(&decoder.slotStats[b]);
+  }
+
+  runPipeline(&decoder, readDecodeBatch, decodeBatch, writeDecodeBatch);
+
+  if(decoder.corrupt) fprintf(stderr, "Invalid or truncated blocks!\n");
+  if(options->stats != NULL) options->stats->inputBytes = 8 + decoder.readBytes;
+
+  for(b = 0; b < numSlots; b++)
+  {
+    if(decoder.slotStats != NULL) addStats(options->stats, &decoder.slotStats[b]);
+    free(decoder.blocks[b].raw);
+    free(decoder.blocks[b].packed);
+    freeHuffContext(decoder.blocks[b].context);
+  }
+  free(decoder.blocks);
+  free(decoder.slotStats);
+  free(decoder.capacity);
+  free(decoder.rawCapacity);
+  freeThreadPool(decoder.pool);
+  return !decoder.corrupt;
+}
+
+/*
+ * Decodes just options->rangeLength bytes starting at options->rangeStart
+ * from a FORMAT_BLOCKS file, after the magic and format. The index at the
+ * end of the file says where every block starts, both decoded and in the
+ * file, so the block holding the first byte is found by a binary search
+ * and decoding starts there instead of at the beginning. A range going
+ * past the end of the file is cut short.
+ 
+ * FILE* in - file to decode, has to be seekable
+ * FILE* out - file to write the decoded range to
+ * struct DecodeOptions* options - threads and the range to decode
+ 
+ * returns int - 1 if the range was decoded
+ *               0 if the file is corrupt or can't seek
+*/
+int decodeRange(FILE* in, FILE* out, struct DecodeOptions* options)
+{
+  unsigned long blockSize = readU32(in);
+  unsigned char magic[4];
+  uint64_t numBlocks, indexOffset, blockRaw, blockFile;
+  long fileSize;
+
+  if(fseek(in, 0, SEEK_END) != 0 || (fileSize = ftell(in)) < 8 + 1 + 8 + 12)
+  {
+    fprintf(stderr, "Ranges need the whole file, it can't be a pipe!\n");
+    return 0;
+  }
+
+  /* the last 12 bytes say where the index starts */
+  fseek(in, fileSize - 12, SEEK_SET);
+  indexOffset = readU64(in);
+  if(fread(magic, 1, 4, in) != 4 || memcmp(magic, INDEX_MAGIC, 4) != 0 ||
+     indexOffset < 9 || indexOffset > (uint64_t)fileSize - 8 - 12)
+  {
+    fprintf(stderr, "Invalid or missing block index!\n");
+    return 0;
+  }
+
+  fseek(in, (long)indexOffset, SEEK_SET);
+  numBlocks = readU64(in);
+  if(numBlocks != ((uint64_t)fileSize - 8 - 12 - indexOffset) / 16 ||
+     ((uint64_t)fileSize - 8 - 12 - indexOffset) % 16 != 0)
+  {
+    fprintf(stderr, "Invalid or missing block index!\n");
+    return 0;
+  }
+  if(numBlocks == 0) return 1;
+
+  if(!findBlock(in, (long)indexOffset, numBlocks, options->rangeStart, &blockRaw, &blockFile) ||
+     blockFile < 8 || blockFile >= indexOffset || fseek(in, (long)blockFile, SEEK_SET) != 0)
+  {
+    fprintf(stderr, "Invalid or missing block index!\n");
+    return 0;
+  }
+
+  return decodeBlocks(in, out, options, blockSize, options->rangeStart - blockRaw,
+                      options->rangeLength);
+}
+
+/*
+ * Finds the last block in the index starting at or before a decoded byte,
+ * reading only the entries a binary search looks at.
+ 
+ * FILE* in - file holding the index
+ * long indexOffset - where the index starts, at its count of blocks
+ * uint64_t numBlocks - entries in the index, at least 1
+ * uint64_t rawOffset - decoded byte to find the block of
+ * uint64_t* blockRaw - filled with where the block starts once decoded
+ * uint64_t* blockFile - filled with where the block starts in the file
+ 
+ * returns int - 1 if the block was found, 0 if the index is out of order
+*/
+int findBlock(FILE* in, long indexOffset, uint64_t numBlocks, uint64_t rawOffset,
+              uint64_t* blockRaw, uint64_t* blockFile)
+{
+  uint64_t low = 0, high = numBlocks - 1;
+
+  while(low < high)
+  {
+    uint64_t middle = low + (high - low + 1) / 2;
+    fseek(in, indexOffset + 8 + (long)(16 * middle), SEEK_SET);
+    if(readU64(in) <= rawOffset) low = middle;
+    else high = middle - 1;
+  }
+
+  fseek(in, indexOffset + 8 + (long)(16 * low), SEEK_SET);
+  *blockRaw = readU64(in);
+  *blockFile = readU64(in);
+  return *blockRaw <= rawOffset;
+}
+
+/*
+ * Reads a range given as "offset:length" on the command line
+ 
+ * const char* text - range to read
+ * uint64_t* start - filled with the offset
+ * uint64_t* length - filled with the length
+ 
+ * returns int - 1 if the range was valid, 0 if not
+*/
+int parseRange(const char* text, uint64_t* start, uint64_t* length)
+{
+  if(!parseU64(&text, start) || *text != ':') return 0;
+  text++;
+  return parseU64(&text, length) && *text == '\0';
+}
+
+/*
+ * Reads a decimal number, moving the text past its digits
+ 
+ * const char** text - where the number starts
+ * uint64_t* value - filled with the number
+ 
+ * returns int - 1 if there were digits and the number fits, 0 if not
+*/
+int parseU64(const char** text, uint64_t* value)
+{
+  const char* digit = *text;
+  *value = 0;
+
+  for(; *digit >= '0' && *digit <= '9'; digit++)
+  {
+    if(*value > ((uint64_t)-1 - (uint64_t)(*digit - '0')) / 10) return 0;
+    *value = *value * 10 + (uint64_t)(*digit - '0');
+  }
+  if(digit == *text) return 0;
+  *text = digit;
+  return 1;
+}
+
+/*
+ * Reads a 32 bit value stored as 4 bytes, least significant byte first
+ 
+ * FILE* in - file to read from
+ 
+ * returns unsigned long - value read
+*/
+unsigned long readU32(FILE* in)
+{
+  unsigned long value = 0;
+  int i;
+  for(i = 0; i < 4; i++) value |= (unsigned long)(fgetc(in) & 0xFF) << (8*i);
+  return value;
+}
+
+/*
+ * Reads a 64 bit value stored as 8 bytes, least significant byte first
+ 
+ * FILE* in - file to read from
+ 
+ * returns uint64_t - value read
+*/
+uint64_t readU64(FILE* in)
+{
+  uint64_t value = 0;
+  int i;
+  for(i = 0; i < 8; i++) value |= (uint64_t)(fgetc(in) & 0xFF) << (8*i);
+  return value;
+}
+
+/*
+ * Finds how long a file is, leaving it positioned at its end
+ 
+ * FILE* file - file to measure, flushed first if it was written to
+ 
+ * returns uint64_t - length of the file, 0 if it can't seek like a pipe
+*/
+uint64_t fileLength(FILE* file)
+{
+  long end;
+  fflush(file);
+  if(fseek(file, 0, SEEK_END) != 0 || (end = ftell(file)) < 0) return 0;
+  return (uint64_t)end;
 }
 
 /*
@@ -84,68 +878,86 @@ void decodeFile(FILE* in, FILE* out)
 struct SymbolNode* readHeader(FILE* in, int numSymbols, struct SymbolNode* root)
 {
   unsigned char symbol, codeLength; 
-  int i, j, numBytes;
-  struct SymbolNode* newNode;
   if(numSymbols == 0) return root;
   
   /* Reading in information about next code */
   symbol = fgetc(in); 
   codeLength = fgetc(in);
-  numBytes = (codeLength % 8) ? codeLength/8 + 1: codeLength/8;
+  
+  root = readCode(in, symbol, codeLength, root);
+  return readHeader(in, numSymbols-1, root); 
+}
+
+/*
+ * Reads in the bytes holding the code of a symbol, after the symbol 
+ * and the code length have already been read, and places a new node 
+ * for the symbol into the tree.
+ 
+ * FILE* in - file to read header from 
+ * unsigned char symbol - symbol the code belongs to 
+ * unsigned char codeLength - how many bits long the code is
+ * struct SymbolNode* root - root of the tree so far, NULL to start one
+ 
+ * returns SymbolNode* - root of the tree with the new node in it
+*/
+struct SymbolNode* readCode(FILE* in, unsigned char symbol, unsigned char codeLength,
+                            struct SymbolNode* root)
+{
+  unsigned char code[32]; /* codes are stored 8 bits per byte */
+  int numBytes = (codeLength % 8) ? codeLength/8 + 1: codeLength/8;
+  int i;
+  struct SymbolNode* newNode;
   
   newNode = makeSymbol(0, symbol); 
   newNode->length = codeLength;
+  for(i = 0; i < numBytes; i++) code[i] = fgetc(in);
   
-  /* Filling in Code*/
-  for(i = 0; i < numBytes; i++)
-  {
-    unsigned char currByte = fgetc(in);
-    for(j = 0; j < 8; j++)
-    {
-      int currBit = ((1 << (7-j)) & currByte) != 0;
-      newNode->code[i*8+j] = currBit; 
-    }
-  }
-  
-  root = insertTree(root, newNode, 0);
-  return readHeader(in, numSymbols-1, root); 
+  return insertTree(root, newNode, code, 0);
 }
 
 /* 
  * Decodes the input file and writes decoded characters to the output
- * file. Takes a completed huffman tree and how many chars to decode.
+ * file. Takes the lookup table built from the huffman tree and how many 
+ * chars to decode. The input is read through a mapping when it can be
+ * and since numChars is known, the output is mapped at its full size when 
+ * possible, so the table lookups work straight from one to the other.
+ * Otherwise chars are decoded into a buffer and written a chunk at a time.
+ * Both are done a window at a time for large files, so memory stays the
+ * same whatever numChars is.
  
  * FILE* in - file to decode/read from
  * FILE* out - file to write decoded characters to 
- * int numChars- how many characters to decode
- * struct SymbolNode* root - root of huffman tree
+ * uint64_t numChars- how many characters to decode
+ * struct DecodeTable* table - lookup table for the huffman codes
+ 
+ * returns int - 1 if every character was decoded
+ *               0 if a code isn't in the table or the bits run out
 */
-void decodeChars(FILE* in, FILE* out, int numChars, struct SymbolNode* root)
+int decodeChars(FILE* in, FILE* out, uint64_t numChars, struct DecodeTable* table)
 {
-  unsigned char currByte;
-  int currBit;
-  struct SymbolNode* currNode = root;
-  int byteLength = 0;
+  struct InputFile input;
+  struct OutputFile output;
+  struct BitReader reader;
+  uint64_t left = numChars;
+  int decoded = 1;
 
-  while(numChars != 0)
-  {
-    if(byteLength == 0) 
-    {
-    currByte = fgetc(in);   
-    byteLength = 8;
-    }
+  openInput(&input, in);
+  openOutput(&output, out, left);
+  initBitReader(&reader, &input);
 
-    /* Getting current byte of code and moving in the tree */ 
-    currBit = (currByte & (1 << (byteLength-1))) != 0;
-    if(currBit == 1) currNode = currNode->right; 
-    else currNode = currNode->left;
+  while(left > 0 && decoded)
+  {
+    unsigned long count = output.capacity - output.used;
+    if(count > left) count = (unsigned long)left;
 
-    if(isLeaf(currNode))
-    {
-      fputc(currNode->symbol, out); 
-      currNode = root; 
-      numChars--;
-    }
-    byteLength--;
+    decoded = decodeSymbols(table, &reader, output.data + output.used, count);
+    output.used += count;
+    left -= count;
+    if(output.used == output.capacity) flushOutput(&output);
   }
+
+  closeOutput(&output);
+  closeInput(&input);
+  if(!decoded) fprintf(stderr, "Invalid or truncated encoded data!\n");
+  return decoded;
 }
@@ -4,79 +4,390 @@
  * the huffman tree algorithm, also prints information about codes.
  * To use it, compile the program and as arguments place input/output 
  * files in the following format: 
- * ./huffencode inputFile outputFile 
+ * ./huffencode [-l | -c | -a] [-p | -q] [-o] [--stats=json] [-t threads] [-B blockSize] 
+ *              [-S streams] [-L maxLength] inputFile outputFile 
+ * ./huffencode [-t threads] [-L maxLength] --batch outputDir inputs...
+ * ./huffencode [-L maxLength] --train dictFile corpus...
+ * ./huffencode --dict dictFile inputFile outputFile
+ * By default the file is split into blocks that are encoded on several
+ * threads, each with its own canonical code. -l writes the legacy format 
+ * with full codes in the header, and -c a single canonical code for the 
+ * whole file with a header of only code lengths. -a writes an adaptive 
+ * code that changes as the file is read, with no header at all. -L limits
+ * how long codes may get, at a small cost in size, so that they decode 
+ * with fewer table lookups. -S splits the bits of every block into 
+ * several streams that the decoder works through side by side. -o lets
+ * blocks code each byte with a code picked by the byte before it, which
+ * they do wherever that comes out smaller. -p prints
+ * the table of codes, which -q leaves out again, and --stats=json writes
+ * how long each phase took and how good the codes were to standard error.
+ * --batch encodes every input file, directory or list of names given on
+ * standard input as "-" into outputDir, several files at a time.
+ * --train builds a dictionary, a code for files like the corpus, and 
+ * --dict encodes with it without counting, leaving the code out of the 
+ * header, which suits small files.
+ * Either file may be "-" 
+ * for standard input/output, the block format reads its input only once 
+ * so it works on pipes, and -c reads a pipe into memory first.
 */
 #include <stdio.h> 
 #include <stdlib.h> 
+#include <string.h>
+#include <stdint.h>
 #include "huffman.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 /* Codes for file related errors */
 #define ARG_ERR 1
 #define IN_FILE_ERR 2
 #define OUT_FILE_ERR 3
+#define ENCODE_ERR 4
 
-unsigned long *countSymbols(FILE* inFile, unsigned long *totalSymbols);
+/* Everything the stages of encodeBlocks share, each batch of blocks
+ * having a slot of batchSize blocks */
+struct BlockEncoder
+{
+  FILE* in;
+  FILE* out;
+  struct EncodeOptions* options;
+  struct ThreadPool* pool;
+  struct Block* blocks; /* PIPELINE_DEPTH slots of batchSize blocks */
+  unsigned long batchSize; /* blocks in a slot */
+  unsigned long counts[PIPELINE_DEPTH]; /* blocks read into each slot */
+  int inputEnded; /* set by the read stage at the end of the file */
+  int encoded; /* cleared by the write stage if a block failed */
+  uint64_t* index; /* raw offset and file offset of each block */
+  unsigned long numBlocks, indexCapacity;
+  uint64_t rawOffset, fileOffset;
+  uint64_t totalBits, extraBits; /* for the cost of the length limit */
+  unsigned long symbolCount[256]; /* counts over the whole file */
+};
+
+unsigned long *countSymbols(struct InputFile* input, uint64_t *totalSymbols, int numThreads);
 void writeHeader(FILE* out, struct SymbolNode **codes);
 void writeCode(FILE* out, struct SymbolNode *symbol);
-void writeSymbols(FILE* in, FILE* out, struct SymbolNode **codes, unsigned long totalSymbols);
+void writeSymbols(struct InputFile* input, FILE* out, struct CodeTable *table,
+                  uint64_t totalSymbols);
+uint64_t limitCodes(struct SymbolNode **codes, int maxLength);
+void printLimitCost(int maxLength, uint64_t bits, uint64_t extraBits);
+void writeU64(FILE* out, uint64_t value);
+void writeU32(FILE* out, unsigned long value);
+void defaultEncodeOptions(struct EncodeOptions* options);
+FILE* openFile(const char* name, const char* mode);
+int isSeekable(FILE* file);
+FILE* spoolInput(FILE* in);
+unsigned long parseSize(const char* text);
+int encodeBlocks(FILE* in, FILE* out, struct EncodeOptions* options);
+int encodeAdaptiveFile(FILE* in, FILE* out, struct EncodeOptions* options);
+int encodeCanonicalFile(FILE* in, FILE* out, struct EncodeOptions* options);
+int encodeDictFile(FILE* in, FILE* out, struct EncodeOptions* options);
+int trainFiles(const char* dictName, char** inputs, int numInputs, int maxLength);
+void encodeBlockTask(void* context, unsigned long index);
+int readEncodeBatch(void* context, int slot);
+int encodeBatch(void* context, int slot);
+int writeEncodeBatch(void* context, int slot);
 
 int main(int argc, char *argv[])
 {
   FILE* inFile; 
   FILE* outFile; 
+  struct EncodeOptions options;
+  struct CodecStats stats;
+  struct Dictionary dictionary;
+  FILE* dictFile;
+  int argi = 1;
+  int batch = 0;
+  int train = 0;
+  int encoded;
+  double start = wallClock();
+  long end;
+
+  defaultEncodeOptions(&options);
+
+  /* reading any flags before the file names, a lone "-" is a file name */
+  while(argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0')
+  {
+    if(strcmp(argv[argi], "-l") == 0) options.format = FORMAT_LEGACY;
+    else if(strcmp(argv[argi], "-c") == 0) options.format = FORMAT_CANONICAL;
+    else if(strcmp(argv[argi], "-a") == 0) options.format = FORMAT_ADAPTIVE;
+    else if(strcmp(argv[argi], "-p") == 0) options.printTable = 1;
+    else if(strcmp(argv[argi], "-q") == 0) options.printTable = 0;
+    else if(strcmp(argv[argi], "-o") == 0) options.order = 1;
+    else if(strcmp(argv[argi], "--stats=json") == 0) options.stats = &stats;
+    else if(strcmp(argv[argi], "--batch") == 0) batch = 1;
+    else if(strcmp(argv[argi], "--train") == 0) train = 1;
+    else if(strcmp(argv[argi], "--dict") == 0 && argi + 1 < argc)
+    {
+      dictFile = fopen(argv[++argi], "rb");
+      if(dictFile == NULL || !loadDictionary(&dictionary, dictFile))
+      {
+        fprintf(stderr, "Invalid Dictionary %s!\n", argv[argi]);
+        return ARG_ERR;
+      }
+      fclose(dictFile);
+      options.format = FORMAT_DICT;
+      options.dictionary = &dictionary;
+    }
+    else if(strcmp(argv[argi], "-t") == 0 && argi + 1 < argc)
+    {
+      options.numThreads = (int)parseSize(argv[++argi]);
+      if(options.numThreads < 1)
+      {
+        fprintf(stderr, "Invalid Thread Count %s!\n", argv[argi]);
+        return ARG_ERR;
+      }
+    }
+    else if(strcmp(argv[argi], "-B") == 0 && argi + 1 < argc)
+    {
+      options.blockSize = parseSize(argv[++argi]);
+      if(options.blockSize < 1 || options.blockSize > MAX_BLOCK_SIZE)
+      {
+        fprintf(stderr, "Invalid Block Size %s!\n", argv[argi]);
+        return ARG_ERR;
+      }
+    }
+    else if(strcmp(argv[argi], "-S") == 0 && argi + 1 < argc)
+    {
+      options.numStreams = (int)parseSize(argv[++argi]);
+      if(options.numStreams < 1 || options.numStreams > MAX_STREAMS)
+      {
+        fprintf(stderr, "Invalid Stream Count %s, must be 1 to %d!\n", argv[argi], MAX_STREAMS);
+        return ARG_ERR;
+      }
+    }
+    else if(strcmp(argv[argi], "-L") == 0 && argi + 1 < argc)
+    {
+      options.maxLength = (int)parseSize(argv[++argi]);
+      if(options.maxLength < MIN_LENGTH_LIMIT || options.maxLength > MAX_CODE_LENGTH)
+      {
+        fprintf(stderr, "Invalid Code Length Limit %s, must be %d to %d!\n", 
+                argv[argi], MIN_LENGTH_LIMIT, MAX_CODE_LENGTH);
+        return ARG_ERR;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Unknown Option %s!\n", argv[argi]);
+      return ARG_ERR;
+    }
+    argi++;
+  }
+
+  /* training takes the dictionary to write and then the corpus */
+  if(train)
+  {
+    if(argc - argi < 2)
+    {
+      fprintf(stderr, "Command Line Argument Mismatch!\n");
+      return ARG_ERR;
+    }
+    return trainFiles(argv[argi], argv + argi + 1, argc - argi - 1, options.maxLength) ? 0 : ENCODE_ERR;
+  }
+
+  /* a batch takes the output directory and then any number of inputs */
+  if(batch)
+  {
+    if(argc - argi < 2)
+    {
+      fprintf(stderr, "Command Line Argument Mismatch!\n");
+      return ARG_ERR;
+    }
+    if(options.format == FORMAT_LEGACY || options.format == FORMAT_ADAPTIVE ||
+       options.format == FORMAT_DICT)
+    {
+      fprintf(stderr, "Batches are written in the canonical format, -l, -a and --dict can't be used!\n");
+      return ARG_ERR;
+    }
+    return runBatch(1, argv[argi], argv + argi + 1, argc - argi - 1, options.numThreads,
+                    options.maxLength) ? 0 : ENCODE_ERR;
+  }
 
   /* ensuring validity of command-line inputs */
-  if(argc != 3)
+  if(argc - argi != 2)
   {
     fprintf(stderr, "Command Line Argument Mismatch!\n");
     return ARG_ERR; 
   }
   
-  inFile = fopen(argv[1], "rb");
-  outFile = fopen(argv[2], "wb"); 
+  inFile = openFile(argv[argi], "rb");
+  outFile = openFile(argv[argi+1], "wb"); 
 
   /* making sure files can be opened */
   if(inFile == NULL)
   {
-    fprintf(stderr, "Error Opening Input File %s!\n", argv[1]); 
+    fprintf(stderr, "Error Opening Input File %s!\n", argv[argi]); 
     return IN_FILE_ERR; 
   }
   else if(outFile == NULL)
   {
-    fprintf(stderr, "Error Opening Output File %s!\n", argv[2]);
+    fprintf(stderr, "Error Opening Output File %s!\n", argv[argi+1]);
     return OUT_FILE_ERR;
   }
 
-  encodeFile(inFile, outFile); 
-  fclose(inFile);
-  fclose(outFile);
-  return 0;
+  /* the table would end up mixed in with the encoded data */
+  if(outFile == stdout) options.printTable = 0;
+
+  if(options.stats != NULL) resetStats(options.stats);
+  encoded = encodeFileOptions(inFile, outFile, &options); 
+  fflush(outFile);
+
+  /* sizes the formats don't work out themselves come from the file */
+  if(options.stats != NULL)
+  {
+    stats.totalSeconds = wallClock() - start;
+    stats.format = options.format;
+    stats.inputBytes = stats.symbols;
+    if(stats.outputBytes == 0 && (end = ftell(outFile)) > 0) stats.outputBytes = (uint64_t)end;
+    writeStatsJson(stderr, "huffencode", &stats);
+  }
+
+  if(inFile != stdin) fclose(inFile);
+  if(outFile != stdout) fclose(outFile);
+  return encoded ? 0 : ENCODE_ERR;
+}
+
+/*
+ * Opens a file for the command line, "-" meaning standard input or
+ * output depending on the mode, which gets switched to binary where
+ * that makes a difference.
+ 
+ * const char* name - file name as typed
+ * const char* mode - "rb" or "wb"
+ 
+ * returns FILE* - opened file, NULL if it couldn't be opened
+*/
+FILE* openFile(const char* name, const char* mode)
+{
+  FILE* file;
+  if(strcmp(name, "-") != 0) return fopen(name, mode);
+
+  file = (mode[0] == 'r') ? stdin : stdout;
+#ifdef _WIN32
+  _setmode(_fileno(file), _O_BINARY);
+#endif
+  return file;
+}
+
+/*
+ * Tells whether a file can be read a second time from the start, 
+ * which pipes and terminals can't be.
+ 
+ * FILE* file - file to check
+ 
+ * returns int - 1 if the file can seek, 0 if not
+*/
+int isSeekable(FILE* file)
+{
+  return fseek(file, 0, SEEK_CUR) == 0;
+}
+
+/*
+ * Copies the rest of a file that can only be read once, like a pipe,
+ * into a temporary file a chunk at a time, so it can be read twice.
+ 
+ * FILE* in - file to copy
+ 
+ * returns FILE* - temporary file at its start, removed when closed
+ *                 NULL if it couldn't be made or written
+*/
+FILE* spoolInput(FILE* in)
+{
+  FILE* spool = tmpfile();
+  unsigned char* buffer;
+  unsigned long got;
+  int copied = 1;
+
+  if(spool == NULL) return NULL;
+  buffer = (unsigned char*)malloc(INPUT_CHUNK_BYTES);
+  while(copied && (got = fread(buffer, 1, INPUT_CHUNK_BYTES, in)) > 0)
+  {
+    copied = fwrite(buffer, 1, got, spool) == got;
+  }
+  free(buffer);
+
+  if(!copied || fseek(spool, 0, SEEK_SET) != 0)
+  {
+    fclose(spool);
+    return NULL;
+  }
+  return spool;
+}
+
+/*
+ * Fills in the settings used when none are given: the block format with
+ * one thread per processor, without the table or stats.
+ 
+ * struct EncodeOptions* options - settings to fill in
+*/
+void defaultEncodeOptions(struct EncodeOptions* options)
+{
+  options->format = FORMAT_BLOCKS;
+  options->blockSize = DEFAULT_BLOCK_SIZE;
+  options->numThreads = countProcessors();
+  options->printTable = 0;
+  options->maxLength = 0;
+  options->numStreams = 1;
+  options->order = 0;
+  options->dictionary = NULL;
+  options->stats = NULL;
+}
+
+/*
+ * Reads a size from the command line, which may end in k or m 
+ * for kilobytes or megabytes.
+ 
+ * const char* text - size as typed
+ 
+ * returns unsigned long - size in bytes, 0 if it isn't a number
+*/
+unsigned long parseSize(const char* text)
+{
+  char* end;
+  unsigned long size = strtoul(text, &end, 10);
+  
+  if(end == text) return 0;
+  if(*end == 'k' || *end == 'K') 
+  {
+    size *= 1024;
+    end++;
+  }
+  else if(*end == 'm' || *end == 'M') 
+  {
+    size *= 1024*1024;
+    end++;
+  }
+  return (*end == '\0') ? size : 0;
 }
 
 /* 
  * Count the occurence of symbols in a given file.
  
- * FILE* inFile - file to read from 
- * unsigned long *totalSymbols - pointer to an unsigned long that wiill hold the 
+ * struct InputFile* input - file to read from, a span at a time
+ * uint64_t *totalSymbols - pointer to a uint64_t that wiill hold the 
  * total number of characters seen in the file
+ * int numThreads - threads to count a mapped file with
 
  * returns an array of unsigned long, where index i
  * represents the occurences of the character with 
  * ascii value i inside of the file.
 */
-unsigned long *countSymbols(FILE* inFile, unsigned long *totalSymbols)
+unsigned long *countSymbols(struct InputFile* input, uint64_t *totalSymbols, int numThreads)
 {
-  int currChar; 
+  const unsigned char* span;
+  unsigned long length;
   int i;
   unsigned long *symbolCount = (unsigned long*)malloc(sizeof(unsigned long) * 256);
   
   for(i = 0; i < 256; i++) symbolCount[i] = 0;
   *totalSymbols = 0;
 
-  while((currChar = getc(inFile)) != EOF)
+  while((length = nextSpan(input, &span)) > 0)
   {
-    symbolCount[currChar]++; 
-    *totalSymbols += 1;
+    countBytesParallel(span, length, symbolCount, numThreads); 
+    *totalSymbols += length;
   }
   
   return symbolCount; 
@@ -93,7 +404,7 @@ unsigned long *countSymbols(FILE* inFile, unsigned long *totalSymbols)
 */
 void writeHeader(FILE* out, struct SymbolNode **codes)
 {
-  unsigned long numChars = 0; 
+  uint64_t numChars = 0; 
   unsigned char numSymbols = 0;
   unsigned int i;
   
@@ -118,7 +429,7 @@ void writeHeader(FILE* out, struct SymbolNode **codes)
       writeCode(out, codes[i]);
     }
   }
-  fwrite(&numChars, sizeof(unsigned long), 1, out); 
+  writeU64(out, numChars); /* 8 bytes, least significant first */
 }
 
 /*
@@ -142,70 +453,127 @@ void writeCode(FILE* out, struct SymbolNode *symbol)
   for(i = 0; i < numBytes; i++)
   {
     unsigned char currByte = 0;
-    /* put the code into a single byte */
-    for(j = 0; j < 7; j++)
+    /* put the next 8 bits of the code into a single byte, 
+     * padding the end of the code with zeroes */
+    for(j = 0; j < 8; j++)
     {
-      currByte |= symbol->code[i*8+j];
+      int bit = i*8 + j;
       currByte <<= 1;
+      if(bit < symbol->length) currByte |= (symbol->code >> (symbol->length-1-bit)) & 1;
     } 
-    currByte |= symbol->code[i*8+j];
     fputc(currByte, out);
   }
 }
 
 /*
  * Writes to the output file the encoded version of each symbol
- * from the input file.
+ * from the input file, a whole code at a time.
  
- * FILE* in - input file 
+ * struct InputFile* input - input file, read a span at a time
  * FILE* out - output file
- * struct SymbolNode **codes - array of the symbol nodes storing the codes, 
- * with the ith index being the symbol with ASCII value 'i'
- * unsigned long totalSymbols - how many total symbols are in the input file
+ * struct CodeTable *table - code and code length of every symbol
+ * uint64_t totalSymbols - how many total symbols are in the input file
 */
-void writeSymbols(FILE* in, FILE* out, struct SymbolNode **codes, unsigned long totalSymbols)
+void writeSymbols(struct InputFile* input, FILE* out, struct CodeTable *table,
+                  uint64_t totalSymbols)
 {
-  unsigned int byteLength = 8; 
-  unsigned int currCodeLength = 0;
-  struct SymbolNode *currNode = NULL; /* current symbol we are encoding */
-  unsigned char currByte = 0; /* current byte we are encoding */
-  int flag_last_loop = 0; /* used to ensure we finish placing the byte*/
+  struct BitWriter writer;
+  const unsigned char* span;
+  unsigned long length;
+  initBitWriter(&writer, out);
 
-  /* keep reading symbols while there are symbols to read */
-  while(1)
+  /* keep reading spans while there are symbols to read, the file may 
+   * have changed size since it was counted */
+  while(totalSymbols > 0 && (length = nextSpan(input, &span)) > 0)
   {
-    /* if we have fully filled a byte, write it start writing to next byte */
-    if(byteLength == 0)
-    {
-      fputc(currByte, out);
-      currByte = 0;
-      byteLength = 8;
-    }
-    /* if we have fully encoded a symbol, get the next symbol */ 
-    if(currCodeLength == 0)
-    {
-      unsigned char nextChar = fgetc(in);
-      totalSymbols--;
-      if(flag_last_loop) break; /* once finished w/ last byte, break*/
-      if(totalSymbols == 0) flag_last_loop = 1; /* still need to finish currByte */
-      currNode = codes[nextChar]; 
-      currCodeLength = currNode->length; 
-    }
-    
-    /* shift the bits over, place the next bit of the code into byte*/
-    currByte <<= 1;
-    currByte |= currNode->code[currNode->length-currCodeLength];
-    currCodeLength--;
-    byteLength--;
+    if(length > totalSymbols) length = totalSymbols;
+    writeCodes(&writer, table, span, length, 1);
+    totalSymbols -= length;
   }
   
-  /* if there is still a byte to place, pad the zeroes and place it */
-  if(byteLength != 0 && byteLength != 8) 
+  /* place what is left, padding the last byte with zeroes */
+  flushBits(&writer);
+}
+
+/*
+ * Shortens any codes longer than maxLength, replacing every code with a
+ * canonical code for the best lengths within the limit. The codes stay
+ * prefix free, so they can still be written in the legacy format.
+ 
+ * struct SymbolNode **codes - array of symbol nodes from generateCodes, ith
+ * index is the node representing symbol w/ASCII value i, NULL if the symbol
+ * doesn't appear.
+ * int maxLength - longest code allowed
+ 
+ * returns uint64_t - how many more bits the file takes with the limit
+*/
+uint64_t limitCodes(struct SymbolNode **codes, int maxLength)
+{
+  unsigned long freq[256];
+  unsigned char lengths[256];
+  uint64_t canonical[256];
+  uint64_t unlimitedBits = 0, limitedBits = 0;
+  int i, longest = 0;
+
+  for(i = 0; i < 256; i++)
   {
-    int i;
-    for(i = 0; i < byteLength; i++) currByte <<= 1;
-    fputc(currByte, out);
+    freq[i] = (codes[i] == NULL) ? 0 : codes[i]->freq;
+    if(codes[i] != NULL && (int)codes[i]->length > longest) longest = codes[i]->length;
+  }
+  /* codes is the start of the arena generateCodes made */
+  if(longest <= maxLength ||
+     !limitCodeLengths((struct CodeArena*)codes, freq, lengths, maxLength)) return 0;
+
+  canonicalCodes(lengths, canonical);
+  for(i = 0; i < 256; i++)
+  {
+    if(codes[i] == NULL) continue;
+    unlimitedBits += (uint64_t)freq[i] * codes[i]->length;
+    limitedBits += (uint64_t)freq[i] * lengths[i];
+    codes[i]->length = lengths[i];
+    codes[i]->code = canonical[i];
   }
+  return limitedBits - unlimitedBits;
+}
+
+/*
+ * Prints how much a code length limit cost, as bits and as a percentage 
+ * of what the encoded bits would have been without it.
+ 
+ * int maxLength - the limit
+ * uint64_t bits - encoded bits with the limit
+ * uint64_t extraBits - of those, how many are due to the limit
+*/
+void printLimitCost(int maxLength, uint64_t bits, uint64_t extraBits)
+{
+  double unlimited = (double)(bits - extraBits);
+  printf("Code length limit = %d, costs %lu bits (+%.4f%%)\n", maxLength, 
+         (unsigned long)extraBits, unlimited > 0 ? 100.0 * (double)extraBits / unlimited : 0.0);
+}
+
+/*
+ * Writes a 32 bit value as 4 bytes, least significant byte first
+ 
+ * FILE* out - file to write to
+ * unsigned long value - value to write, below 2^32
+*/
+void writeU32(FILE* out, unsigned long value)
+{
+  int i;
+  for(i = 0; i < 4; i++) fputc((int)((value >> (8*i)) & 0xFF), out);
+}
+
+/*
+ * Writes a 64 bit value as 8 bytes, least significant byte first, 
+ * so the file reads the same on any machine.
+ 
+ * FILE* out - file to write to
+ * uint64_t value - value to write
+*/
+void writeU64(FILE* out, uint64_t value)
+{
+  int i;
+  for(i = 0; i < 8; i++) fputc((int)((value >> (8*i)) & 0xFF), out);
 }
 
 /**************************************************************/
@@ -216,39 +584,612 @@ void writeSymbols(FILE* in, FILE* out, struct SymbolNode **codes, unsigned long
 /* out -- File where encoded data will be written.            */
 /**************************************************************/
 void encodeFile(FILE* in, FILE* out) 
+{
+  struct EncodeOptions options;
+  defaultEncodeOptions(&options);
+  options.printTable = 1;
+  encodeFileOptions(in, out, &options);
+}
+
+/*
+ * Task for the thread pool, encodes one block of a batch
+ 
+ * void* context - array of blocks in the batch
+ * unsigned long index - which block to encode
+*/
+void encodeBlockTask(void* context, unsigned long index)
+{
+  encodeBlock((struct Block*)context + index);
+}
+
+/*
+ * Reads the next batch of blocks of a file being encoded, the read stage
+ * of encodeBlocks. A short read means the end of the file.
+ 
+ * void* context - the BlockEncoder
+ * int slot - which slot's blocks to read into
+ 
+ * returns int - 1 if any blocks were read, 0 at the end of the file
+*/
+int readEncodeBatch(void* context, int slot)
+{
+  struct BlockEncoder* encoder = (struct BlockEncoder*)context;
+  struct Block* blocks = encoder->blocks + (unsigned long)slot * encoder->batchSize;
+  unsigned long count = 0;
+
+  while(!encoder->inputEnded && count < encoder->batchSize)
+  {
+    unsigned long got = fread(blocks[count].raw, 1, encoder->options->blockSize, encoder->in);
+    blocks[count].rawLength = got;
+    if(got > 0) count++;
+    if(got < encoder->options->blockSize) encoder->inputEnded = 1;
+  }
+  encoder->counts[slot] = count;
+  return count > 0;
+}
+
+/*
+ * Encodes a batch of blocks on the thread pool, the code stage of
+ * encodeBlocks
+ 
+ * void* context - the BlockEncoder
+ * int slot - which slot's blocks to encode
+ 
+ * returns int - always 1
+*/
+int encodeBatch(void* context, int slot)
+{
+  struct BlockEncoder* encoder = (struct BlockEncoder*)context;
+  runTasks(encoder->pool, encodeBlockTask,
+           encoder->blocks + (unsigned long)slot * encoder->batchSize, encoder->counts[slot]);
+  return 1;
+}
+
+/*
+ * Writes out an encoded batch of blocks in order, each part a block was
+ * split into as a block of its own, and notes where each one went for
+ * the index, the write stage of encodeBlocks
+ 
+ * void* context - the BlockEncoder
+ * int slot - which slot's blocks to write
+ 
+ * returns int - 1 if written, 0 if a block failed to encode
+*/
+int writeEncodeBatch(void* context, int slot)
+{
+  struct BlockEncoder* encoder = (struct BlockEncoder*)context;
+  struct Block* blocks = encoder->blocks + (unsigned long)slot * encoder->batchSize;
+  FILE* out = encoder->out;
+  unsigned long b, packedUsed;
+  int i, p;
+
+  for(b = 0; b < encoder->counts[slot]; b++)
+  {
+    struct Block* block = &blocks[b];
+    if(block->failed)
+    {
+      fprintf(stderr, "Error Encoding Block %lu!\n", encoder->numBlocks);
+      encoder->encoded = 0;
+      return 0;
+    }
+
+    for(p = 0, packedUsed = 0; p < block->numParts; p++)
+    {
+      struct BlockPart* part = &block->parts[p];
+      if(encoder->numBlocks == encoder->indexCapacity)
+      {
+        encoder->indexCapacity = encoder->indexCapacity ? encoder->indexCapacity * 2 : 64;
+        encoder->index = (uint64_t*)realloc(encoder->index,
+                                            sizeof(uint64_t) * 2 * encoder->indexCapacity);
+      }
+      encoder->index[2*encoder->numBlocks] = encoder->rawOffset;
+      encoder->index[2*encoder->numBlocks+1] = encoder->fileOffset;
+      encoder->numBlocks++;
+
+      fputc(part->kind, out);
+      writeU32(out, part->rawLength);
+      writeU32(out, part->packedLength);
+      fwrite(block->packed + packedUsed, 1, part->packedLength, out);
+      packedUsed += part->packedLength;
+      encoder->rawOffset += part->rawLength;
+      encoder->fileOffset += 9 + part->packedLength;
+    }
+    encoder->totalBits += block->bits;
+    encoder->extraBits += block->extraBits;
+    for(i = 0; i < 256; i++) encoder->symbolCount[i] += block->freq[i];
+  }
+
+  /* each batch of blocks decodes on its own, so readers on the other
+   * end of a pipe can start on it right away */
+  fflush(out);
+  return 1;
+}
+
+/*
+ * Encodes a file as a series of blocks, each with its own canonical code.
+ * Blocks are read in batches of a few per thread and go through a
+ * pipeline: while one batch is encoded by the thread pool, the next is
+ * being read and the one before written out in order. Only
+ * PIPELINE_DEPTH batches are ever held in memory no matter how long the
+ * input is. The input is read once from start to end, so it may be a
+ * pipe. The index of where every block starts gets written after the
+ * last block.
+ 
+ * FILE* in - file to encode
+ * FILE* out - file to write the blocks to
+ * struct EncodeOptions* options - block size and number of threads
+ 
+ * returns int - 1 if every block was encoded, 0 if not
+*/
+int encodeBlocks(FILE* in, FILE* out, struct EncodeOptions* options)
+{
+  struct BlockEncoder encoder;
+  unsigned long numSlots = (unsigned long)options->numThreads * BLOCKS_PER_THREAD * PIPELINE_DEPTH;
+  struct CodecStats* slotStats = NULL; /* each slot times its own phases */
+  int i;
+  unsigned long b;
+
+  encoder.in = in;
+  encoder.out = out;
+  encoder.options = options;
+  encoder.pool = createThreadPool(options->numThreads);
+  encoder.batchSize = (unsigned long)options->numThreads * BLOCKS_PER_THREAD;
+  encoder.blocks = (struct Block*)calloc(numSlots, sizeof(struct Block));
+  encoder.inputEnded = 0;
+  encoder.encoded = 1;
+  encoder.index = NULL;
+  encoder.numBlocks = 0;
+  encoder.indexCapacity = 0;
+  encoder.rawOffset = 0;
+  encoder.fileOffset = 8;
+  encoder.totalBits = 0;
+  encoder.extraBits = 0;
+  for(i = 0; i < 256; i++) encoder.symbolCount[i] = 0;
+
+  /* every slot of every batch keeps its buffers and context from batch to
+   * batch, packed having room for the most a block can be encoded to */
+  for(b = 0; b < numSlots; b++)
+  {
+    struct Block* block = &encoder.blocks[b];
+    block->raw = (unsigned char*)malloc(options->blockSize);
+    block->packed = (unsigned char*)malloc(MAX_LENGTHS_BYTES + MAX_STREAM_TABLE_BYTES +
+                                           options->blockSize);
+    block->context = createHuffContext(options->maxLength, 1);
+    block->numStreams = options->numStreams;
+    block->order = options->order;
+  }
+  if(options->stats != NULL)
+  {
+    slotStats = (struct CodecStats*)malloc(sizeof(struct CodecStats) * numSlots);
+    for(b = 0; b < numSlots; b++)
+    {
+      resetStats(&slotStats[b]);
+      encoder.blocks[b].context->stats = &slotStats[b];
+    }
+  }
+
+  fputc(MAGIC_0, out);
+  fputc(MAGIC_1, out);
+  fputc(MAGIC_2, out);
+  fputc(FORMAT_BLOCKS, out);
+  writeU32(out, options->blockSize);
+
+  runPipeline(&encoder, readEncodeBatch, encodeBatch, writeEncodeBatch);
+
+  /* End of the blocks, then the index and where to find it */
+  fputc(BLOCK_END, out);
+  writeU64(out, encoder.numBlocks);
+  for(b = 0; b < 2*encoder.numBlocks; b++) writeU64(out, encoder.index[b]);
+  writeU64(out, encoder.fileOffset + 1);
+  fwrite(INDEX_MAGIC, 1, 4, out);
+
+  /* block headers and the index count as headers too */
+  if(options->stats != NULL)
+  {
+    for(b = 0; b < numSlots; b++) addStats(options->stats, &slotStats[b]);
+    options->stats->bytes[PHASE_HEADER_WRITE] += 8 + 9 * encoder.numBlocks + 1 + 8 +
+                                                 16 * encoder.numBlocks + 12;
+    options->stats->outputBytes = encoder.fileOffset + 1 + 8 + 16 * encoder.numBlocks + 12;
+  }
+
+  /* printing out the information table, codes differ between blocks */
+  if(options->printTable)
+  {
+    printf("Symbol\tFreq\n");
+    for(i = 0; i < 256; i++)
+    {
+      if(encoder.symbolCount[i] == 0) continue;
+      if(i < 33 || i > 126) printf("=%-d\t", i); 
+      else printf("%c\t", i); 
+      printf("%-lu\n", encoder.symbolCount[i]);
+    }
+    printf("Total chars = %lu\n", (unsigned long)encoder.rawOffset); 
+    printf("Blocks = %lu\n", encoder.numBlocks);
+    if(options->maxLength > 0)
+    {
+      printLimitCost(options->maxLength, encoder.totalBits, encoder.extraBits);
+    }
+  }
+
+  for(b = 0; b < numSlots; b++)
+  {
+    free(encoder.blocks[b].raw);
+    free(encoder.blocks[b].packed);
+    freeHuffContext(encoder.blocks[b].context);
+  }
+  free(encoder.blocks);
+  free(slotStats);
+  free(encoder.index);
+  freeThreadPool(encoder.pool);
+  return encoder.encoded;
+}
+
+/*
+ * Encodes a file with the adaptive code, which needs only the magic
+ * and format in front of the encoded bits. The input is read once,
+ * so it may be a pipe.
+ 
+ * FILE* in - file to encode
+ * FILE* out - file to write to
+ * struct EncodeOptions* options - whether to print the table and stats
+ 
+ * returns int - always 1
+*/
+int encodeAdaptiveFile(FILE* in, FILE* out, struct EncodeOptions* options)
+{
+  unsigned long symbolCount[256];
+  unsigned long total;
+  double start;
+  long end;
+  int i;
+
+  fputc(MAGIC_0, out);
+  fputc(MAGIC_1, out);
+  fputc(MAGIC_2, out);
+  fputc(FORMAT_ADAPTIVE, out);
+  start = startPhase(options->stats);
+  total = encodeAdaptive(in, out, symbolCount);
+
+  /* the bits are only counted by where the file ended up, so not on pipes */
+  if(options->stats != NULL)
+  {
+    fflush(out);
+    end = ftell(out);
+    endPhase(options->stats, PHASE_ENCODE, start, (end > 4) ? (uint64_t)(end - 4) : 0);
+    addCodeStats(options->stats, symbolCount, NULL);
+  }
+
+  /* printing out the information table, codes change as symbols are seen */
+  if(options->printTable)
+  {
+    printf("Symbol\tFreq\n");
+    for(i = 0; i < 256; i++)
+    {
+      if(symbolCount[i] == 0) continue;
+      if(i < 33 || i > 126) printf("=%-d\t", i); 
+      else printf("%c\t", i); 
+      printf("%-lu\n", symbolCount[i]);
+    }
+    printf("Total chars = %lu\n", total); 
+  }
+  return 1;
+}
+
+/*
+ * Encodes a file with a single canonical code, the same stream
+ * encodeBuffer makes. The input is counted a window at a time, then read
+ * again to write the codes, so memory doesn't grow with the file. Inputs
+ * that can't be read twice, like pipes, are copied to a temporary file
+ * first.
+ 
+ * FILE* in - file to encode
+ * FILE* out - file to write to
+ * struct EncodeOptions* options - threads, length limit, the table and stats
+ 
+ * returns int - 1 if encoded, 0 if not
+*/
+int encodeCanonicalFile(FILE* in, FILE* out, struct EncodeOptions* options)
+{
+  struct HuffContext* context = createHuffContext(options->maxLength, options->numThreads);
+  struct InputFile input;
+  unsigned char packedLengths[MAX_LENGTHS_BYTES];
+  unsigned long *symbolCount;
+  unsigned long numBytes;
+  uint64_t total, headerBytes;
+  FILE* spool = NULL;
+  double start;
+  int encoded, i, j;
+
+  if(!isSeekable(in) && (in = spool = spoolInput(in)) == NULL)
+  {
+    fprintf(stderr, "Error Copying Input To A Temporary File!\n");
+    freeHuffContext(context);
+    return 0;
+  }
+
+  context->stats = options->stats;
+  openInput(&input, in);
+  start = startPhase(options->stats);
+  symbolCount = countSymbols(&input, &total, options->numThreads);
+  endPhase(options->stats, PHASE_COUNT, start, total);
+  for(i = 0; i < 256; i++) context->freq[i] = symbolCount[i];
+  free(symbolCount);
+
+  encoded = buildCountedCode(context);
+  if(encoded)
+  {
+    start = startPhase(options->stats);
+    numBytes = writeLengths(packedLengths, context->lengths);
+    headerBytes = 4 + numBytes + 8;
+    fputc(MAGIC_0, out);
+    fputc(MAGIC_1, out);
+    fputc(MAGIC_2, out);
+    fputc(FORMAT_CANONICAL, out);
+    fwrite(packedLengths, 1, numBytes, out);
+    writeU64(out, total);
+    endPhase(options->stats, PHASE_HEADER_WRITE, start, headerBytes);
+
+    start = startPhase(options->stats);
+    rewindInput(&input);
+    writeSymbols(&input, out, &context->table, total);
+    endPhase(options->stats, PHASE_ENCODE, start, (context->bits + 7) / 8);
+    if(options->stats != NULL) options->stats->outputBytes = headerBytes + (context->bits + 7) / 8;
+  }
+  closeInput(&input);
+  if(spool != NULL) fclose(spool);
+
+  if(!encoded) fprintf(stderr, "Error Encoding File!\n");
+
+  /* printing out the information table */
+  if(encoded && options->printTable)
+  {
+    printf("Symbol\tFreq\tCode\n");
+    for(i = 0; i < 256; i++)
+    {
+      if(context->table.length[i] == 0) continue;
+      if(i < 33 || i > 126) printf("=%-d\t", i); 
+      else printf("%c\t", i); 
+      printf("%-lu\t", context->freq[i]);
+      for(j = context->table.length[i] - 1; j >= 0; j--)
+      {
+        printf("%d", (int)((context->table.code[i] >> j) & 1));
+      }
+      printf("\n");
+    }
+    printf("Total chars = %lu\n", (unsigned long)total); 
+    if(options->maxLength > 0) printLimitCost(options->maxLength, context->bits, context->extraBits);
+  }
+
+  freeHuffContext(context);
+  return encoded;
+}
+
+/*
+ * Encodes a file with a trained dictionary: the magic, the format, the
+ * dictionary's ID and the number of bytes, then the bits. Nothing is
+ * counted first unless the stats ask for it, so the input is only read
+ * into memory to learn its length up front, which costs nothing for a
+ * mapped file.
+ 
+ * FILE* in - file to encode
+ * FILE* out - file to write to
+ * struct EncodeOptions* options - the dictionary and stats
+ 
+ * returns int - 1 if encoded
+ *               0 if a byte has no code in the dictionary
+*/
+int encodeDictFile(FILE* in, FILE* out, struct EncodeOptions* options)
+{
+  struct Dictionary* dict = options->dictionary;
+  struct InputFile input;
+  struct BitWriter writer;
+  const unsigned char* src;
+  unsigned long srcLength, headerBytes;
+  unsigned long freq[256];
+  uint64_t bits;
+  double start;
+  int i;
+
+  openInput(&input, in);
+  srcLength = wholeInput(&input, &src);
+
+  start = startPhase(options->stats);
+  fputc(MAGIC_0, out);
+  fputc(MAGIC_1, out);
+  fputc(MAGIC_2, out);
+  fputc(FORMAT_DICT, out);
+  writeU32(out, (unsigned long)dict->id);
+  headerBytes = 8 + writeVarint(out, srcLength);
+  endPhase(options->stats, PHASE_HEADER_WRITE, start, headerBytes);
+
+  start = startPhase(options->stats);
+  initBitWriter(&writer, out);
+  bits = encodeDictionary(dict, src, srcLength, &writer);
+  flushBits(&writer);
+  endPhase(options->stats, PHASE_ENCODE, start, (bits + 7) / 8);
+
+  if(bits == (uint64_t)-1)
+  {
+    fprintf(stderr, "A byte has no code in the dictionary and it has no escape!\n");
+    closeInput(&input);
+    return 0;
+  }
+
+  /* the counts are only for the stats, the code doesn't need them */
+  if(options->stats != NULL)
+  {
+    for(i = 0; i < 256; i++) freq[i] = 0;
+    countBytes(src, srcLength, freq);
+    addCodeStats(options->stats, freq, NULL);
+    options->stats->codeBits += bits;
+    options->stats->outputBytes = headerBytes + (bits + 7) / 8;
+  }
+  closeInput(&input);
+  return 1;
+}
+
+/*
+ * Trains a dictionary on a corpus of files and writes it out
+ 
+ * const char* dictName - dictionary file to write
+ * char** inputs - training files, or tables printed by -p
+ * int numInputs - how many inputs there are
+ * int maxLength - longest code allowed, 0 for no limit
+ 
+ * returns int - 1 if the dictionary was written
+ *               0 if a file couldn't be read or written
+*/
+int trainFiles(const char* dictName, char** inputs, int numInputs, int maxLength)
+{
+  struct Dictionary dict;
+  unsigned long freq[256];
+  unsigned long total = 0;
+  FILE* file;
+  int i, numCodes = 0;
+
+  for(i = 0; i < 256; i++) freq[i] = 0;
+  for(i = 0; i < numInputs; i++)
+  {
+    file = fopen(inputs[i], "rb");
+    if(file == NULL)
+    {
+      fprintf(stderr, "Error Opening Input File %s!\n", inputs[i]);
+      return 0;
+    }
+    total += countTrainingFile(file, freq);
+    fclose(file);
+  }
+
+  if(!trainDictionary(&dict, freq, maxLength)) return 0;
+  file = fopen(dictName, "wb");
+  if(file == NULL || !saveDictionary(&dict, file))
+  {
+    fprintf(stderr, "Error Opening Output File %s!\n", dictName);
+    return 0;
+  }
+  fclose(file);
+
+  for(i = 0; i < 256; i++) numCodes += (dict.lengths[i] > 0 && i != dict.escape);
+  printf("Trained dictionary %08lx on %lu bytes, %d bytes have codes", 
+         (unsigned long)dict.id, total, numCodes);
+  if(dict.escape != DICT_NO_ESCAPE) printf(", the rest escape with %d bits", dict.lengths[dict.escape] + 8);
+  printf("\n");
+  return 1;
+}
+
+/**************************************************************/
+/* Huffman encode a file with the given settings.             */
+/*     Writes the freq/code table to stdout if asked to.      */
+/* in -- File to encode.                                      */
+/* out -- File where encoded data will be written.            */
+/* options -- Format and other settings for the output.       */
+/* returns 1 if encoded, 0 if not                             */
+/**************************************************************/
+int encodeFileOptions(FILE* in, FILE* out, struct EncodeOptions* options)
 {
   unsigned long *symbolCount; /* array of symbol frequencies */
   struct SymbolNode **codes; /* array of SymbolNodes representing symbol + code */
   struct SymbolNode *treeRoot; /* pointer to root of huffman tree */
-  unsigned long totalSymbols; /* how many characters in file */
+  struct CodeTable table; /* flat copy of the codes for writing symbols */
+  struct InputFile input; /* input file read in spans */
+  uint64_t totalSymbols; /* how many characters in file */
+  uint64_t extraBits = 0; /* bits the code length limit costs */
+  uint64_t totalBits = 0; /* bits of encoded symbols */
+  uint64_t headerBytes; /* bytes the header takes */
+  unsigned char lengths[256]; /* code lengths for the stats */
+  double start; /* when the phase being timed started */
   int i, j; /* loop indices */
   
-  symbolCount = countSymbols(in, &totalSymbols); /* generate frequency count */
+  if(options->format == FORMAT_BLOCKS) return encodeBlocks(in, out, options);
+  if(options->format == FORMAT_ADAPTIVE) return encodeAdaptiveFile(in, out, options);
+  if(options->format == FORMAT_CANONICAL) return encodeCanonicalFile(in, out, options);
+  if(options->format == FORMAT_DICT) return encodeDictFile(in, out, options);
+
+  /* the legacy format counts the symbols, then reads the file again */
+  if(!isSeekable(in))
+  {
+    fprintf(stderr, "Input must be a regular file for the legacy format!\n");
+    return 0;
+  }
+
+  openInput(&input, in); /* mapped if it is a regular file */
+  start = startPhase(options->stats);
+  symbolCount = countSymbols(&input, &totalSymbols, options->numThreads); /* generate frequency count */
+  endPhase(options->stats, PHASE_COUNT, start, totalSymbols);
+
+  /* symbols are counted in unsigned longs, 32 bits on some platforms */
+  if(totalSymbols != (unsigned long)totalSymbols)
+  {
+    fprintf(stderr, "Input is too large for the legacy format, use the block format!\n");
+    free(symbolCount);
+    closeInput(&input);
+    return 0;
+  }
+
+  start = startPhase(options->stats);
   codes = generateCodes(symbolCount, &treeRoot); /* make huffman tree + codes */
+  if(options->maxLength > 0) extraBits = limitCodes(codes, options->maxLength);
+  endPhase(options->stats, PHASE_TREE, start, 0);
+
+  /* codes only get too long to write for files of many TB */
+  for(i = 0; i < 256; i++)
+  {
+    if(codes[i] != NULL && codes[i]->length > MAX_CODE_LENGTH)
+    {
+      fprintf(stderr, "Codes are too long to encode!\n");
+      free(codes);
+      free(symbolCount);
+      closeInput(&input);
+      return 0;
+    }
+  }
+
+  /* the symbol count, then each symbol with its length and code */
+  headerBytes = 1 + 8;
+  for(i = 0; i < 256; i++)
+  {
+    lengths[i] = (codes[i] == NULL) ? 0 : (unsigned char)codes[i]->length;
+    if(codes[i] != NULL) headerBytes += 2 + (codes[i]->length + 7) / 8;
+    totalBits += (uint64_t)symbolCount[i] * lengths[i];
+  }
+
+  start = startPhase(options->stats);
   writeHeader(out, codes); /* write header to output */
-  rewind(in); /* go to start of input file */
-  writeSymbols(in, out, codes, totalSymbols); /* encode all symbols and write */
+  endPhase(options->stats, PHASE_HEADER_WRITE, start, headerBytes);
+
+  start = startPhase(options->stats);
+  buildCodeTable(codes, &table);
+  rewindInput(&input); /* go to start of input file */
+  writeSymbols(&input, out, &table, totalSymbols); /* encode all symbols and write */
+  endPhase(options->stats, PHASE_ENCODE, start, (totalBits + 7) / 8);
+  addCodeStats(options->stats, symbolCount, lengths);
+  if(options->stats != NULL) options->stats->outputBytes = headerBytes + (totalBits + 7) / 8;
   
   /* printing out the information table */
-  printf("Symbol\tFreq\tCode\n");
-  for(i = 0; i < 256; i++)
+  for(i = 0; i < 256 && options->printTable; i++)
   {
+    if(i == 0) printf("Symbol\tFreq\tCode\n");
     if(codes[i] != NULL && codes[i]->length != 0)
     {
       if(i < 33 || i > 126) printf("=%-d\t", i); 
       else printf("%c\t", i); 
       printf("%-lu\t", codes[i]->freq);
-      for(j = 0; j < codes[i]->length; j++)
+      for(j = codes[i]->length - 1; j >= 0; j--)
       {
-        printf("%d", codes[i]->code[j]);
+        printf("%d", (int)((codes[i]->code >> j) & 1));
       }
       printf("\n");
     }
   }
-  printf("Total chars = %lu\n", totalSymbols); 
+  if(options->printTable) printf("Total chars = %lu\n", (unsigned long)totalSymbols); 
+  if(options->printTable && options->maxLength > 0)
+  {
+    printLimitCost(options->maxLength, totalBits, extraBits);
+  }
 
-  /* Free all allocated memory */
-  freeTree(treeRoot);
+  /* Free all allocated memory, the tree lives with the codes */
   free(codes);
   free(symbolCount);
+  closeInput(&input);
+  return 1;
 }
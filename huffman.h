@@ -3,6 +3,225 @@
 
 /* Including stdio so we'll know about FILE type */
 #include <stdio.h>
+/* Including stdint for fixed width codes and bit buffers */
+#include <stdint.h>
+
+/* Nodes in a huffman tree of all 256 symbols */
+#define ARENA_NODES 511
+
+/* Number of code bits used to index the first level of a decode table */
+#define TABLE_BITS 11
+
+/* Fewest root bits a table needs to have a decode kernel of its own */
+#define KERNEL_MIN_BITS 6
+
+/* Code bits looked at per lookup of a multi-symbol table */
+#define MULTI_BITS TABLE_BITS
+
+/* Most symbols one multi-symbol lookup can give */
+#define MULTI_MAX_SYMBOLS 4
+
+/* Multi-symbol tables are used when codes average at most this many bits */
+#define MULTI_MAX_AVERAGE 5
+
+/* Longest code the encoder can use, codes are kept in 64 bits */
+#define MAX_CODE_LENGTH 64
+
+/* Bytes a BitWriter collects before writing them to its file */
+#define BIT_WRITER_BYTES 4096
+
+/* Bytes an InputFile reads at a time when the file can't be mapped */
+#define INPUT_CHUNK_BYTES (64*1024)
+
+/* Bytes an OutputFile collects before writing them, when not mapped */
+#define OUTPUT_CHUNK_BYTES (64*1024)
+
+/* Most bytes of a file mapped at once, larger inputs are mapped a window
+ * at a time and larger outputs written in chunks, so memory stays flat */
+#define MAP_WINDOW_BYTES (64UL*1024*1024)
+
+/* Tables of counts the byte histogram spreads bytes over, it is unrolled for 4 */
+#define HISTOGRAM_WAYS 4
+
+/* Bytes counted before the 32 bit histogram tables are added up */
+#define HISTOGRAM_SPAN (1UL << 30)
+
+/* Fewest bytes worth handing to another thread when counting */
+#define HISTOGRAM_THREAD_BYTES (1024*1024)
+
+/* 
+ * Files in the newer formats start with these bytes. In the legacy format
+ * they would mean 72 symbols, the first having a code 255 bits long, 
+ * which can't happen with so few symbols, so the two can't be confused.
+*/
+#define MAGIC_0 'H'
+#define MAGIC_1 'F'
+#define MAGIC_2 0xFF
+
+/* Byte after the magic bytes, telling how the rest of the file is laid out */
+#define FORMAT_LEGACY 0 /* no magic, full codes in header */
+#define FORMAT_CANONICAL 1 /* code lengths only, codes are canonical */
+#define FORMAT_BLOCKS 2 /* blocks with their own canonical codes, then an index */
+#define FORMAT_ADAPTIVE 3 /* one pass, the code adapts after every symbol */
+#define FORMAT_DICT 4 /* code from a trained dictionary, only its ID in the header */
+
+/* 
+ * The adaptive code has a symbol for every byte plus ADAPTIVE_END, which
+ * ends the bits. Symbols sent for the first time follow the NYT code in
+ * ADAPTIVE_LITERAL_BITS bits. 
+*/
+#define ADAPTIVE_SYMBOLS 257
+#define ADAPTIVE_END 256
+#define ADAPTIVE_LITERAL_BITS 9
+#define ADAPTIVE_ROOT (2*ADAPTIVE_SYMBOLS - 2) /* node number of the root */
+
+/* 
+ * A FORMAT_BLOCKS file is the magic, the format and the block size (4 bytes), 
+ * followed by blocks. Each block starts with one of these kinds, then the 
+ * raw length (4 bytes) and the length of what follows (4 bytes). Numbers 
+ * are stored least significant byte first.
+*/
+#define BLOCK_END 0 /* no more blocks, the index follows */
+#define BLOCK_HUFFMAN 1 /* code lengths then the encoded bits */
+#define BLOCK_STREAMS 2 /* code lengths, then the bits split into streams */
+#define BLOCK_ORDER1 3 /* a code per cluster of previous bytes, then the encoded bits */
+#define BLOCK_STORED 4 /* the raw bytes as they are */
+
+/* 
+ * A block is stored as it is unless coding it saves at least 1 / this of
+ * its bytes. Data that hardly compresses, like JPEGs or zip files, then
+ * costs the block's 9 header bytes at most and decodes with a copy.
+*/
+#define STORED_MIN_SAVING 64
+
+/* 
+ * Before a block is encoded, the counts of its segments are compared to
+ * find where the bytes change enough for a new code to pay for itself,
+ * and the block is written as several blocks split there. Segments are
+ * at least SPLIT_SEGMENT_BYTES long, and a block has at most
+ * SPLIT_MAX_SEGMENTS of them, so it is never split into more parts.
+ * Like storing, a split has to save at least 1/SPLIT_MIN_SAVING of the
+ * bits, since every block also costs a code to build and a table to fill.
+ * Data that only looks a little different from segment to segment, like
+ * random runs, then stays in one block after a single look.
+*/
+#define SPLIT_SEGMENT_BYTES (16*1024)
+#define SPLIT_MAX_SEGMENTS 64
+#define SPLIT_BLOCK_BYTES (9 + 16) /* a block's header and index entry */
+#define SPLIT_MIN_SAVING 64
+#define SPLIT_TABLE_COUNTS 4096 /* counts whose count * log2(count) is kept */
+
+/* 
+ * A BLOCK_STREAMS block deals its symbols out to several streams in turn,
+ * the first symbol to the first stream and so on, so the decoder can work
+ * on every stream at once. After the code lengths come the number of 
+ * streams (1 byte) and the byte length of all but the last (4 bytes each).
+*/
+#define MAX_STREAMS 8
+#define MAX_STREAM_TABLE_BYTES (1 + 4 * (MAX_STREAMS - 1))
+
+/* 
+ * A BLOCK_ORDER1 block codes each byte with the code of the byte before
+ * it, the first byte counting 0 as the one before. Previous bytes that are
+ * followed by much the same bytes share a code, so only a few codes are
+ * stored: the number of codes (1 byte), which code each previous byte
+ * uses and then the code lengths of every code, all run-length encoded 
+ * like the code lengths of the other blocks. Codes are at most TABLE_BITS 
+ * long so every symbol decodes with a single lookup.
+*/
+#define ORDER1_MAX_CODES 16
+#define ORDER1_PASSES 4 /* rounds of moving previous bytes to the code that suits them */
+#define ORDER1_BYTES_PER_CODE 8192 /* raw bytes each extra code needs to pay for itself */
+#define MAX_ORDER1_HEADER_BYTES (1 + MAX_LENGTHS_BYTES * (1 + ORDER1_MAX_CODES))
+
+/* 
+ * After the end block comes the index: the number of blocks (8 bytes), then
+ * for every block its raw offset and its offset in the file (8 bytes each).
+ * The file ends with the offset of the index (8 bytes) and these bytes.
+*/
+#define INDEX_MAGIC "HFIX"
+
+/* 
+ * A dictionary file is these bytes, the dictionary's ID (4 bytes), its
+ * escape (2 bytes) and the code lengths as writeLengths writes them. A 
+ * FORMAT_DICT file holds the ID and the number of bytes encoded, 7 bits a 
+ * byte lowest first with the top bit set on all but the last, then the 
+ * bits. Bytes without a code are the escape's code followed by the byte.
+*/
+#define DICT_MAGIC "HFDC"
+#define DICT_NO_ESCAPE 256 /* escape of a dictionary where every byte has a code */
+#define DICT_ESCAPE_SHARE 1024 /* the escape is counted once per this many trained bytes */
+#define DICT_MAX_LENGTH 56 /* longest dictionary code, so escape and byte fit in one write */
+
+/* Raw bytes in each block unless asked otherwise */
+#define DEFAULT_BLOCK_SIZE (256*1024)
+
+/* Largest block size that can be asked for */
+#define MAX_BLOCK_SIZE (1024*1024*1024)
+
+/* Shortest code length limit that can be asked for, enough for 256 symbols */
+#define MIN_LENGTH_LIMIT 8
+
+/* Blocks read in per thread before they are handed out to be worked on */
+#define BLOCKS_PER_THREAD 4
+
+/* Batches in flight at once, one being read, one coded and one written */
+#define PIPELINE_DEPTH 3
+
+/* Most bytes writeLengths can take for the code lengths of 256 symbols */
+#define MAX_LENGTHS_BYTES 256
+
+/* Most bytes a canonical code header takes: magic, format, lengths, count */
+#define MAX_HEADER_BYTES (4 + MAX_LENGTHS_BYTES + 8)
+
+/* Phases of encoding and decoding that --stats=json times */
+#define PHASE_COUNT 0 /* counting symbols */
+#define PHASE_TREE 1 /* building the tree and the codes */
+#define PHASE_HEADER_WRITE 2 /* writing code lengths and other headers */
+#define PHASE_ENCODE 3 /* writing the codes of the symbols */
+#define PHASE_HEADER_PARSE 4 /* reading code lengths and building decode tables */
+#define PHASE_DECODE 5 /* decoding the symbols */
+#define NUM_PHASES 6
+
+/* Where the time went while encoding or decoding, and how good the codes were */
+struct CodecStats
+{
+  double seconds[NUM_PHASES]; /* wall time of each phase, added up over threads */
+  uint64_t bytes[NUM_PHASES]; /* bytes each phase read or wrote */
+  uint64_t freq[256]; /* how often each symbol was encoded */
+  uint64_t symbols; /* symbols encoded or decoded */
+  uint64_t codeBits; /* bits of their codes, when the code is known up front */
+  int longest; /* longest code used */
+  uint64_t inputBytes; /* size of what was read */
+  uint64_t outputBytes; /* size of what was written */
+  double totalSeconds; /* wall time from start to end */
+  int format; /* FORMAT_ value of the encoded file, -1 until known */
+};
+
+/* Settings for how a file gets encoded */
+struct EncodeOptions
+{
+  int format; /* one of the FORMAT_ values */
+  unsigned long blockSize; /* raw bytes per block for FORMAT_BLOCKS */
+  int numThreads; /* threads encoding blocks at the same time */
+  int printTable; /* whether to print the freq/code table to stdout */
+  int maxLength; /* longest code allowed, 0 for no limit */
+  int numStreams; /* streams each block is split into, 1 for BLOCK_HUFFMAN */
+  int order; /* 1 to let blocks use order-1 codes where they come out smaller */
+  struct Dictionary* dictionary; /* code for FORMAT_DICT */
+  struct CodecStats* stats; /* phases are timed into this unless NULL */
+};
+
+/* Settings for how a file gets decoded */
+struct DecodeOptions
+{
+  int numThreads; /* threads decoding blocks at the same time */
+  int useRange; /* set to decode only a range of the raw bytes */
+  uint64_t rangeStart; /* first raw byte of the range */
+  uint64_t rangeLength; /* raw bytes in the range */
+  struct Dictionary* dictionary; /* code for FORMAT_DICT files, NULL if none was given */
+  struct CodecStats* stats; /* phases are timed into this unless NULL */
+};
 
 /**************************************************************/
 /* Huffman encode a file.                                     */
@@ -13,6 +232,16 @@
 /**************************************************************/
 void encodeFile(FILE* in, FILE* out);
 
+/**************************************************************/
+/* Huffman encode a file with the given settings.             */
+/*     Writes the freq/code table to stdout if asked to.      */
+/* in -- File to encode.                                      */
+/* out -- File where encoded data will be written.            */
+/* options -- Format and other settings for the output.       */
+/* returns 1 if encoded, 0 if not                             */
+/**************************************************************/
+int encodeFileOptions(FILE* in, FILE* out, struct EncodeOptions* options);
+
 /***************************************************/
 /* Decode a Huffman encoded file.                  */
 /* in -- File to decode.                           */
@@ -20,27 +249,281 @@ void encodeFile(FILE* in, FILE* out);
 /***************************************************/
 void decodeFile(FILE* in, FILE* out);
 
-/* Represents both an element of the Huffman Tree and the Priority Queue */
+/***************************************************/
+/* Decode a Huffman encoded file with settings.    */
+/* in -- File to decode.                           */
+/* out -- File where decoded data will be written. */
+/* options -- Threads and other settings.          */
+/* returns 1 if decoded, 0 if the file is corrupt  */
+/***************************************************/
+int decodeFileOptions(FILE* in, FILE* out, struct DecodeOptions* options);
+
+/* Represents an element of the Huffman Tree */
 struct SymbolNode
 {
   unsigned long freq;
   unsigned char symbol; 
   unsigned int length;
-  unsigned char code[256];
-  struct SymbolNode *next; 
+  uint64_t code; /* right aligned, first bit of the code is the highest */
   struct SymbolNode *left;
   struct SymbolNode *right;
 };
 
+/* 
+ * Everything generateCodes allocates, in one piece. The array of symbols
+ * comes first so it is also the pointer to free the whole thing with.
+ * The leaves are at the start of nodes, then the combined nodes in the 
+ * order they were made, the root last. limitCodeLengths keeps its lists
+ * in isPackage, so limiting the lengths needs no memory of its own.
+*/
+struct CodeArena
+{
+  struct SymbolNode* symbols[256];
+  struct SymbolNode nodes[ARENA_NODES];
+  unsigned char isPackage[MAX_CODE_LENGTH][512]; /* for each level, which items are packages */
+};
+
+/* Flat table of every symbol's code, all the encoder needs per symbol */
+struct CodeTable
+{
+  uint64_t code[256]; /* right aligned code of each symbol */
+  unsigned char length[256]; /* code length, 0 if the symbol doesn't appear */
+};
+
+/* A code trained ahead of time, see trainDictionary */
+struct Dictionary
+{
+  uint32_t id; /* hash of the escape and lengths, stored in every file it encodes */
+  int escape; /* byte whose code stands for an escape, DICT_NO_ESCAPE if none */
+  unsigned char lengths[256]; /* code lengths, the escape's included */
+  struct CodeTable table; /* code of every byte, escaped ones with the byte appended */
+};
+
+/* 
+ * Packs codes into a 64 bit accumulator and stores it a whole word at a 
+ * time, first bit being the highest bit, so each code takes a shift and 
+ * an or instead of a step per bit.
+*/
+struct BitWriter
+{
+  uint64_t bitBuf; /* bits not yet stored, right aligned */
+  unsigned int bitCount; /* how many bits of bitBuf are valid */
+  unsigned char* buffer; /* where whole words are stored */
+  unsigned long used; /* bytes of buffer in use */
+  unsigned long capacity; /* bytes buffer can hold */
+  int overflow; /* set if writing to memory ran out of room */
+  FILE* out; /* if not NULL, buffer is written here whenever it fills up */
+  unsigned char fileBuffer[BIT_WRITER_BYTES]; /* buffer used for a file */
+};
+
+/* Encode loop adding a fixed number of codes between stores */
+typedef unsigned long (*EncodeKernel)(struct BitWriter* writer, const struct CodeTable* table,
+                                      const unsigned char* src, unsigned long count, int stride);
+
+/* 
+ * Input read in spans, either windows mapped from the rest of the file or
+ * chunks read into a buffer. Details are in fileIO.c.
+*/
+struct InputFile
+{
+  FILE* in;
+  const unsigned char* data; /* mapped bytes, or the chunk buffer */
+  unsigned long length; /* bytes at data */
+  unsigned long pos; /* bytes of data already handed out */
+  void* map; /* start of the mapping, NULL if reading chunks */
+  unsigned long mapLength;
+  unsigned char* buffer; /* chunk buffer, NULL if mapped */
+  long start; /* file offset the input starts at */
+  uint64_t total; /* bytes from start to the end of a mapped file */
+  uint64_t mapped; /* bytes from start to the end of the current window */
+};
+
+/* Output of a known length, either mapped or collected in a buffer */
+struct OutputFile
+{
+  FILE* out;
+  unsigned char* data; /* where the next bytes go, from data + used on */
+  unsigned long used; /* bytes of data filled in */
+  unsigned long capacity; /* bytes data holds */
+  void* map; /* start of the mapping, NULL if writing chunks */
+  unsigned long mapLength;
+  long start; /* file offset the output starts at */
+};
+
+/* 
+ * Reads codes out of memory or an InputFile, first bit being the highest
+ * bit of the bit buffer. Past the end of the input zero bytes are added,
+ * and the padding is counted so using any of it can be caught.
+*/
+struct BitReader
+{
+  uint64_t bitBuf; /* unread bits, next bit is the top one */
+  unsigned int bitCount; /* how many bits of bitBuf are valid */
+  const unsigned char* src; /* bytes being read */
+  unsigned long srcLength; /* bytes src holds */
+  unsigned long pos; /* next byte of src to put in bitBuf */
+  unsigned long padding; /* zero bytes added past the end */
+  struct InputFile* input; /* if not NULL, src is refilled from here */
+};
+
+/* One of the blocks an encoded Block is written out as */
+struct BlockPart
+{
+  int kind; /* BLOCK_ kind of the part */
+  unsigned long rawLength; /* raw bytes of the part */
+  unsigned long packedLength; /* its bytes in the block's packed buffer */
+};
+
+/* One block of a FORMAT_BLOCKS file, both as raw bytes and as encoded */
+struct Block
+{
+  unsigned char* raw; /* raw bytes of the block */
+  unsigned long rawLength;
+  unsigned char* packed; /* code lengths followed by the encoded bits */
+  unsigned long packedLength;
+  int kind; /* BLOCK_HUFFMAN, BLOCK_STREAMS, BLOCK_ORDER1 or BLOCK_STORED */
+  int numStreams; /* streams to split the bits into when encoding */
+  int order; /* set to try an order-1 code when encoding */
+  unsigned long freq[256]; /* how often each symbol is in the block */
+  struct HuffContext* context; /* scratch memory for whoever works on the block */
+  uint64_t bits; /* encoded bits, not counting the code lengths */
+  uint64_t extraBits; /* of those, how many are due to maxLength */
+  int failed; /* set if the block couldn't be encoded or decoded */
+  int numParts; /* blocks it was split into when encoding, packed one after another */
+  struct BlockPart parts[SPLIT_MAX_SEGMENTS];
+};
+
+/* One node of the adaptive tree, nodes link to each other by number */
+struct AdaptiveNode
+{
+  unsigned long weight; /* times the symbols under this node were seen */
+  int parent; /* -1 for the root */
+  int left; /* -1 for a leaf */
+  int right;
+  int symbol; /* symbol of a leaf, -1 for the NYT leaf and inner nodes */
+};
+
+/* 
+ * Tree of an adaptive huffman code. Nodes are numbered so that weights 
+ * never decrease as the number goes up, which keeps the tree a huffman 
+ * tree for the symbols seen so far. The root always has the last number.
+*/
+struct AdaptiveTree
+{
+  struct AdaptiveNode nodes[ADAPTIVE_ROOT + 1];
+  int leaf[ADAPTIVE_SYMBOLS]; /* node number of each symbol, -1 if not seen */
+  int nyt; /* node number of the not yet transmitted leaf */
+};
+
+/* Work given to a thread pool, called once for each task index of a batch */
+typedef void (*TaskFunction)(void* context, unsigned long index);
+
+/* Threads that run batches of tasks, details are in threadPool.c */
+struct ThreadPool;
+
+/* One stage of a pipeline, working on the batch in the given slot */
+typedef int (*StageFunction)(void* context, int slot);
+
+/* 
+ * One entry of a decode table. An entry either holds a decoded symbol
+ * along with how many bits its code takes up, or links to a sub-table
+ * used to finish decoding codes longer than the current table's bits.
+*/
+struct DecodeEntry
+{
+  unsigned int value; /* symbol, or index of the first sub-table entry */
+  unsigned char length; /* bits of the code consumed, 0 for a link */
+  unsigned char subBits; /* 0 for a symbol, else bits indexing the sub-table */
+};
+
+/* 
+ * One entry of a multi-symbol table, every whole code found in a window
+ * of MULTI_BITS bits, up to MULTI_MAX_SYMBOLS of them. A count of 0 means
+ * the first code is longer than the window or isn't a code at all.
+*/
+struct MultiEntry
+{
+  unsigned char symbols[MULTI_MAX_SYMBOLS]; /* decoded symbols, in order */
+  unsigned char count; /* how many symbols are whole */
+  unsigned char length; /* bits taken up by those symbols' codes */
+};
+
+/* Multi-level lookup table for decoding several code bits at once */
+struct DecodeTable
+{
+  struct DecodeEntry *entries; /* root table first, then all sub-tables */
+  unsigned int size; /* entries in use */
+  unsigned int capacity; /* entries allocated */
+  unsigned int rootBits; /* bits indexing the root table */
+  unsigned int longest; /* length of the longest code */
+  struct MultiEntry* multi; /* 1 << MULTI_BITS entries, NULL until first needed */
+  int useMulti; /* 1 if multi is filled in for the current code */
+};
+
+/* Decode loop written out for one table size and number of streams */
+typedef int (*DecodeKernel)(const struct DecodeEntry* entries, struct BitReader* readers,
+                            unsigned char* dest, unsigned long count);
+
+/* 
+ * The order-1 codes of a block. Counting how often each byte follows each
+ * other byte takes a lot more memory than the rest of a context, so a 
+ * context only makes one of these once it meets an order-1 block.
+*/
+struct ContextModel
+{
+  uint32_t counts[256][256]; /* times each byte came after each byte, [previous][byte] */
+  unsigned long total[256]; /* bytes that came after each byte */
+  unsigned int listStart[257]; /* where each previous byte's list starts in the next two */
+  unsigned char listSymbol[256*256]; /* bytes seen after each previous byte */
+  uint32_t listCount[256*256]; /* and how often */
+  unsigned long freq[ORDER1_MAX_CODES][256]; /* symbol counts of each code */
+  double cost[ORDER1_MAX_CODES][256]; /* estimated bits for each symbol in each code */
+  unsigned char map[256]; /* code used after each previous byte */
+  int numCodes;
+  unsigned char lengths[ORDER1_MAX_CODES][256]; /* code lengths of each code */
+  struct CodeTable tables[ORDER1_MAX_CODES];
+  struct DecodeTable decodeTables[ORDER1_MAX_CODES]; /* single level, no sub-tables */
+  unsigned char header[MAX_ORDER1_HEADER_BYTES]; /* written out by buildOrder1Code */
+  unsigned long headerLength;
+  uint64_t bits; /* encoded bits, not counting the header */
+  uint64_t extraBits; /* of those, how many are due to the length limit */
+  int longest; /* longest code of any of the codes */
+};
+
+/* 
+ * Everything encoding or decoding a buffer in memory needs besides the
+ * buffers themselves, made once with createHuffContext and then reused.
+ * Once the decode table has grown to what the codes need, encoding and
+ * decoding with a context don't allocate any memory at all.
+*/
+struct HuffContext
+{
+  struct CodeArena arena; /* huffman tree of the last code built */
+  struct CodeTable table; /* canonical codes of the last code built */
+  unsigned long freq[256]; /* symbol counts of the last buffer encoded */
+  unsigned char lengths[256]; /* code lengths of the last code built or read */
+  struct DecodeTable decodeTable; /* entries are kept from call to call */
+  int maxLength; /* longest code allowed when encoding, 0 for no limit */
+  int numThreads; /* threads to count symbols with, more than 1 allocates */
+  uint64_t bits; /* encoded bits of the last buffer, not counting the header */
+  uint64_t extraBits; /* of those, how many are due to maxLength */
+  struct ContextModel* model; /* order-1 codes, NULL until a block needs them */
+  unsigned long* splitFreq; /* running counts of a block's segments, 256 a row */
+  unsigned long splitRows; /* rows splitFreq has room for */
+  double* splitBits; /* count * log2(count) of counts below SPLIT_TABLE_COUNTS */
+  struct CodecStats* stats; /* phases are timed into this unless NULL */
+};
+
 /* 
  * Given an array of frequencies for symbols
  * with the value at the ith indexing representing 
  * the frequency of the character w/ ASCII value i, 
- * generates the set of codes for them. 
+ * generates the set of codes for them. The whole tree is allocated
+ * along with the returned array, so freeing the array frees the tree.
  
  * unsigned long* freq - array of character frequencies
- * struct SymbolNode** root - Pointer to root of tree, used to clean up
- * memory in encode/decode file and useful for other operations.
+ * struct SymbolNode** root - Pointer to root of tree, useful for other 
+ * operations. Don't call freeTree on it.
  
  * return struct SymbolNode** - an array of generated symbol 
  * nodes, holding their respective codes. Index i of the array
@@ -49,7 +532,22 @@ struct SymbolNode
 struct SymbolNode** generateCodes(unsigned long* freq, struct SymbolNode** root);
 
 /* 
- * Given the root of a huffman tree, frees all of the nodes for the given tree
+ * Generates the set of codes for an array of frequencies like generateCodes,
+ * building the tree in an arena the caller already has.
+ 
+ * struct CodeArena* arena - where the tree gets built, its old tree is lost
+ * const unsigned long* freq - array of character frequencies
+ * struct SymbolNode** root - set to the root of the tree, NULL for an empty file
+ 
+ * return struct SymbolNode** - the arena's array of symbol nodes, index i
+ * being the symbol with ascii code i, NULL if it doesn't appear
+*/
+struct SymbolNode** buildCodes(struct CodeArena* arena, const unsigned long* freq,
+                               struct SymbolNode** root);
+
+/* 
+ * Given the root of a huffman tree read from a file, frees all of the nodes 
+ * for the given tree
  
  * struct SymbolNode* root - root of the huffman tree
 */
@@ -57,17 +555,21 @@ void freeTree(struct SymbolNode* root);
 
 /*
  * Inserts into the tree a new symbol node. The new symbol node 
- * needs to have the correct code in order to be inserted. Creates new 
- * nodes along the way as needed. Call first with a depth of '0'
+ * needs to have the correct length and its code is given as it was stored 
+ * in the file. Creates new nodes along the way as needed. Call first with 
+ * a depth of '0'
  
  * struct SymbolNode* root - root of huffman tree
  * struct SymbolNode* newNode - node to insert
+ * const unsigned char* code - code packed 8 bits per byte, first bit being
+ * the highest bit of the first byte
  * int depth - pass in 0, but is used to keep place in code for the 
  * recursive calls. 
  
  * return struct SymbolNode* - used to update links in tree when making new nodes
 */
-struct SymbolNode* insertTree(struct SymbolNode* root, struct SymbolNode* newNode, int depth);
+struct SymbolNode* insertTree(struct SymbolNode* root, struct SymbolNode* newNode,
+                              const unsigned char* code, int depth);
 
 /* 
  * Creates a new symbolNode with given data 
@@ -98,4 +600,921 @@ void printTree(struct SymbolNode* head, int level);
  *               0 if not leaf
 */
 int isLeaf(struct SymbolNode* node);
+
+/*
+ * Assigns the canonical huffman codes for a set of code lengths. Symbols are
+ * ordered by code length and then by value, the first gets a code of all 
+ * zeroes and every following code is the previous code plus one, shifted 
+ * left whenever the length grows.
+ 
+ * const unsigned char* lengths - code length of each of the 256 symbols,
+ * 0 for symbols that don't appear. No longer than MAX_CODE_LENGTH.
+ * uint64_t* codes - array of 256 filled with the code for each symbol, 
+ * right aligned. Codes of unused symbols are set to 0.
+ 
+ * returns int - how many symbols have codes
+ *               -1 if the lengths are too long or over-subscribed
+*/
+int canonicalCodes(const unsigned char* lengths, uint64_t* codes);
+
+/*
+ * Finds the best code lengths for a set of frequencies when no code may 
+ * be longer than maxLength, using the package-merge algorithm.
+ 
+ * struct CodeArena* arena - scratch memory, its tree is left alone
+ * const unsigned long* freq - frequency of each of the 256 symbols
+ * unsigned char* lengths - array of 256 filled with each symbol's code length
+ * int maxLength - longest code allowed, from MIN_LENGTH_LIMIT up to MAX_CODE_LENGTH
+ 
+ * returns int - 1 if the lengths were found
+ *               0 if maxLength is out of range
+*/
+int limitCodeLengths(struct CodeArena* arena, const unsigned long* freq, unsigned char* lengths,
+                     int maxLength);
+
+/*
+ * Copies the codes out of the symbol nodes into a flat table, which is
+ * all the encoder needs to look at while writing out symbols.
+ 
+ * struct SymbolNode** codes - array of symbol nodes, NULL for symbols 
+ * that don't appear
+ * struct CodeTable* table - table to fill in
+*/
+void buildCodeTable(struct SymbolNode** codes, struct CodeTable* table);
+
+/*
+ * Gets a BitWriter ready to write to the given file
+ 
+ * struct BitWriter* writer - writer to set up
+ * FILE* out - file to write to
+*/
+void initBitWriter(struct BitWriter* writer, FILE* out);
+
+/*
+ * Gets a BitWriter ready to write into memory. The memory needs to hold
+ * every byte that will be written, otherwise overflow gets set.
+ 
+ * struct BitWriter* writer - writer to set up
+ * unsigned char* dest - memory to write to
+ * unsigned long capacity - how many bytes dest holds
+*/
+void initMemoryWriter(struct BitWriter* writer, unsigned char* dest, unsigned long capacity);
+
+/*
+ * Appends a code to the bits being written
+ 
+ * struct BitWriter* writer - writer to append to
+ * uint64_t code - right aligned code, no bits set above its length
+ * unsigned int length - how many bits long the code is, at most 64
+*/
+void writeBits(struct BitWriter* writer, uint64_t code, unsigned int length);
+
+/*
+ * Appends the codes of symbols stride bytes apart, through an encode
+ * kernel picked for the table and processor where there is one
+ 
+ * struct BitWriter* writer - writer to append to
+ * const struct CodeTable* table - code and code length of every symbol
+ * const unsigned char* src - first symbol to write
+ * unsigned long count - how many symbols to write
+ * int stride - bytes from one symbol to the next, 1 for all of them
+*/
+void writeCodes(struct BitWriter* writer, const struct CodeTable* table,
+                const unsigned char* src, unsigned long count, int stride);
+
+/*
+ * Writes out every bit still held by the writer, padding the last 
+ * byte with zeroes.
+ 
+ * struct BitWriter* writer - writer to empty
+*/
+void flushBits(struct BitWriter* writer);
+
+/*
+ * Adds how often every byte value appears in a buffer to freq
+ 
+ * const unsigned char* data - bytes to count
+ * unsigned long length - how many bytes data holds
+ * unsigned long* freq - array of 256 counts to add to
+*/
+void countBytes(const unsigned char* data, unsigned long length, unsigned long* freq);
+
+/*
+ * Adds how often every byte value appears in a buffer to freq, splitting 
+ * large buffers between threads and adding up their counts at the end
+ 
+ * const unsigned char* data - bytes to count
+ * unsigned long length - how many bytes data holds
+ * unsigned long* freq - array of 256 counts to add to
+ * int numThreads - most threads to use
+*/
+void countBytesParallel(const unsigned char* data, unsigned long length, unsigned long* freq,
+                        int numThreads);
+
+/*
+ * Counts a buffer a segment at a time, giving the running counts of
+ * everything up to the end of each segment
+ 
+ * const unsigned char* data - bytes to count, at most HISTOGRAM_SPAN of them
+ * unsigned long length - how many bytes data holds
+ * unsigned long segmentBytes - bytes in every segment but the last, which has the rest
+ * unsigned long numSegments - how many segments there are
+ * unsigned long* rows - 256 counts for each segment, set to the counts up to its end
+*/
+void countSegments(const unsigned char* data, unsigned long length, unsigned long segmentBytes,
+                   unsigned long numSegments, unsigned long* rows);
+
+/*
+ * Gets a BitReader ready to read from memory
+ 
+ * struct BitReader* reader - reader to set up
+ * const unsigned char* src - bytes to read
+ * unsigned long srcLength - how many bytes src holds
+*/
+void initMemoryReader(struct BitReader* reader, const unsigned char* src, unsigned long srcLength);
+
+/*
+ * Gets a BitReader ready to read the spans of an InputFile
+ 
+ * struct BitReader* reader - reader to set up
+ * struct InputFile* input - input to read from
+*/
+void initBitReader(struct BitReader* reader, struct InputFile* input);
+
+/*
+ * Tops off the bit buffer so it holds at least 56 bits
+ 
+ * struct BitReader* reader - reader to refill
+*/
+void refillBits(struct BitReader* reader);
+
+/*
+ * Tells whether any of the zero padding past the end of the input has 
+ * been used, which means the input was cut short or is corrupt
+ 
+ * struct BitReader* reader - reader to check
+ 
+ * returns int - 1 if bits past the end were used
+*/
+int readPastEnd(struct BitReader* reader);
+
+/*
+ * Gets the rest of a file, from where it is now, ready to be read in
+ * spans. Regular files are mapped a window at a time, others are read
+ * in chunks.
+ 
+ * struct InputFile* input - input to set up
+ * FILE* in - file to read
+ 
+ * returns int - 1 if the file was mapped
+ *               0 if it will be read in chunks
+*/
+int openInput(struct InputFile* input, FILE* in);
+
+/*
+ * Hands out the next span of bytes
+ 
+ * struct InputFile* input - input to read from
+ * const unsigned char** span - set to the first byte of the span
+ 
+ * returns unsigned long - bytes in the span, 0 at the end of the input
+*/
+unsigned long nextSpan(struct InputFile* input, const unsigned char** span);
+
+/*
+ * Hands out all the rest of the input as one span, reading it into
+ * memory first unless the file is mapped
+ 
+ * struct InputFile* input - input to read, nothing handed out yet
+ * const unsigned char** data - set to the first byte of the input
+ 
+ * returns unsigned long - bytes of input
+*/
+unsigned long wholeInput(struct InputFile* input, const unsigned char** data);
+
+/*
+ * Goes back to where the input started, so it can be read again
+ 
+ * struct InputFile* input - input to rewind
+ 
+ * returns int - 1 if rewound
+ *               0 if the file can't seek, like a pipe
+*/
+int rewindInput(struct InputFile* input);
+
+/*
+ * Unmaps or frees whatever the input was read through
+ 
+ * struct InputFile* input - input to close, the file itself stays open
+*/
+void closeInput(struct InputFile* input);
+
+/*
+ * Gets ready to write a known number of bytes at the file's current
+ * position, mapping the file if it is regular and open for reading
+ * and writing. Bytes go in at data + used, flushOutput makes room.
+ 
+ * struct OutputFile* output - output to set up
+ * FILE* out - file to write to
+ * uint64_t length - how many bytes will be written
+ 
+ * returns int - 1 if the output was mapped
+ *               0 if it will be written in chunks
+*/
+int openOutput(struct OutputFile* output, FILE* out, uint64_t length);
+
+/*
+ * Writes out the bytes collected so far, making room for more
+ 
+ * struct OutputFile* output - output to flush
+*/
+void flushOutput(struct OutputFile* output);
+
+/*
+ * Makes sure the next length bytes can be written at data + used in one
+ * go, which is never more than OUTPUT_CHUNK_BYTES for a buffered output
+ 
+ * struct OutputFile* output - output to make room in
+ * unsigned long length - bytes about to be written
+ 
+ * returns int - 1 if there is room
+ *               0 if a mapped output is too short or length is over a chunk
+*/
+int reserveOutput(struct OutputFile* output, unsigned long length);
+
+/*
+ * Writes out anything left and unmaps or frees the output, a mapped
+ * file is cut off after the bytes used
+ 
+ * struct OutputFile* output - output to close, the file itself stays open
+*/
+void closeOutput(struct OutputFile* output);
+
+/*
+ * Builds the lookup table used for decoding from a completed huffman tree.
+ * Codes no longer than the root table's bits are decoded with one lookup,
+ * longer codes continue through sub-tables TABLE_BITS at a time.
+ 
+ * struct SymbolNode* root - root of the huffman tree
+ 
+ * returns DecodeTable* - newly allocated table, free with freeDecodeTable
+*/
+struct DecodeTable* buildDecodeTable(struct SymbolNode* root);
+
+/*
+ * Builds the lookup table used for decoding straight from the code lengths 
+ * of a canonical code, without making a tree.
+ 
+ * const unsigned char* lengths - code length of each of the 256 symbols
+ 
+ * returns DecodeTable* - newly allocated table, free with freeDecodeTable
+ *                        NULL if the lengths don't make a valid code
+*/
+struct DecodeTable* buildCanonicalTable(const unsigned char* lengths);
+
+/*
+ * Fills in a lookup table for a canonical code like buildCanonicalTable,
+ * reusing the entries the table already has.
+ 
+ * struct DecodeTable* table - table to fill in, its old entries are lost
+ * const unsigned char* lengths - code length of each of the 256 symbols
+ 
+ * returns int - 1 if the table was filled in
+ *               0 if the lengths don't make a valid code
+*/
+int fillCanonicalTable(struct DecodeTable* table, const unsigned char* lengths);
+
+/*
+ * Frees a table created by buildDecodeTable
+ 
+ * struct DecodeTable* table - table to free
+*/
+void freeDecodeTable(struct DecodeTable* table);
+
+/*
+ * Fills in the multi-symbol entries of a table when its codes are short
+ * enough on average for a lookup to give several symbols
+ 
+ * struct DecodeTable* table - table whose entries were just filled in
+ 
+ * returns int - 1 if the table now uses its multi-symbol entries
+*/
+int fillMultiTable(struct DecodeTable* table);
+
+/*
+ * Writes the code lengths of all 256 symbols, run-length encoded. 
+ 
+ * unsigned char* dest - where to write, needs room for 256 bytes
+ * const unsigned char* lengths - code length of each symbol
+ 
+ * returns unsigned long - how many bytes were written
+*/
+unsigned long writeLengths(unsigned char* dest, const unsigned char* lengths);
+
+/*
+ * Reads code lengths written by writeLengths
+ 
+ * const unsigned char* src - bytes to read from
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* lengths - array of 256 filled with each symbol's length
+ 
+ * returns long - how many bytes were read, -1 if they are malformed
+*/
+long readLengthsFrom(const unsigned char* src, unsigned long srcLength, unsigned char* lengths);
+
+/*
+ * Encodes the raw bytes of a block into its packed buffer, split into
+ * parts where a new code pays for itself, each holding the code lengths
+ * followed by the encoded bits. The buffer must have room for
+ * MAX_LENGTHS_BYTES + MAX_STREAM_TABLE_BYTES + rawLength bytes. Blocks 
+ * asking for order-1 codes get them if they come out smaller. Also fills
+ * in the block's symbol counts. Works in the block's context.
+ 
+ * struct Block* block - block to encode, failed is set if it can't be
+*/
+void encodeBlock(struct Block* block);
+
+/*
+ * Decodes the packed bytes of a block into its raw buffer, which must
+ * already hold rawLength bytes. Works in the block's context.
+ 
+ * struct Block* block - block to decode, failed is set if it is corrupt
+*/
+void decodeBlock(struct Block* block);
+
+/*
+ * Decodes codes using a lookup table. May be called again with the same
+ * reader to carry on where the last call stopped.
+ 
+ * struct DecodeTable* table - lookup table for the codes
+ * struct BitReader* reader - where the encoded bits come from
+ * unsigned char* dest - where decoded symbols go
+ * unsigned long count - how many symbols to decode
+ 
+ * returns int - 1 if all symbols were decoded 
+ *               0 if the bits are corrupt or run out
+*/
+int decodeSymbols(struct DecodeTable* table, struct BitReader* reader,
+                  unsigned char* dest, unsigned long count);
+
+/*
+ * Creates a context for encoding and decoding buffers in memory
+ 
+ * int maxLength - longest code allowed when encoding, 0 for no limit
+ * int numThreads - threads to count symbols with, 1 to never allocate
+ 
+ * returns HuffContext* - newly allocated context, free with freeHuffContext
+*/
+struct HuffContext* createHuffContext(int maxLength, int numThreads);
+
+/*
+ * Frees a context and all of its scratch memory
+ 
+ * struct HuffContext* context - context to free
+*/
+void freeHuffContext(struct HuffContext* context);
+
+/*
+ * Gives the most bytes encodeBuffer can write for a buffer, so a 
+ * destination of this size always has room.
+ 
+ * unsigned long srcLength - bytes to be encoded
+ 
+ * returns unsigned long - largest possible encoded size
+*/
+unsigned long encodeBound(unsigned long srcLength);
+
+/*
+ * Encodes a buffer as a FORMAT_CANONICAL stream, the same bytes 
+ * huffencode -c writes for a file holding it.
+ 
+ * struct HuffContext* context - scratch memory, also keeps the code used
+ * const unsigned char* src - bytes to encode
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where the encoded stream goes
+ * unsigned long destCapacity - bytes dest holds, encodeBound is always enough
+ * unsigned long* destLength - set to how many bytes were written
+ 
+ * returns int - 1 if encoded
+ *               0 if dest is too small
+*/
+int encodeBuffer(struct HuffContext* context, const unsigned char* src, unsigned long srcLength,
+                 unsigned char* dest, unsigned long destCapacity, unsigned long* destLength);
+
+/*
+ * Finds how many bytes an encoded stream decodes to, from its headers
+ 
+ * const unsigned char* src - FORMAT_CANONICAL or FORMAT_BLOCKS stream
+ * unsigned long srcLength - how many bytes src holds
+ * uint64_t* length - set to the decoded length
+ 
+ * returns int - 1 if the length was found
+ *               0 if the stream is malformed or in another format
+*/
+int decodedLength(const unsigned char* src, unsigned long srcLength, uint64_t* length);
+
+/*
+ * Decodes a FORMAT_CANONICAL or FORMAT_BLOCKS stream held in memory
+ 
+ * struct HuffContext* context - scratch memory
+ * const unsigned char* src - encoded stream, starting with the magic bytes
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where decoded bytes go
+ * unsigned long destCapacity - bytes dest holds, see decodedLength
+ * unsigned long* destLength - set to how many bytes were decoded
+ 
+ * returns int - 1 if decoded
+ *               0 if the stream is corrupt or dest is too small
+*/
+int decodeBuffer(struct HuffContext* context, const unsigned char* src, unsigned long srcLength,
+                 unsigned char* dest, unsigned long destCapacity, unsigned long* destLength);
+
+/*
+ * Finds how many bytes the part of a stream after the magic bytes and 
+ * the format decodes to, for callers that have already read those.
+ 
+ * int format - FORMAT_CANONICAL or FORMAT_BLOCKS
+ * const unsigned char* src - stream after the format byte
+ * unsigned long srcLength - how many bytes src holds
+ * uint64_t* length - set to the decoded length
+ 
+ * returns int - 1 if the length was found
+ *               0 if the stream is malformed or in another format
+*/
+int formatLength(int format, const unsigned char* src, unsigned long srcLength, uint64_t* length);
+
+/*
+ * Decodes the part of a stream after the magic bytes and the format
+ 
+ * struct HuffContext* context - scratch memory
+ * int format - FORMAT_CANONICAL or FORMAT_BLOCKS
+ * const unsigned char* src - stream after the format byte
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where decoded bytes go
+ * unsigned long destCapacity - bytes dest holds
+ * unsigned long* destLength - set to how many bytes were decoded
+ 
+ * returns int - 1 if decoded
+ *               0 if the stream is corrupt or dest is too small
+*/
+int decodeFormat(struct HuffContext* context, int format, const unsigned char* src,
+                 unsigned long srcLength, unsigned char* dest, unsigned long destCapacity,
+                 unsigned long* destLength);
+
+/*
+ * Counts the symbols of a buffer and builds the canonical code for it in
+ * the context, within the context's length limit.
+ 
+ * struct HuffContext* context - gets the counts, lengths, codes and bits
+ * const unsigned char* src - bytes the code is for
+ * unsigned long srcLength - how many bytes src holds
+ 
+ * returns int - 1 if the code was built
+ *               0 if the length limit is out of range
+*/
+int buildContextCode(struct HuffContext* context, const unsigned char* src, unsigned long srcLength);
+
+/*
+ * Builds the canonical code for the symbol counts already in the
+ * context's freq, within the context's length limit
+ 
+ * struct HuffContext* context - holds the counts, gets the lengths, codes and bits
+ 
+ * returns int - 1 if the code was built
+ *               0 if the length limit is out of range
+*/
+int buildCountedCode(struct HuffContext* context);
+
+/*
+ * Counts the symbols of a block a segment at a time and picks where to
+ * split it, wherever the estimated bits of the parts and their headers
+ * come out at least 1/SPLIT_MIN_SAVING below those of the whole. Leaves the running counts at the
+ * end of each part in the context's splitFreq, so part p has the counts
+ * of row p + 1 less those of row p.
+ 
+ * struct Block* block - block to split, gets its parts' raw lengths
+ 
+ * returns int - how many parts the block is split into
+*/
+int findBlockSplits(struct Block* block);
+
+/*
+ * Writes the codes of a buffer with the code last built in the context,
+ * exactly (bits + 7) / 8 bytes of them.
+ 
+ * struct HuffContext* context - holds the code
+ * const unsigned char* src - bytes to encode, those the code was built for
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where the encoded bits go
+*/
+void writeContextSymbols(struct HuffContext* context, const unsigned char* src,
+                         unsigned long srcLength, unsigned char* dest);
+
+/*
+ * Decodes bits written with a canonical code of the given lengths, 
+ * using the context's decode table.
+ 
+ * struct HuffContext* context - scratch memory
+ * const unsigned char* lengths - code length of each of the 256 symbols
+ * const unsigned char* src - encoded bits
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where decoded symbols go
+ * unsigned long count - how many symbols to decode
+ 
+ * returns int - 1 if all symbols were decoded
+ *               0 if the lengths or bits are corrupt
+*/
+int decodeContextSymbols(struct HuffContext* context, const unsigned char* lengths,
+                         const unsigned char* src, unsigned long srcLength,
+                         unsigned char* dest, unsigned long count);
+
+/*
+ * Decodes codes dealt out to several streams, a symbol from each stream
+ * in turn, so the lookups of different streams can overlap.
+ 
+ * struct DecodeTable* table - lookup table for the codes
+ * struct BitReader* readers - a reader for every stream
+ * int numStreams - how many streams there are
+ * unsigned char* dest - where decoded symbols go
+ * unsigned long count - how many symbols to decode over all streams
+ 
+ * returns int - 1 if all symbols were decoded 
+ *               0 if the bits are corrupt or run out
+*/
+int decodeStreams(struct DecodeTable* table, struct BitReader* readers, int numStreams,
+                  unsigned char* dest, unsigned long count);
+
+/*
+ * Picks the decode loop written out for a table's bits, longest code
+ * and number of streams, if there is one
+ 
+ * const struct DecodeTable* table - table the codes will be decoded with
+ * int numStreams - how many streams the codes are dealt out to
+ 
+ * returns DecodeKernel - the kernel, NULL if the general loop has to do
+*/
+DecodeKernel findDecodeKernel(const struct DecodeTable* table, int numStreams);
+
+/*
+ * Decodes codes with a table's multi-symbol entries, giving as many
+ * symbols per lookup as fit in the window
+ 
+ * const struct DecodeTable* table - table with its multi-symbol entries in use
+ * struct BitReader* reader - where the encoded bits come from
+ * unsigned char* dest - where decoded symbols go
+ * unsigned long count - how many symbols to decode
+ 
+ * returns int - 1 if all symbols were decoded
+ *               0 if the bits are corrupt or run out
+*/
+int decodeMultiSymbols(const struct DecodeTable* table, struct BitReader* reader,
+                       unsigned char* dest, unsigned long count);
+
+/*
+ * Decodes the packed bytes of a block of any kind
+ 
+ * struct HuffContext* context - scratch memory
+ * int kind - BLOCK_HUFFMAN, BLOCK_STREAMS, BLOCK_ORDER1 or BLOCK_STORED
+ * const unsigned char* packed - code lengths followed by the encoded bits
+ * unsigned long packedLength - how many bytes packed holds
+ * unsigned char* raw - where the decoded bytes go
+ * unsigned long rawLength - how many bytes the block decodes to
+ 
+ * returns int - 1 if decoded
+ *               0 if the block is corrupt
+*/
+int decodePayload(struct HuffContext* context, int kind, const unsigned char* packed,
+                  unsigned long packedLength, unsigned char* raw, unsigned long rawLength);
+
+/*
+ * Gives the context's order-1 model, making it the first time it is needed
+ 
+ * struct HuffContext* context - context the model belongs to
+ 
+ * returns ContextModel* - the model, freed along with the context
+*/
+struct ContextModel* getContextModel(struct HuffContext* context);
+
+/*
+ * Frees an order-1 model and its decode tables
+ 
+ * struct ContextModel* model - model to free, may be NULL
+*/
+void freeContextModel(struct ContextModel* model);
+
+/*
+ * Builds order-1 codes for a buffer in the context's model: counts which
+ * bytes follow which, groups previous bytes into at most ORDER1_MAX_CODES
+ * clusters that share a code and writes the header of a BLOCK_ORDER1
+ * block to the model.
+ 
+ * struct HuffContext* context - scratch memory, gets the codes in its model
+ * const unsigned char* src - bytes the codes are for
+ * unsigned long srcLength - how many bytes src holds
+ 
+ * returns int - 1 if the codes were built
+ *               0 if src is empty or the length limit is out of range
+*/
+int buildOrder1Code(struct HuffContext* context, const unsigned char* src, unsigned long srcLength);
+
+/*
+ * Writes the codes of a buffer with the order-1 codes last built in the
+ * context's model, exactly (bits + 7) / 8 bytes of them.
+ 
+ * struct HuffContext* context - holds the codes
+ * const unsigned char* src - bytes to encode, those the codes were built for
+ * unsigned long srcLength - how many bytes src holds
+ * unsigned char* dest - where the encoded bits go
+*/
+void writeOrder1Symbols(struct HuffContext* context, const unsigned char* src,
+                        unsigned long srcLength, unsigned char* dest);
+
+/*
+ * Decodes the packed bytes of a BLOCK_ORDER1 block
+ 
+ * struct HuffContext* context - scratch memory
+ * const unsigned char* packed - order-1 header followed by the encoded bits
+ * unsigned long packedLength - how many bytes packed holds
+ * unsigned char* raw - where the decoded bytes go
+ * unsigned long rawLength - how many bytes the block decodes to
+ 
+ * returns int - 1 if decoded
+ *               0 if the block is corrupt
+*/
+int decodeOrder1(struct HuffContext* context, const unsigned char* packed,
+                 unsigned long packedLength, unsigned char* raw, unsigned long rawLength);
+
+/*
+ * Sets up a tree holding only the NYT leaf, which starts out as the root
+ 
+ * struct AdaptiveTree* tree - tree to set up
+*/
+void initAdaptiveTree(struct AdaptiveTree* tree);
+
+/*
+ * Counts one more of a symbol in the adaptive tree, adding a leaf for 
+ * it if it is new, and moves nodes around to keep it a huffman tree.
+ 
+ * struct AdaptiveTree* tree - tree to update
+ * int symbol - symbol that was just sent
+*/
+void updateAdaptiveTree(struct AdaptiveTree* tree, int symbol);
+
+/*
+ * Encodes a file with the adaptive code, reading it once from start
+ * to end, and ends the bits with ADAPTIVE_END.
+ 
+ * FILE* in - file to encode, may be a pipe
+ * FILE* out - file to write the encoded bits to
+ * unsigned long* freq - array of 256 filled with how often each symbol is seen
+ 
+ * returns unsigned long - how many symbols were encoded
+*/
+unsigned long encodeAdaptive(FILE* in, FILE* out, unsigned long* freq);
+
+/*
+ * Decodes bits written by encodeAdaptive
+ 
+ * FILE* in - file to decode, positioned at the first encoded bit
+ * FILE* out - file to write decoded characters to
+ 
+ * returns int - 1 if everything up to ADAPTIVE_END was decoded
+ *               0 if the bits are corrupt or run out first
+*/
+int decodeAdaptive(FILE* in, FILE* out);
+
+/*
+ * Gives the time on a clock that only moves forward, for timing phases
+ 
+ * returns double - seconds since some point in the past
+*/
+double wallClock(void);
+
+/*
+ * Sets every time, count and total of the stats back to 0
+ 
+ * struct CodecStats* stats - stats to clear
+*/
+void resetStats(struct CodecStats* stats);
+
+/*
+ * Starts timing a phase
+ 
+ * struct CodecStats* stats - stats the phase is timed into, may be NULL
+ 
+ * returns double - time the phase started, 0 if stats is NULL
+*/
+double startPhase(struct CodecStats* stats);
+
+/*
+ * Adds the time since startPhase and the bytes handled to a phase
+ 
+ * struct CodecStats* stats - stats to add to, nothing happens if NULL
+ * int phase - one of the PHASE_ values
+ * double start - what startPhase returned
+ * uint64_t bytes - bytes the phase read or wrote
+*/
+void endPhase(struct CodecStats* stats, int phase, double start, uint64_t bytes);
+
+/*
+ * Adds the symbols encoded with one code to the stats
+ 
+ * struct CodecStats* stats - stats to add to, nothing happens if NULL
+ * const unsigned long* freq - how often each of the 256 symbols was seen
+ * const unsigned char* lengths - code length of each symbol, NULL if 
+ *                                the code changes as it goes
+*/
+void addCodeStats(struct CodecStats* stats, const unsigned long* freq,
+                  const unsigned char* lengths);
+
+/*
+ * Adds the symbols decoded with one table to the stats
+ 
+ * struct CodecStats* stats - stats to add to, nothing happens if NULL
+ * const struct DecodeTable* table - table the symbols were decoded with
+ * uint64_t count - how many symbols were decoded
+*/
+void addTableStats(struct CodecStats* stats, const struct DecodeTable* table, uint64_t count);
+
+/*
+ * Adds the times, counts and totals of one set of stats to another
+ 
+ * struct CodecStats* total - stats to add to
+ * const struct CodecStats* part - stats to add
+*/
+void addStats(struct CodecStats* total, const struct CodecStats* part);
+
+/*
+ * Writes the stats as one line of JSON, with the time and bytes of every
+ * phase, the entropy against the bits spent per symbol, the longest and
+ * average code length and how much of the encoded file is headers.
+ 
+ * FILE* out - where to write the line
+ * const char* program - "huffencode" or "huffdecode"
+ * const struct CodecStats* stats - stats to write
+*/
+void writeStatsJson(FILE* out, const char* program, const struct CodecStats* stats);
+
+/*
+ * Builds a dictionary from the byte counts of a training corpus. The 
+ * first byte that never appears becomes the escape, with a code of its
+ * own standing for every byte that has none.
+ 
+ * struct Dictionary* dict - dictionary to fill in
+ * const unsigned long* freq - how often each byte appears in the corpus
+ * int maxLength - longest code allowed, 0 for DICT_MAX_LENGTH
+ 
+ * returns int - 1 if the dictionary was built
+ *               0 if maxLength is out of range
+*/
+int trainDictionary(struct Dictionary* dict, const unsigned long* freq, int maxLength);
+
+/*
+ * Adds the byte counts of one training file, or the counts listed in it
+ * if it is a table printed by huffencode -p
+ 
+ * FILE* in - training file
+ * unsigned long* freq - array of 256 counts to add to
+ 
+ * returns unsigned long - how many bytes the counts added up to
+*/
+unsigned long countTrainingFile(FILE* in, unsigned long* freq);
+
+/*
+ * Writes a dictionary file
+ 
+ * const struct Dictionary* dict - dictionary to write
+ * FILE* out - file to write it to
+ 
+ * returns int - 1 if written
+ *               0 if the file couldn't be written
+*/
+int saveDictionary(const struct Dictionary* dict, FILE* out);
+
+/*
+ * Reads a dictionary file written by saveDictionary
+ 
+ * struct Dictionary* dict - dictionary to fill in
+ * FILE* in - dictionary file
+ 
+ * returns int - 1 if read
+ *               0 if it isn't a dictionary or is corrupt
+*/
+int loadDictionary(struct Dictionary* dict, FILE* in);
+
+/*
+ * Writes the codes of a buffer with a dictionary
+ 
+ * const struct Dictionary* dict - dictionary to encode with
+ * const unsigned char* src - bytes to encode
+ * unsigned long srcLength - how many bytes src holds
+ * struct BitWriter* writer - where the bits go, not flushed
+ 
+ * returns uint64_t - how many bits were written
+ *                    (uint64_t)-1 if a byte has no code and there is no escape
+*/
+uint64_t encodeDictionary(const struct Dictionary* dict, const unsigned char* src,
+                          unsigned long srcLength, struct BitWriter* writer);
+
+/*
+ * Decodes bits written with a dictionary. May be called again with the
+ * same reader to carry on where the last call stopped.
+ 
+ * const struct Dictionary* dict - dictionary the bits were written with
+ * struct DecodeTable* table - lookup table made from the dictionary's lengths
+ * struct BitReader* reader - where the encoded bits come from
+ * unsigned char* dest - where decoded bytes go
+ * unsigned long count - how many bytes to decode
+ 
+ * returns int - 1 if all bytes were decoded
+ *               0 if the bits are corrupt or run out
+*/
+int decodeDictionary(const struct Dictionary* dict, struct DecodeTable* table,
+                     struct BitReader* reader, unsigned char* dest, unsigned long count);
+
+/*
+ * Writes a number 7 bits a byte, with the top bit set on all but the last
+ 
+ * FILE* out - file to write to
+ * uint64_t value - number to write
+ 
+ * returns unsigned long - how many bytes were written
+*/
+unsigned long writeVarint(FILE* out, uint64_t value);
+
+/*
+ * Reads a number written by writeVarint
+ 
+ * FILE* in - file to read from
+ * uint64_t* value - set to the number
+ 
+ * returns int - 1 if read
+ *               0 if the file ends first or the number is too long
+*/
+int readVarint(FILE* in, uint64_t* value);
+
+/*
+ * Encodes or decodes many files in one run, on several threads that each
+ * reuse their own context and buffers from file to file. Inputs may be 
+ * files, directories or "-" for a list of names on standard input. 
+ * Outputs go in outDir named after their inputs, and the total bytes and
+ * throughput are written to standard error at the end.
+ 
+ * int encoding - 1 to encode to the canonical format, 0 to decode
+ * const char* outDir - directory the output files go in
+ * char** inputs - files, directories or "-"
+ * int numInputs - how many inputs there are
+ * int numThreads - threads to work on files at the same time
+ * int maxLength - longest code allowed when encoding, 0 for no limit
+ 
+ * returns int - 1 if every file was done
+ *               0 if any couldn't be read, written or decoded
+*/
+int runBatch(int encoding, const char* outDir, char** inputs, int numInputs,
+             int numThreads, int maxLength);
+
+/*
+ * Gets how many processors are online, a good default number of threads
+ 
+ * returns int - number of processors, at least 1
+*/
+int countProcessors(void);
+
+/*
+ * Creates a pool of worker threads that wait for batches of tasks.
+ 
+ * int numThreads - how many threads to run tasks on
+ 
+ * returns ThreadPool* - newly created pool, free with freeThreadPool
+*/
+struct ThreadPool* createThreadPool(int numThreads);
+
+/*
+ * Runs task for every index from 0 up to numTasks and waits for all of
+ * them to finish. Tasks may run in any order and at the same time.
+ 
+ * struct ThreadPool* pool - pool to run the tasks on
+ * TaskFunction task - function to run for each index
+ * void* context - passed along to every call of task
+ * unsigned long numTasks - how many tasks are in the batch
+*/
+void runTasks(struct ThreadPool* pool, TaskFunction task, void* context, unsigned long numTasks);
+
+/*
+ * Stops the worker threads and frees the pool
+ 
+ * struct ThreadPool* pool - pool to free
+*/
+void freeThreadPool(struct ThreadPool* pool);
+
+/*
+ * Runs batches through reading, coding and writing, with each stage on
+ * a different batch at the same time, in PIPELINE_DEPTH slots
+ 
+ * void* context - passed along to every stage
+ * StageFunction read - fills a slot with the next batch, 0 if there are no more
+ * StageFunction code - codes the batch in a slot, run on the calling thread
+ * StageFunction write - writes out the batch in a slot, 0 to stop everything
+*/
+void runPipeline(void* context, StageFunction read, StageFunction code, StageFunction write);
 #endif
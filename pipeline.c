@@ -0,0 +1,195 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for overlapping reading, coding and writing.
+ * Batches of work go through PIPELINE_DEPTH slots in turn: a reader
+ * thread fills a free slot, the calling thread codes it, and a writer
+ * thread writes it out and frees the slot again. With a slot in each
+ * stage, the disk and the coding threads are kept busy at the same time
+ * and a run takes about as long as the slowest stage instead of all
+ * three added up. Slots are only ever handed from one stage to the
+ * next, in order, so memory stays at PIPELINE_DEPTH batches.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "huffman.h"
+
+/* What a slot is waiting for */
+#define SLOT_FREE 0 /* to be read into */
+#define SLOT_READ 1 /* to be coded */
+#define SLOT_CODED 2 /* to be written */
+
+struct Pipeline
+{
+  pthread_mutex_t lock; /* guards everything below */
+  pthread_cond_t changed; /* signalled whenever a slot or stage finishes */
+  int state[PIPELINE_DEPTH]; /* SLOT_ value of each slot */
+  unsigned long numRead; /* batches the reader read, once it has ended */
+  unsigned long numCoded; /* batches coded, once coding has ended */
+  int readEnded; /* the reader won't read any more batches */
+  int codeEnded; /* no more batches will be coded */
+  int stopped; /* the writer failed, every stage stops */
+  StageFunction read, code, write;
+  void* context;
+};
+
+/* Function Declarations */
+void* readerMain(void* arg);
+void* writerMain(void* arg);
+int waitForSlot(struct Pipeline* pipeline, unsigned long batch, int state,
+                int* ended, unsigned long* numBatches);
+void finishSlot(struct Pipeline* pipeline, unsigned long batch, int state);
+
+/*
+ * Waits until a batch's slot reaches a state, or until the stage before
+ * has ended without getting to it
+
+ * struct Pipeline* pipeline - pipeline the slot is in
+ * unsigned long batch - number of the batch, its slot is batch % PIPELINE_DEPTH
+ * int state - SLOT_ value to wait for
+ * int* ended - flag set once the stage before has ended, NULL for none
+ * unsigned long* numBatches - batches the stage before got through
+
+ * returns int - 1 if the slot got there, 0 if the pipeline is done
+*/
+int waitForSlot(struct Pipeline* pipeline, unsigned long batch, int state,
+                int* ended, unsigned long* numBatches)
+{
+  int slot = (int)(batch % PIPELINE_DEPTH);
+  int ready;
+
+  pthread_mutex_lock(&pipeline->lock);
+  while(pipeline->state[slot] != state && !pipeline->stopped &&
+        !(ended != NULL && *ended && batch >= *numBatches))
+  {
+    pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+  }
+  ready = (pipeline->state[slot] == state) && !pipeline->stopped;
+  pthread_mutex_unlock(&pipeline->lock);
+  return ready;
+}
+
+/*
+ * Moves a batch's slot on to its next state
+
+ * struct Pipeline* pipeline - pipeline the slot is in
+ * unsigned long batch - number of the batch
+ * int state - SLOT_ value it now has
+*/
+void finishSlot(struct Pipeline* pipeline, unsigned long batch, int state)
+{
+  pthread_mutex_lock(&pipeline->lock);
+  pipeline->state[batch % PIPELINE_DEPTH] = state;
+  pthread_cond_broadcast(&pipeline->changed);
+  pthread_mutex_unlock(&pipeline->lock);
+}
+
+/*
+ * Reads batches into free slots until the read stage says there are
+ * no more, or the pipeline stops
+
+ * void* arg - the pipeline
+
+ * returns void* - NULL
+*/
+void* readerMain(void* arg)
+{
+  struct Pipeline* pipeline = (struct Pipeline*)arg;
+  unsigned long batch;
+
+  for(batch = 0; waitForSlot(pipeline, batch, SLOT_FREE, NULL, NULL); batch++)
+  {
+    if(!pipeline->read(pipeline->context, (int)(batch % PIPELINE_DEPTH))) break;
+    finishSlot(pipeline, batch, SLOT_READ);
+  }
+
+  pthread_mutex_lock(&pipeline->lock);
+  pipeline->numRead = batch;
+  pipeline->readEnded = 1;
+  pthread_cond_broadcast(&pipeline->changed);
+  pthread_mutex_unlock(&pipeline->lock);
+  return NULL;
+}
+
+/*
+ * Writes coded batches out in order, freeing their slots, until coding
+ * has ended or a write fails
+
+ * void* arg - the pipeline
+
+ * returns void* - NULL
+*/
+void* writerMain(void* arg)
+{
+  struct Pipeline* pipeline = (struct Pipeline*)arg;
+  unsigned long batch;
+
+  for(batch = 0; waitForSlot(pipeline, batch, SLOT_CODED, &pipeline->codeEnded,
+                             &pipeline->numCoded); batch++)
+  {
+    if(!pipeline->write(pipeline->context, (int)(batch % PIPELINE_DEPTH)))
+    {
+      pthread_mutex_lock(&pipeline->lock);
+      pipeline->stopped = 1;
+      pthread_cond_broadcast(&pipeline->changed);
+      pthread_mutex_unlock(&pipeline->lock);
+      break;
+    }
+    finishSlot(pipeline, batch, SLOT_FREE);
+  }
+  return NULL;
+}
+
+/*
+ * Runs batches through reading, coding and writing, each stage working
+ * on a different batch at the same time. Batches are read, coded and
+ * written in order, and a stage only ever sees one slot at a time, so
+ * stages need no locking of their own. Reading stops once read returns
+ * 0, and every stage stops once write returns 0.
+
+ * void* context - passed along to every stage
+ * StageFunction read - fills a slot with the next batch, 0 if there are no more
+ * StageFunction code - codes the batch in a slot, run on the calling thread
+ * StageFunction write - writes out the batch in a slot, 0 to stop everything
+*/
+void runPipeline(void* context, StageFunction read, StageFunction code, StageFunction write)
+{
+  struct Pipeline pipeline;
+  pthread_t reader, writer;
+  unsigned long batch;
+  int slot;
+
+  pthread_mutex_init(&pipeline.lock, NULL);
+  pthread_cond_init(&pipeline.changed, NULL);
+  for(slot = 0; slot < PIPELINE_DEPTH; slot++) pipeline.state[slot] = SLOT_FREE;
+  pipeline.numRead = 0;
+  pipeline.numCoded = 0;
+  pipeline.readEnded = 0;
+  pipeline.codeEnded = 0;
+  pipeline.stopped = 0;
+  pipeline.read = read;
+  pipeline.code = code;
+  pipeline.write = write;
+  pipeline.context = context;
+
+  pthread_create(&reader, NULL, readerMain, &pipeline);
+  pthread_create(&writer, NULL, writerMain, &pipeline);
+
+  for(batch = 0; waitForSlot(&pipeline, batch, SLOT_READ, &pipeline.readEnded,
+                             &pipeline.numRead); batch++)
+  {
+    code(context, (int)(batch % PIPELINE_DEPTH));
+    finishSlot(&pipeline, batch, SLOT_CODED);
+  }
+
+  pthread_mutex_lock(&pipeline.lock);
+  pipeline.numCoded = batch;
+  pipeline.codeEnded = 1;
+  pthread_cond_broadcast(&pipeline.changed);
+  pthread_mutex_unlock(&pipeline.lock);
+
+  pthread_join(reader, NULL);
+  pthread_join(writer, NULL);
+  pthread_mutex_destroy(&pipeline.lock);
+  pthread_cond_destroy(&pipeline.changed);
+}
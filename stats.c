@@ -0,0 +1,214 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for timing the phases of encoding and
+ * decoding and reporting them, along with how close the codes came to
+ * the entropy of the input, as a line of JSON. The codecs only take the
+ * time when they are handed a CodecStats, so nothing is measured unless
+ * --stats=json asks for it.
+*/
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "huffman.h"
+
+/*
+ * Gives the time on a clock that only moves forward, for timing phases
+
+ * returns double - seconds since some point in the past
+*/
+double wallClock(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/*
+ * Sets every time, count and total of the stats back to 0
+
+ * struct CodecStats* stats - stats to clear
+*/
+void resetStats(struct CodecStats* stats)
+{
+  int i;
+  for(i = 0; i < NUM_PHASES; i++)
+  {
+    stats->seconds[i] = 0;
+    stats->bytes[i] = 0;
+  }
+  for(i = 0; i < 256; i++) stats->freq[i] = 0;
+  stats->symbols = 0;
+  stats->codeBits = 0;
+  stats->longest = 0;
+  stats->inputBytes = 0;
+  stats->outputBytes = 0;
+  stats->totalSeconds = 0;
+  stats->format = -1;
+}
+
+/*
+ * Starts timing a phase
+
+ * struct CodecStats* stats - stats the phase is timed into, may be NULL
+
+ * returns double - time the phase started, 0 if stats is NULL
+*/
+double startPhase(struct CodecStats* stats)
+{
+  return (stats == NULL) ? 0 : wallClock();
+}
+
+/*
+ * Adds the time since startPhase and the bytes handled to a phase
+
+ * struct CodecStats* stats - stats to add to, nothing happens if NULL
+ * int phase - one of the PHASE_ values
+ * double start - what startPhase returned
+ * uint64_t bytes - bytes the phase read or wrote
+*/
+void endPhase(struct CodecStats* stats, int phase, double start, uint64_t bytes)
+{
+  if(stats == NULL) return;
+  stats->seconds[phase] += wallClock() - start;
+  stats->bytes[phase] += bytes;
+}
+
+/*
+ * Adds the symbols encoded with one code to the stats
+
+ * struct CodecStats* stats - stats to add to, nothing happens if NULL
+ * const unsigned long* freq - how often each of the 256 symbols was seen
+ * const unsigned char* lengths - code length of each symbol, NULL if
+ *                                the code changes as it goes
+*/
+void addCodeStats(struct CodecStats* stats, const unsigned long* freq,
+                  const unsigned char* lengths)
+{
+  int i;
+  if(stats == NULL) return;
+
+  for(i = 0; i < 256; i++)
+  {
+    stats->freq[i] += freq[i];
+    stats->symbols += freq[i];
+    if(lengths == NULL) continue;
+    stats->codeBits += (uint64_t)freq[i] * lengths[i];
+    if(freq[i] > 0 && lengths[i] > stats->longest) stats->longest = lengths[i];
+  }
+}
+
+/*
+ * Adds the symbols decoded with one table to the stats
+
+ * struct CodecStats* stats - stats to add to, nothing happens if NULL
+ * const struct DecodeTable* table - table the symbols were decoded with
+ * uint64_t count - how many symbols were decoded
+*/
+void addTableStats(struct CodecStats* stats, const struct DecodeTable* table, uint64_t count)
+{
+  if(stats == NULL) return;
+  stats->symbols += count;
+  if(count > 0 && (int)table->longest > stats->longest) stats->longest = (int)table->longest;
+}
+
+/*
+ * Adds the times, counts and totals of one set of stats to another,
+ * for codecs that ran on several threads with stats of their own
+
+ * struct CodecStats* total - stats to add to
+ * const struct CodecStats* part - stats to add
+*/
+void addStats(struct CodecStats* total, const struct CodecStats* part)
+{
+  int i;
+  for(i = 0; i < NUM_PHASES; i++)
+  {
+    total->seconds[i] += part->seconds[i];
+    total->bytes[i] += part->bytes[i];
+  }
+  for(i = 0; i < 256; i++) total->freq[i] += part->freq[i];
+  total->symbols += part->symbols;
+  total->codeBits += part->codeBits;
+  if(part->longest > total->longest) total->longest = part->longest;
+}
+
+/*
+ * Writes the stats as one line of JSON. Every phase is listed, with 0
+ * for those the program didn't go through. The entropy comes from the
+ * symbol counts, which only the encoder keeps, and the bits
+ * per symbol count the encoded bits without the headers, which are
+ * reported apart as header_bytes and their share of the encoded file.
+ * Anything that couldn't be measured, like sizes of adaptive codes on
+ * pipes, is null.
+
+ * FILE* out - where to write the line
+ * const char* program - "huffencode" or "huffdecode"
+ * const struct CodecStats* stats - stats to write
+*/
+void writeStatsJson(FILE* out, const char* program, const struct CodecStats* stats)
+{
+  const char* phaseNames[NUM_PHASES] =
+  {
+    "count", "tree", "header_write", "encode", "header_parse", "decode"
+  };
+  const char* formatNames[5] = {"legacy", "canonical", "blocks", "adaptive", "dictionary"};
+  int encoding = (strcmp(program, "huffencode") == 0);
+  uint64_t encodedBytes = encoding ? stats->outputBytes : stats->inputBytes;
+  uint64_t payloadBytes = encoding ? stats->bytes[PHASE_ENCODE] : stats->bytes[PHASE_DECODE];
+  uint64_t headerBytes = (encodedBytes > payloadBytes) ? encodedBytes - payloadBytes : 0;
+  double entropy = 0;
+  int i;
+
+  fprintf(out, "{\"program\":\"%s\",\"format\":\"%s\",\"seconds\":%.6f,", program,
+          (stats->format >= 0 && stats->format < 5) ? formatNames[stats->format] : "unknown",
+          stats->totalSeconds);
+  fprintf(out, "\"input_bytes\":%lu,\"output_bytes\":%lu,\"phases\":{",
+          (unsigned long)stats->inputBytes, (unsigned long)stats->outputBytes);
+  for(i = 0; i < NUM_PHASES; i++)
+  {
+    fprintf(out, "%s\"%s\":{\"seconds\":%.6f,\"bytes\":%lu}", (i > 0) ? "," : "",
+            phaseNames[i], stats->seconds[i], (unsigned long)stats->bytes[i]);
+  }
+  fprintf(out, "},\"symbols\":%lu,", (unsigned long)stats->symbols);
+
+  if(stats->symbols > 0 && encoding)
+  {
+    for(i = 0; i < 256; i++)
+    {
+      double p = (double)stats->freq[i] / (double)stats->symbols;
+      if(stats->freq[i] > 0) entropy -= p * log(p) / log(2.0);
+    }
+    fprintf(out, "\"entropy_bits_per_symbol\":%.6f,", entropy);
+  }
+  else fprintf(out, "\"entropy_bits_per_symbol\":null,");
+
+  if(stats->symbols > 0 && payloadBytes > 0)
+  {
+    fprintf(out, "\"bits_per_symbol\":%.6f,", 8.0 * (double)payloadBytes / (double)stats->symbols);
+  }
+  else fprintf(out, "\"bits_per_symbol\":null,");
+
+  if(stats->symbols > 0 && stats->codeBits > 0)
+  {
+    fprintf(out, "\"average_code_length\":%.6f,",
+            (double)stats->codeBits / (double)stats->symbols);
+  }
+  else fprintf(out, "\"average_code_length\":null,");
+  if(stats->longest > 0) fprintf(out, "\"max_code_length\":%d,", stats->longest);
+  else fprintf(out, "\"max_code_length\":null,");
+
+  if(encodedBytes > 0)
+  {
+    fprintf(out, "\"header_bytes\":%lu,\"header_overhead\":%.6f}\n", (unsigned long)headerBytes,
+            (double)headerBytes / (double)encodedBytes);
+  }
+  else fprintf(out, "\"header_bytes\":null,\"header_overhead\":null}\n");
+}
@@ -0,0 +1,306 @@
+/*
+ * Andrew Geyko
+ * This file is responsible for running batches of independent tasks,
+ * such as encoding or decoding blocks, across several threads. Each
+ * worker starts with an even share of the batch and once it runs out,
+ * steals half of what is left from the worker with the most remaining,
+ * so blocks that take longer than others don't leave threads idle.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "huffman.h"
+
+/* Tasks left for one worker, it takes from the front and others steal
+ * from the back */
+struct TaskRange
+{
+  unsigned long next; /* next task to run */
+  unsigned long end; /* one past the last task */
+  pthread_mutex_t lock;
+};
+
+/* Everything a worker thread needs to find its work */
+struct Worker
+{
+  struct ThreadPool* pool;
+  int id; /* index of this worker's range */
+};
+
+struct ThreadPool
+{
+  int numThreads;
+  pthread_t* threads;
+  struct Worker* workers;
+  struct TaskRange* ranges; /* one per worker */
+  pthread_mutex_t lock; /* guards everything below */
+  pthread_cond_t start; /* signalled when a batch is handed out */
+  pthread_cond_t done; /* signalled when the last worker finishes */
+  unsigned long batch; /* counts batches handed out so far */
+  int busy; /* workers still working on the current batch */
+  int stopping; /* set when the pool is being freed */
+  TaskFunction task;
+  void* context;
+};
+
+/* Function Declarations */
+void* workerMain(void* arg);
+int takeTask(struct TaskRange* range, unsigned long* index);
+int stealTasks(struct ThreadPool* pool, int id);
+
+/*
+ * Gets how many processors are online, a good default number of threads
+
+ * returns int - number of processors, at least 1
+*/
+int countProcessors(void)
+{
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return (count < 1) ? 1 : (int)count;
+}
+
+/*
+ * Creates a pool of worker threads that wait for batches of tasks.
+ * A pool of one thread runs tasks on the calling thread instead.
+
+ * int numThreads - how many threads to run tasks on
+
+ * returns ThreadPool* - newly created pool, free with freeThreadPool
+*/
+struct ThreadPool* createThreadPool(int numThreads)
+{
+  struct ThreadPool* pool = (struct ThreadPool*)malloc(sizeof(struct ThreadPool));
+  int i;
+
+  if(numThreads < 1) numThreads = 1;
+  pool->numThreads = numThreads;
+  pool->batch = 0;
+  pool->busy = 0;
+  pool->stopping = 0;
+  pool->threads = NULL;
+  pool->workers = NULL;
+  pool->ranges = NULL;
+  if(numThreads == 1) return pool;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * numThreads);
+  pool->workers = (struct Worker*)malloc(sizeof(struct Worker) * numThreads);
+  pool->ranges = (struct TaskRange*)malloc(sizeof(struct TaskRange) * numThreads);
+
+  for(i = 0; i < numThreads; i++)
+  {
+    pool->ranges[i].next = 0;
+    pool->ranges[i].end = 0;
+    pthread_mutex_init(&pool->ranges[i].lock, NULL);
+    pool->workers[i].pool = pool;
+    pool->workers[i].id = i;
+  }
+  for(i = 0; i < numThreads; i++)
+  {
+    pthread_create(&pool->threads[i], NULL, workerMain, &pool->workers[i]);
+  }
+  return pool;
+}
+
+/*
+ * Runs task for every index from 0 up to numTasks and waits for all of
+ * them to finish. Tasks may run in any order and at the same time.
+
+ * struct ThreadPool* pool - pool to run the tasks on
+ * TaskFunction task - function to run for each index
+ * void* context - passed along to every call of task
+ * unsigned long numTasks - how many tasks are in the batch
+*/
+void runTasks(struct ThreadPool* pool, TaskFunction task, void* context, unsigned long numTasks)
+{
+  unsigned long share, extra, start = 0;
+  int i;
+
+  if(pool->numThreads == 1)
+  {
+    unsigned long index;
+    for(index = 0; index < numTasks; index++) task(context, index);
+    return;
+  }
+
+  /* Handing out an even share to every worker, the first few get one more */
+  share = numTasks / pool->numThreads;
+  extra = numTasks % pool->numThreads;
+  for(i = 0; i < pool->numThreads; i++)
+  {
+    struct TaskRange* range = &pool->ranges[i];
+    pthread_mutex_lock(&range->lock);
+    range->next = start;
+    start += share + ((unsigned long)i < extra ? 1 : 0);
+    range->end = start;
+    pthread_mutex_unlock(&range->lock);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->context = context;
+  pool->busy = pool->numThreads;
+  pool->batch++;
+  pthread_cond_broadcast(&pool->start);
+  while(pool->busy > 0) pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Takes the next task off the front of a range
+
+ * struct TaskRange* range - range to take from
+ * unsigned long* index - set to the task taken
+
+ * returns int - 1 if a task was taken
+ *               0 if the range is empty
+*/
+int takeTask(struct TaskRange* range, unsigned long* index)
+{
+  int taken = 0;
+  pthread_mutex_lock(&range->lock);
+  if(range->next < range->end)
+  {
+    *index = range->next++;
+    taken = 1;
+  }
+  pthread_mutex_unlock(&range->lock);
+  return taken;
+}
+
+/*
+ * Moves the back half of the fullest other range into a worker's own
+ * (empty) range. The owner of a range takes tasks from its front and
+ * thieves take them from its back, so the owner keeps working on tasks
+ * next to each other.
+
+ * struct ThreadPool* pool - pool the worker belongs to
+ * int id - index of the worker doing the stealing
+
+ * returns int - 1 if any tasks were stolen
+ *               0 if every range is empty
+*/
+int stealTasks(struct ThreadPool* pool, int id)
+{
+  while(1)
+  {
+    struct TaskRange* victim = NULL;
+    unsigned long most = 0, first = 0, last = 0;
+    int i;
+
+    /* Sizes are only a hint here, they get checked again under the lock */
+    for(i = 0; i < pool->numThreads; i++)
+    {
+      struct TaskRange* range = &pool->ranges[i];
+      unsigned long left;
+      if(i == id) continue;
+      pthread_mutex_lock(&range->lock);
+      left = range->end - range->next;
+      pthread_mutex_unlock(&range->lock);
+      if(left > most)
+      {
+        most = left;
+        victim = range;
+      }
+    }
+    if(victim == NULL) return 0;
+
+    pthread_mutex_lock(&victim->lock);
+    if(victim->next < victim->end)
+    {
+      last = victim->end;
+      first = last - (last - victim->next + 1) / 2;
+      victim->end = first;
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    /* Somebody else emptied it first, look again */
+    if(first == last) continue;
+
+    pthread_mutex_lock(&pool->ranges[id].lock);
+    pool->ranges[id].next = first;
+    pool->ranges[id].end = last;
+    pthread_mutex_unlock(&pool->ranges[id].lock);
+    return 1;
+  }
+}
+
+/*
+ * Body of every worker thread, waits for a batch, works through its own
+ * range and whatever it can steal, then reports that it is done.
+
+ * void* arg - the Worker describing this thread
+
+ * returns void* - always NULL
+*/
+void* workerMain(void* arg)
+{
+  struct Worker* worker = (struct Worker*)arg;
+  struct ThreadPool* pool = worker->pool;
+  unsigned long seen = 0; /* last batch this worker took part in */
+
+  while(1)
+  {
+    TaskFunction task;
+    void* context;
+    unsigned long index;
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->batch == seen && !pool->stopping) pthread_cond_wait(&pool->start, &pool->lock);
+    if(pool->stopping)
+    {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    seen = pool->batch;
+    task = pool->task;
+    context = pool->context;
+    pthread_mutex_unlock(&pool->lock);
+
+    do
+    {
+      while(takeTask(&pool->ranges[worker->id], &index)) task(context, index);
+    } while(stealTasks(pool, worker->id));
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy--;
+    if(pool->busy == 0) pthread_cond_signal(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/*
+ * Stops the worker threads and frees the pool
+
+ * struct ThreadPool* pool - pool to free
+*/
+void freeThreadPool(struct ThreadPool* pool)
+{
+  int i;
+  if(pool == NULL) return;
+
+  if(pool->numThreads > 1)
+  {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(i = 0; i < pool->numThreads; i++)
+    {
+      pthread_join(pool->threads[i], NULL);
+      pthread_mutex_destroy(&pool->ranges[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+  }
+
+  free(pool->threads);
+  free(pool->workers);
+  free(pool->ranges);
+  free(pool);
+}
@@ -8,17 +8,15 @@
 */
 #include <stdio.h> 
 #include <stdlib.h> 
+#include <stdint.h>
 #include "huffman.h" 
 
 /* Function Declarations */
 struct SymbolNode* makeSymbol(unsigned long freq, unsigned char symbol);
-struct SymbolNode* insertPriority(struct SymbolNode* head, struct SymbolNode* insertNode);
-unsigned char smallestValue(struct SymbolNode* root);
-struct SymbolNode* buildTree(struct SymbolNode* head);
-struct SymbolNode* combineNodes(struct SymbolNode* left, struct SymbolNode* right);
-struct SymbolNode* popPriority(struct SymbolNode** head);
-void fillCodes(struct SymbolNode* root, int direction, int depth, unsigned char* prevCode);
-void printPriority(struct SymbolNode* head);
+int sortSymbols(const unsigned long* freq, unsigned char* symbols);
+struct SymbolNode* buildTree(struct SymbolNode* leaves, int numLeaves,
+                             struct SymbolNode* combined, unsigned char* leftmost);
+void fillCodes(struct SymbolNode* root, int direction, int depth, uint64_t prevCode);
 void printTree(struct SymbolNode* root, int level);
 
 /* 
@@ -31,132 +29,115 @@ void printTree(struct SymbolNode* root, int level);
 */
 struct SymbolNode* makeSymbol(unsigned long freq, unsigned char symbol)
 {
-  int i;
   struct SymbolNode* newNode = (struct SymbolNode*)malloc(sizeof(struct SymbolNode));
   newNode->freq = freq; 
   newNode->symbol = symbol;
   newNode->length = 0;
-  newNode->next = NULL; 
+  newNode->code = 0;
   newNode->left = NULL; 
   newNode->right = NULL; 
-  for(i = 0; i < 256; i++) newNode->code[i] = 0;
   
   return newNode;
 }
 
-/* 
- * Inserts a new node into the priority queue into its correct place.
- * Uses the same algorithm as implemented in list and trees project.
-
- * struct SymbolNode* head - head of the priority queue 
- * struct SymbolNode* insertNode - node to insert into queue 
+/*
+ * Lists the symbols that appear, lightest first and the smaller symbol
+ * first on a tie. A shell sort works in place, where qsort may allocate,
+ * and takes far fewer steps than an insertion sort over 256 symbols.
  
- * return SymbolNode* - new head of priority queue
+ * const unsigned long* freq - frequency of each of the 256 symbols
+ * unsigned char* symbols - array of 256 filled with the sorted symbols
+ 
+ * returns int - how many symbols appear
 */
-struct SymbolNode* insertPriority(struct SymbolNode* head, struct SymbolNode* insertNode)
+int sortSymbols(const unsigned long* freq, unsigned char* symbols)
 {
-  /* If head is empty or insertNode is less than head, insert before*/
-  if(head == NULL || insertNode->freq < head->freq)
-  {
-    insertNode->next = head;
-    return insertNode; 
-  }
-  /* If insert is strictly greater than head, keep going */
-  else if(insertNode->freq > head->freq)
+  static const int gaps[] = {57, 23, 10, 4, 1};
+  int numSymbols = 0;
+  int g, i, j;
+
+  for(i = 0; i < 256; i++)
   {
-    head->next = insertPriority(head->next, insertNode); 
+    if(freq[i] != 0) symbols[numSymbols++] = (unsigned char)i;
   }
-  /* If head and insert are equal, do the tie breaker */
-  else
+  for(g = 0; g < 5; g++)
   {
-    unsigned char insertSmall = smallestValue(insertNode);
-    unsigned char headSmall = smallestValue(head); 
-    if(insertSmall < headSmall) 
+    int gap = gaps[g];
+    for(i = gap; i < numSymbols; i++)
     {
-      insertNode->next = head; 
-      return insertNode; 
+      unsigned char symbol = symbols[i];
+      for(j = i; j >= gap; j -= gap)
+      {
+        unsigned char other = symbols[j-gap];
+        if(freq[other] < freq[symbol] || (freq[other] == freq[symbol] && other < symbol)) break;
+        symbols[j] = other;
+      }
+      symbols[j] = symbol;
     }
-    else head->next = insertPriority(head->next, insertNode);
   }
-
-  return head; 
+  return numSymbols;
 }
 
 /*
- * Given a root of a tree, returns the smallest value 
- * in that tree. Useful for the tiebreaker in the priority queue.
+ * Builds the huffman tree in linear time once the leaves are sorted.
+ * The two lightest nodes are always at the front of one of two queues: 
+ * the leaves, and the combined nodes in the order they were made, which
+ * come out in order of weight too. Ties go to the node whose leftmost
+ * leaf has the smaller symbol, and since nodes of the same weight get 
+ * made in that order as well, the front of each queue is all that ever 
+ * needs comparing. The first node taken becomes the left child.
  
- * struct SymbolNode* root - root of partial (or full) Huffman Tree
+ * struct SymbolNode* leaves - leaves sorted by compareLeaves
+ * int numLeaves - how many leaves there are, at least 2
+ * struct SymbolNode* combined - room for numLeaves-1 combined nodes
+ * unsigned char* leftmost - room for the leftmost symbol of each combined node
  
- * return unsigned char - leftmost (smallest) symbol in tree
+ * returns SymbolNode* - root of the tree, the last combined node
 */
-unsigned char smallestValue(struct SymbolNode* root)
+struct SymbolNode* buildTree(struct SymbolNode* leaves, int numLeaves,
+                             struct SymbolNode* combined, unsigned char* leftmost)
 {
-  if(root->left == NULL) return root->symbol;
-  else return smallestValue(root->left);
-}
-
-/*
- * Given a priority queue, reduces the priority queue into
- * a single node representing the Huffman Tree. 
- 
- * struct SymbolNode* head - start of the priority queue 
- 
- * returns SymbolNode* - root of the tree created
-*/
-struct SymbolNode* buildTree(struct SymbolNode* head)
-{
-  struct SymbolNode* leftChild; 
-  struct SymbolNode* rightChild; 
-  struct SymbolNode* combinedNode; 
+  int nextLeaf = 0, nextCombined = 0, made;
+  int i;
 
-  while(head->next != NULL)
+  for(made = 0; made < numLeaves - 1; made++)
   {
-    leftChild = popPriority(&head); 
-    rightChild = popPriority(&head); 
-    combinedNode = combineNodes(leftChild, rightChild);
-    head = insertPriority(head, combinedNode);
-  }
+    struct SymbolNode* children[2];
+    unsigned char childLeftmost[2];
 
-  return head;
-}
+    for(i = 0; i < 2; i++)
+    {
+      int takeLeaf = nextCombined == made;
+      if(!takeLeaf && nextLeaf < numLeaves)
+      {
+        struct SymbolNode* leaf = &leaves[nextLeaf];
+        struct SymbolNode* node = &combined[nextCombined];
+        takeLeaf = leaf->freq < node->freq ||
+                   (leaf->freq == node->freq && leaf->symbol < leftmost[nextCombined]);
+      }
 
-/*
- * Given two SymbolNodes (which are also trees), combines them together into 
- * a single tree, returning the new root containing the summed frequencies. 
- 
- * struct SymbolNode* left - the left child of new tree
- * struct SymbolNode* right - the right child of new tree 
- 
- * returns SymbolNode* - root of the new tree
-*/
-struct SymbolNode* combineNodes(struct SymbolNode* left, struct SymbolNode* right)
-{
-  unsigned long newFreq = left->freq + right->freq; 
-  struct SymbolNode* newRoot = makeSymbol(newFreq, 'r');
-  
-  left->next = NULL;
-  right->next = NULL; 
-  
-  newRoot->left = left; 
-  newRoot->right = right;
+      if(takeLeaf)
+      {
+        childLeftmost[i] = leaves[nextLeaf].symbol;
+        children[i] = &leaves[nextLeaf++];
+      }
+      else
+      {
+        childLeftmost[i] = leftmost[nextCombined];
+        children[i] = &combined[nextCombined++];
+      }
+    }
 
-  return newRoot;
-}
+    combined[made].freq = children[0]->freq + children[1]->freq;
+    combined[made].symbol = 'r';
+    combined[made].length = 0;
+    combined[made].code = 0;
+    combined[made].left = children[0];
+    combined[made].right = children[1];
+    leftmost[made] = childLeftmost[0];
+  }
 
-/*
- * Pops the head off the priority queue and changes the head pointer 
- 
- * struct SymbolNode** head - reference to the head of the queue 
- 
- * returns SymbolNode* - node that got popped off
-*/
-struct SymbolNode* popPriority(struct SymbolNode** head)
-{
-  struct SymbolNode* poppedNode = *head; 
-  *head = (*head)->next; 
-  poppedNode->next = NULL; 
-  return poppedNode; 
+  return &combined[numLeaves - 2];
 }
 
 /*
@@ -169,29 +150,23 @@ struct SymbolNode* popPriority(struct SymbolNode** head)
  * struct SymbolNode* root - root of the huffman tree
  * int direction - 1 if we are going to the right
  *                 0 if we are going to the left
- * int depth - current depth of tree, useful for getting array index for code
- * unsigned char* prevCode - Code of the parent, copied
- * over into the child with an added value to represent the new direction 
+ * int depth - current depth of tree, which is the length of the parent's code
+ * uint64_t prevCode - Code of the parent, shifted over in the child with 
+ * an added bit to represent the new direction 
 */
-void fillCodes(struct SymbolNode* root, int direction, int depth, unsigned char* prevCode)
+void fillCodes(struct SymbolNode* root, int direction, int depth, uint64_t prevCode)
 {
   if(root == NULL) return;
   else if(depth == -1)
   {
-    fillCodes(root->left, 0, depth+1, root->code); 
-    fillCodes(root->right, 1, depth+1, root->code);
+    fillCodes(root->left, 0, depth+1, 0); 
+    fillCodes(root->right, 1, depth+1, 0);
   }
   else 
   {
-    int i; 
-    /* copying symbol code */
-    for(i = 0; i < depth; i++)
-    {
-      root->code[i] = prevCode[i];
-    }
     /* Updating code info for node and recursive call */
     root->length = depth+1; 
-    root->code[depth] = direction;
+    root->code = (prevCode << 1) | direction;
     fillCodes(root->left, 0, depth+1, root->code); 
     fillCodes(root->right, 1, depth+1, root->code);
   }
@@ -201,62 +176,77 @@ void fillCodes(struct SymbolNode* root, int direction, int depth, unsigned char*
  * Given an array of frequencies for symbols
  * with the value at the ith indexing representing 
  * the frequency of the character w/ ASCII value i, 
- * generates the set of codes for them. 
+ * generates the set of codes for them. Every node of the tree lives in
+ * one arena allocated along with the returned array, so freeing the 
+ * array frees the whole tree, freeTree must not be called on it.
  
  * unsigned long* freq - array of character frequencies
- * struct SymbolNode** root - Pointer to root of tree, used to clean up
- * memory in encode/decode file and useful for other operations.
+ * struct SymbolNode** root - Pointer to root of tree, useful for other
+ * operations. NULL for an empty file.
  
  * return struct SymbolNode** - an array of generated symbol 
  * nodes, holding their respective codes. Index i of the array
- * represents the symbol with ascii code i
+ * represents the symbol with ascii code i. Free with free().
 */
-struct SymbolNode** generateCodes(unsigned long* freq, struct SymbolNode** head)
+struct SymbolNode** generateCodes(unsigned long* freq, struct SymbolNode** root)
 {
-  struct SymbolNode** symbols = (struct SymbolNode**)calloc(256, sizeof(struct SymbolNode*));
-  struct SymbolNode* locHead = NULL;
-  int i;
-
-  for(i = 0; i < 256; i++)
-  {
-    if(freq[i] != 0)
-    {
-      struct SymbolNode* new = makeSymbol(freq[i], (unsigned char)i);
-      locHead = insertPriority(locHead, new);
-      symbols[i] = new;
-    }
-  }
-
-  locHead = buildTree(locHead);
-  fillCodes(locHead, 0, -1, locHead->code);
-  
-  *head = locHead;
-  return symbols; 
+  struct CodeArena* arena = (struct CodeArena*)malloc(sizeof(struct CodeArena));
+  return buildCodes(arena, freq, root);
 }
 
 /* 
- * Given a head to a priority queue, prints out 
- * information about all the nodes in the queue.
+ * Generates the set of codes for an array of frequencies like 
+ * generateCodes, building the tree in an arena the caller already has
+ * so that building codes over and over doesn't allocate anything.
+ 
+ * struct CodeArena* arena - where the tree gets built, its old tree is lost
+ * const unsigned long* freq - array of character frequencies
+ * struct SymbolNode** root - set to the root of the tree, NULL for an empty file
  
- * SymbolNode* head - head of priority queue
+ * return struct SymbolNode** - the arena's array of symbol nodes, index i
+ * being the symbol with ascii code i, NULL if it doesn't appear
 */
-void printPriority(struct SymbolNode* head)
+struct SymbolNode** buildCodes(struct CodeArena* arena, const unsigned long* freq,
+                               struct SymbolNode** root)
 {
-  unsigned long freq;
-  unsigned char symbol;
+  struct SymbolNode* leaves = arena->nodes;
+  struct SymbolNode* combined;
+  unsigned char leftmost[ARENA_NODES / 2]; /* leftmost symbol of each combined node */
+  unsigned char symbols[256]; /* symbols that appear, lightest first */
+  int numLeaves = sortSymbols(freq, symbols);
+  int i;
 
-  if(head == NULL)
+  for(i = 0; i < 256; i++) arena->symbols[i] = NULL;
+  for(i = 0; i < numLeaves; i++)
   {
-  printf("\n");
-  return; 
+    leaves[i].freq = freq[symbols[i]];
+    leaves[i].symbol = symbols[i];
+    leaves[i].length = 0;
+    leaves[i].code = 0;
+    leaves[i].left = NULL;
+    leaves[i].right = NULL;
+    arena->symbols[symbols[i]] = &leaves[i];
   }
 
-  freq = head->freq; 
-  symbol = head->symbol;
-  
-  if(symbol < 33 || symbol > 126) printf("=%d  %lu\n", symbol, freq);
-  else printf("%c  %lu\n", symbol, freq); 
-  printPriority(head->next); 
+  /* Nothing to build a tree out of for an empty file */
+  if(numLeaves == 0)
+  {
+    *root = NULL;
+    return arena->symbols;
+  }
+
+  /* A lone symbol still needs one bit so there is something to decode */
+  if(numLeaves == 1)
+  {
+    leaves[0].length = 1;
+    *root = &leaves[0];
+    return arena->symbols;
+  }
+
+  combined = leaves + numLeaves;
+  *root = buildTree(leaves, numLeaves, combined, leftmost);
+  fillCodes(*root, 0, -1, 0);
+  return arena->symbols; 
 }
 
 /*
@@ -273,7 +263,7 @@ void printTree(struct SymbolNode* root, int level)
   if(root->left == NULL && root->right == NULL)
   {
     printf("Leaf %c at Depth %d Code ", root->symbol, level);
-    for(i = 0; i < root->length; i++) printf("%d", root->code[i]);
+    for(i = root->length - 1; i >= 0; i--) printf("%d", (int)((root->code >> i) & 1));
     printf("\n");
     return; 
   }
@@ -282,7 +272,9 @@ void printTree(struct SymbolNode* root, int level)
 }
 
 /* 
- * Given the root of a huffman tree, frees all of the nodes for the given tree
+ * Given the root of a huffman tree read from a file, frees all of the nodes 
+ * for the given tree. Trees from generateCodes are freed along with their
+ * array of codes instead.
  
  * struct SymbolNode* root - root of the huffman tree
 */
@@ -296,17 +288,21 @@ void freeTree(struct SymbolNode* root)
 
 /*
  * Inserts into the tree a new symbol node. The new symbol node needs to have
- * the correct code in order to be inserted. Creates new nodes along the way 
- * as needed. Call function with a depth of '0'.
+ * the correct length and its code is given as it was stored in the file,
+ * since codes read from a file may be longer than the node can hold.
+ * Creates new nodes along the way as needed. Call function with a depth of '0'.
  
  * struct SymbolNode* root - root of huffman tree
  * struct SymbolNode* newNode - node to insert 
+ * const unsigned char* code - code packed 8 bits per byte, first bit being
+ * the highest bit of the first byte
  * int depth - pass in 0, but is used to keep place in code for the 
  * recursive calls.
  
  * return struct SymbolNode* - used to update links in tree when making new nodes 
 */
-struct SymbolNode* insertTree(struct SymbolNode* root, struct SymbolNode* newNode, int depth)
+struct SymbolNode* insertTree(struct SymbolNode* root, struct SymbolNode* newNode,
+                              const unsigned char* code, int depth)
 {
   /* If we arrive at where the node should be placed, place it.
    * Create a new node if need be. */
@@ -314,8 +310,11 @@ struct SymbolNode* insertTree(struct SymbolNode* root, struct SymbolNode* newNod
   else if(root == NULL) root = makeSymbol(0, 'r');
   
   /* Go left or right depending on code, update root links */
-  if(newNode->code[depth] == 0) root->left = insertTree(root->left, newNode, depth+1);
-  else root->right = insertTree(root->right, newNode, depth+1); 
+  if(((code[depth/8] >> (7 - depth%8)) & 1) == 0)
+  {
+    root->left = insertTree(root->left, newNode, code, depth+1);
+  }
+  else root->right = insertTree(root->right, newNode, code, depth+1); 
 
   return root; 
 }
@@ -333,3 +332,175 @@ int isLeaf(struct SymbolNode* node)
   if(node->left == NULL && node->right == NULL) return 1; 
   else return 0;
 }
+
+/*
+ * Assigns the canonical huffman codes for a set of code lengths. Symbols are
+ * ordered by code length and then by value, the first gets a code of all 
+ * zeroes and every following code is the previous code plus one, shifted 
+ * left whenever the length grows. Since only the lengths decide the codes, 
+ * they are all that needs to be stored to rebuild them.
+ 
+ * const unsigned char* lengths - code length of each of the 256 symbols,
+ * 0 for symbols that don't appear. No longer than MAX_CODE_LENGTH.
+ * uint64_t* codes - array of 256 filled with the code for each symbol, 
+ * right aligned. Codes of unused symbols are set to 0.
+ 
+ * returns int - how many symbols have codes
+ *               -1 if the lengths are too long or over-subscribed
+*/
+int canonicalCodes(const unsigned char* lengths, uint64_t* codes)
+{
+  unsigned int lengthCount[MAX_CODE_LENGTH+1];
+  uint64_t nextCode[MAX_CODE_LENGTH+1];
+  uint64_t code = 0;
+  unsigned long left = 1; /* codes still free at the current length */
+  int numSymbols = 0;
+  int i;
+
+  for(i = 0; i <= MAX_CODE_LENGTH; i++) lengthCount[i] = 0;
+  for(i = 0; i < 256; i++)
+  {
+    if(lengths[i] > MAX_CODE_LENGTH) return -1;
+    lengthCount[lengths[i]]++;
+  }
+  lengthCount[0] = 0;
+
+  /* Making sure the lengths can actually form a prefix code. Once more codes
+   * are free than there are symbols, there's no need to keep counting up */
+  for(i = 1; i <= MAX_CODE_LENGTH; i++)
+  {
+    left <<= 1;
+    if(lengthCount[i] > left) return -1;
+    left -= lengthCount[i];
+    if(left > 256) left = 512;
+  }
+
+  /* First code of each length */
+  for(i = 1; i <= MAX_CODE_LENGTH; i++)
+  {
+    code = (code + lengthCount[i-1]) << 1;
+    nextCode[i] = code;
+  }
+
+  for(i = 0; i < 256; i++)
+  {
+    codes[i] = 0;
+    if(lengths[i] != 0)
+    {
+      codes[i] = nextCode[lengths[i]]++;
+      numSymbols++;
+    }
+  }
+
+  return numSymbols;
+}
+
+/*
+ * Finds the best code lengths for a set of frequencies when no code may 
+ * be longer than maxLength, using the package-merge algorithm. Every 
+ * symbol starts as an item at each of maxLength levels. Going from the 
+ * deepest level up, the items of a level are paired off into packages in
+ * order of weight, and the packages are merged in with the symbols of the
+ * next level. The lightest 2n-2 items of the top level, opened back up 
+ * into the symbols they hold, give each symbol its code length: one for 
+ * every level it got picked at.
+ 
+ * struct CodeArena* arena - scratch memory, its tree is left alone
+ * const unsigned long* freq - frequency of each of the 256 symbols
+ * unsigned char* lengths - array of 256 filled with each symbol's code length
+ * int maxLength - longest code allowed, from MIN_LENGTH_LIMIT up to MAX_CODE_LENGTH
+ 
+ * returns int - 1 if the lengths were found
+ *               0 if maxLength is out of range
+*/
+int limitCodeLengths(struct CodeArena* arena, const unsigned long* freq, unsigned char* lengths,
+                     int maxLength)
+{
+  unsigned char symbols[256]; /* symbols that appear, lightest first */
+  unsigned char (*isPackage)[512] = arena->isPackage;
+  uint64_t weights[512], prevWeights[512];
+  int listLength[MAX_CODE_LENGTH];
+  int numSymbols;
+  int i, level, take;
+
+  if(maxLength < MIN_LENGTH_LIMIT || maxLength > MAX_CODE_LENGTH) return 0;
+
+  for(i = 0; i < 256; i++) lengths[i] = 0;
+  numSymbols = sortSymbols(freq, symbols);
+  if(numSymbols == 1) lengths[symbols[0]] = 1;
+  if(numSymbols <= 1) return 1;
+
+  /* The deepest level holds only the symbols */
+  for(i = 0; i < numSymbols; i++)
+  {
+    weights[i] = freq[symbols[i]];
+    isPackage[maxLength-1][i] = 0;
+  }
+  listLength[maxLength-1] = numSymbols;
+
+  for(level = maxLength - 2; level >= 0; level--)
+  {
+    int numPackages = listLength[level+1] / 2;
+    int leaf = 0, package = 0, used = 0;
+
+    for(i = 0; i < listLength[level+1]; i++) prevWeights[i] = weights[i];
+
+    /* Merging the symbols with the packages, symbols first on a tie */
+    while(leaf < numSymbols || package < numPackages)
+    {
+      uint64_t packageWeight = 0;
+      if(package < numPackages) packageWeight = prevWeights[2*package] + prevWeights[2*package+1];
+
+      if(package == numPackages || (leaf < numSymbols && freq[symbols[leaf]] <= packageWeight))
+      {
+        weights[used] = freq[symbols[leaf++]];
+        isPackage[level][used++] = 0;
+      }
+      else
+      {
+        weights[used] = packageWeight;
+        isPackage[level][used++] = 1;
+        package++;
+      }
+    }
+    listLength[level] = used;
+  }
+
+  /* Opening up the picked items a level at a time, the symbols picked at a
+   * level are always the lightest ones and packages take two items below */
+  take = 2 * numSymbols - 2;
+  for(level = 0; level < maxLength && take > 0; level++)
+  {
+    int leaves = 0, packages = 0;
+    for(i = 0; i < take && i < listLength[level]; i++)
+    {
+      if(isPackage[level][i]) packages++;
+      else leaves++;
+    }
+    for(i = 0; i < leaves; i++) lengths[symbols[i]]++;
+    take = 2 * packages;
+  }
+
+  return 1;
+}
+
+/*
+ * Copies the codes out of the symbol nodes into a flat table, which is
+ * all the encoder needs to look at while writing out symbols.
+ 
+ * struct SymbolNode** codes - array of symbol nodes, ith index is the node 
+ * representing symbol w/ASCII value i, NULL if the symbol doesn't appear.
+ * struct CodeTable* table - table to fill in
+*/
+void buildCodeTable(struct SymbolNode** codes, struct CodeTable* table)
+{
+  int i;
+  for(i = 0; i < 256; i++)
+  {
+    table->code[i] = 0;
+    table->length[i] = 0;
+    if(codes[i] == NULL) continue;
+    table->code[i] = codes[i]->code;
+    table->length[i] = codes[i]->length;
+  }
+}